@@ -0,0 +1,191 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <array>
+#include <unordered_map>
+#include <functional>
+
+namespace sirius {
+
+    /// \brief copy on write sharded hash map for one writer and snapshot readers.
+    ///        the writer owns the map; snapshot() captures the current content with
+    ///        one shared_ptr copy, and the snapshot stays valid and unchanged while
+    ///        the writer goes on. after a snapshot the first write to a shard copies
+    ///        that shard only, so the copy cost is spread over later writes.
+    ///        snapshot() is called by the writer, the snapshot may then be read and
+    ///        dropped on any thread. whether a shard is shared is known from the
+    ///        snapshots taken, not from use_count(), which does not order the writer
+    ///        after the last reads of a snapshot dropped on another thread. a shard
+    ///        taken by a snapshot is never written in place again.
+    ///        not thread safe for several writers.
+    template<typename KEY, typename VALUE, uint32_t SHARD_COUNT = 256, typename HASH = std::hash<KEY>>
+    class CowShardedMap {
+        static_assert(SHARD_COUNT > 0, "Invalid SHARD_COUNT parameters.");
+    public:
+        typedef std::unordered_map<KEY, VALUE, HASH> Shard;
+
+    private:
+        struct Root {
+            std::array<std::shared_ptr<Shard>, SHARD_COUNT> shards;
+            size_t size = 0;
+        };
+
+    public:
+        /// \brief immutable view of the map at the time snapshot() was called.
+        class Snapshot {
+        public:
+            Snapshot() = default;
+
+            size_t size() const {
+                return _root ? _root->size : 0;
+            }
+
+            template<typename F>
+            void for_each(F &&func) const {
+                if (!_root) {
+                    return;
+                }
+                for (auto &shard: _root->shards) {
+                    for (auto &pair: *shard) {
+                        func(pair.first, pair.second);
+                    }
+                }
+            }
+
+        private:
+            friend class CowShardedMap;
+
+            explicit Snapshot(std::shared_ptr<const Root> root) : _root(std::move(root)) {}
+
+            std::shared_ptr<const Root> _root;
+        };
+
+        CowShardedMap() {
+            clear();
+        }
+
+        size_t size() const {
+            return _root->size;
+        }
+
+        bool contains(const KEY &key) const {
+            auto &shard = *_root->shards[shard_idx(key)];
+            return shard.find(key) != shard.end();
+        }
+
+        /// \return nullptr if not exist
+        const VALUE *seek(const KEY &key) const {
+            auto &shard = *_root->shards[shard_idx(key)];
+            auto it = shard.find(key);
+            if (it == shard.end()) {
+                return nullptr;
+            }
+            return &it->second;
+        }
+
+        /// \brief insert or overwrite.
+        void set(const KEY &key, const VALUE &value) {
+            auto &shard = mutable_shard(shard_idx(key));
+            auto ret = shard.insert_or_assign(key, value);
+            if (ret.second) {
+                ++_root->size;
+            }
+        }
+
+        /// \brief reference to the value, default constructed if not exist.
+        ///        the reference is invalid after the next snapshot().
+        VALUE &operator[](const KEY &key) {
+            auto &shard = mutable_shard(shard_idx(key));
+            auto ret = shard.try_emplace(key);
+            if (ret.second) {
+                ++_root->size;
+            }
+            return ret.first->second;
+        }
+
+        bool erase(const KEY &key) {
+            uint32_t idx = shard_idx(key);
+            if (_root->shards[idx]->count(key) == 0) {
+                return false;
+            }
+            mutable_shard(idx).erase(key);
+            --_root->size;
+            return true;
+        }
+
+        void clear() {
+            _root = std::make_shared<Root>();
+            for (auto &shard: _root->shards) {
+                shard = std::make_shared<Shard>();
+            }
+            _root_epoch = _epoch;
+            _shard_epochs.fill(_epoch);
+        }
+
+        void reserve(size_t count) {
+            for (uint32_t i = 0; i < SHARD_COUNT; ++i) {
+                mutable_shard(i).reserve(count / SHARD_COUNT + 1);
+            }
+        }
+
+        Snapshot snapshot() const {
+            // everything the writer owns is shared from now on
+            ++_epoch;
+            return Snapshot(_root);
+        }
+
+        template<typename F>
+        void for_each(F &&func) const {
+            snapshot().for_each(std::forward<F>(func));
+        }
+
+    private:
+        uint32_t shard_idx(const KEY &key) const {
+            return _hash(key) % SHARD_COUNT;
+        }
+
+        /// copy the root and the shard if a snapshot was taken since the writer copied them
+        Shard &mutable_shard(uint32_t idx) {
+            if (_root_epoch != _epoch) {
+                _root = std::make_shared<Root>(*_root);
+                _root_epoch = _epoch;
+            }
+            auto &shard = _root->shards[idx];
+            if (_shard_epochs[idx] != _epoch) {
+                shard = std::make_shared<Shard>(*shard);
+                _shard_epochs[idx] = _epoch;
+            }
+            return *shard;
+        }
+
+    private:
+        std::shared_ptr<Root> _root;
+        HASH _hash;
+        // bumped by every snapshot, the root and a shard are owned by the writer only
+        // while their epoch equals it. touched by the writer only
+        mutable uint64_t _epoch{0};
+        uint64_t _root_epoch{0};
+        std::array<uint64_t, SHARD_COUNT> _shard_epochs{};
+    };
+
+}  // namespace sirius
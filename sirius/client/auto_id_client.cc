@@ -0,0 +1,241 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <sirius/client/auto_id_client.h>
+#include <algorithm>
+
+namespace sirius::client {
+
+    turbo::Status AutoIdClient::init(const std::string &raft_nodes) {
+        if (_is_inited) {
+            return turbo::OkStatus();
+        }
+        auto rs = _sender.init(raft_nodes);
+        if (!rs.ok()) {
+            return rs;
+        }
+        _is_inited = true;
+        return turbo::OkStatus();
+    }
+
+    AutoIdClient &AutoIdClient::set_buffer_size(uint64_t size) {
+        if (size > 0) {
+            _buffer_size = size;
+        }
+        return *this;
+    }
+
+    AutoIdClient &AutoIdClient::set_refill_percent(int percent) {
+        _refill_percent = std::clamp(percent, 0, 100);
+        return *this;
+    }
+
+    turbo::Status AutoIdClient::gen_id(int64_t servlet_id, uint64_t &start_id, uint64_t count) {
+        if (!_is_inited) {
+            return turbo::unavailable_error("auto id client not init");
+        }
+        if (count == 0) {
+            return turbo::invalid_argument_error("id count should be positive");
+        }
+        if (count > _buffer_size) {
+            uint64_t end_id = 0;
+            return fetch(servlet_id, count, start_id, end_id);
+        }
+        auto buffer = get_buffer(servlet_id);
+        uint64_t watermark = _buffer_size * _refill_percent / 100;
+        turbo::Status rs;
+        bool waited = false;
+        uint64_t waited_seq = 0;
+        fiber_mutex_lock(&buffer->mutex);
+        while (true) {
+            if (buffer->end_id - buffer->next_id < count && buffer->standby_end > buffer->standby_start) {
+                // the rest of the served range is skipped, ids stay unique and increasing
+                buffer->next_id = buffer->standby_start;
+                buffer->end_id = buffer->standby_end;
+                buffer->standby_start = buffer->standby_end = 0;
+            }
+            if (buffer->end_id - buffer->next_id >= count) {
+                start_id = buffer->next_id;
+                buffer->next_id += count;
+                if (!buffer->refilling
+                    && buffer->standby_end == buffer->standby_start
+                    && buffer->end_id - buffer->next_id <= watermark) {
+                    schedule_refill(servlet_id, buffer);
+                }
+                break;
+            }
+            // the refill we waited for failed, do not retry it in a loop
+            if (waited && buffer->refill_seq != waited_seq && !buffer->refill_status.ok()) {
+                rs = buffer->refill_status;
+                break;
+            }
+            if (!buffer->refilling) {
+                schedule_refill(servlet_id, buffer);
+            }
+            waited = true;
+            waited_seq = buffer->refill_seq;
+            fiber_cond_wait(&buffer->cond, &buffer->mutex);
+        }
+        fiber_mutex_unlock(&buffer->mutex);
+        return rs;
+    }
+
+    void AutoIdClient::reset(int64_t servlet_id) {
+        auto buffer = get_buffer(servlet_id);
+        fiber_mutex_lock(&buffer->mutex);
+        ++buffer->generation;
+        buffer->next_id = buffer->end_id = 0;
+        buffer->standby_start = buffer->standby_end = 0;
+        fiber_mutex_unlock(&buffer->mutex);
+    }
+
+    std::shared_ptr<AutoIdClient::IdBuffer> AutoIdClient::get_buffer(int64_t servlet_id) {
+        std::unique_lock<std::mutex> lock(_buffer_mutex);
+        auto &buffer = _buffers[servlet_id];
+        if (buffer == nullptr) {
+            buffer = std::make_shared<IdBuffer>();
+        }
+        return buffer;
+    }
+
+    void AutoIdClient::schedule_refill(int64_t servlet_id, const std::shared_ptr<IdBuffer> &buffer) {
+        buffer->refilling = true;
+        {
+            std::unique_lock<std::mutex> lock(_refill_mutex);
+            _refills.push_back({servlet_id, buffer, buffer->generation});
+            if (_in_flight) {
+                return;
+            }
+            _in_flight = true;
+        }
+        Fiber bth;
+        bth.run([this] {
+            flush();
+        });
+    }
+
+    void AutoIdClient::flush() {
+        while (true) {
+            std::vector<RefillTask> batch;
+            {
+                std::unique_lock<std::mutex> lock(_refill_mutex);
+                if (_refills.empty()) {
+                    _in_flight = false;
+                    return;
+                }
+                if (_refills.size() <= static_cast<size_t>(kMaxRefillBatch)) {
+                    batch.swap(_refills);
+                } else {
+                    batch.assign(_refills.begin(), _refills.begin() + kMaxRefillBatch);
+                    _refills.erase(_refills.begin(), _refills.begin() + kMaxRefillBatch);
+                }
+            }
+            refill_batch(batch);
+        }
+    }
+
+    void AutoIdClient::refill_batch(std::vector<RefillTask> &batch) {
+        struct RefillResult {
+            turbo::Status status;
+            uint64_t start_id{0};
+            uint64_t end_id{0};
+        };
+        std::vector<RefillResult> results(batch.size());
+        if (batch.size() == 1) {
+            results[0].status = fetch(batch[0].servlet_id, _buffer_size, results[0].start_id, results[0].end_id);
+        } else {
+            sirius::proto::DiscoveryManagerRequest request;
+            sirius::proto::DiscoveryManagerResponse response;
+            request.set_op_type(sirius::proto::OP_BATCH_GEN_ID_FOR_AUTO_INCREMENT);
+            for (auto &task: batch) {
+                auto *sub_request = request.add_sub_requests();
+                sub_request->set_op_type(sirius::proto::OP_GEN_ID_FOR_AUTO_INCREMENT);
+                sub_request->mutable_auto_increment()->set_servlet_id(task.servlet_id);
+                sub_request->mutable_auto_increment()->set_count(_buffer_size);
+            }
+            auto rs = _sender.discovery_manager(request, response);
+            if (rs.ok() && response.errcode() != sirius::proto::SUCCESS) {
+                rs = turbo::unavailable_error(response.errmsg());
+            }
+            if (rs.ok() && response.sub_responses_size() != request.sub_requests_size()) {
+                rs = turbo::unavailable_error("sub responses do not match sub requests");
+            }
+            if (!rs.ok()) {
+                LOG(WARNING) << "gen id batch fail, servlets:" << batch.size() << " error:" << rs.message();
+            }
+            for (size_t i = 0; i < batch.size(); ++i) {
+                if (!rs.ok()) {
+                    results[i].status = rs;
+                    continue;
+                }
+                auto &sub_response = response.sub_responses(static_cast<int>(i));
+                if (sub_response.errcode() != sirius::proto::SUCCESS) {
+                    LOG(WARNING) << "gen id fail, servlet_id:" << batch[i].servlet_id << " count:" << _buffer_size
+                                 << " error:" << sub_response.errmsg();
+                    results[i].status = turbo::unavailable_error(sub_response.errmsg());
+                    continue;
+                }
+                results[i].start_id = sub_response.start_id();
+                results[i].end_id = sub_response.end_id();
+            }
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            auto &buffer = batch[i].buffer;
+            auto &result = results[i];
+            fiber_mutex_lock(&buffer->mutex);
+            buffer->refilling = false;
+            ++buffer->refill_seq;
+            buffer->refill_status = result.status;
+            // a range fetched before reset is dropped
+            if (result.status.ok() && buffer->generation == batch[i].generation) {
+                if (buffer->end_id == buffer->next_id) {
+                    buffer->next_id = result.start_id;
+                    buffer->end_id = result.end_id;
+                } else if (buffer->standby_end == buffer->standby_start) {
+                    buffer->standby_start = result.start_id;
+                    buffer->standby_end = result.end_id;
+                }
+            }
+            fiber_cond_broadcast(&buffer->cond);
+            fiber_mutex_unlock(&buffer->mutex);
+        }
+    }
+
+    turbo::Status AutoIdClient::fetch(int64_t servlet_id, uint64_t count, uint64_t &start_id, uint64_t &end_id) {
+        sirius::proto::DiscoveryManagerRequest request;
+        sirius::proto::DiscoveryManagerResponse response;
+        request.set_op_type(sirius::proto::OP_GEN_ID_FOR_AUTO_INCREMENT);
+        auto *increment_info = request.mutable_auto_increment();
+        increment_info->set_servlet_id(servlet_id);
+        increment_info->set_count(count);
+        auto rs = _sender.discovery_manager(request, response);
+        if (rs.ok() && response.errcode() != sirius::proto::SUCCESS) {
+            rs = turbo::unavailable_error(response.errmsg());
+        }
+        if (!rs.ok()) {
+            LOG(WARNING) << "gen id fail, servlet_id:" << servlet_id << " count:" << count
+                         << " error:" << rs.message();
+            return rs;
+        }
+        start_id = response.start_id();
+        end_id = response.end_id();
+        return turbo::OkStatus();
+    }
+
+}  // namespace sirius::client
@@ -0,0 +1,176 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <turbo/utility/status.h>
+#include <sirius/proto/discovery.interface.pb.h>
+#include <sirius/client/discovery_sender.h>
+#include <sirius/base/fiber.h>
+
+namespace sirius::client {
+
+    /**
+     * @ingroup ea_rpc
+     * @brief AutoIdClient is used to get auto increment ids of servlets from the auto increment raft group.
+     *        It keeps two local ranges per servlet_id, the one being served and a standby one.
+     *        When the served range drops below the refill watermark, the standby range is filled
+     *        in a background fiber, so callers only block on an rpc when both ranges are used up.
+     *        Refills due at the same time for different servlet_ids are sent together in one
+     *        OP_BATCH_GEN_ID_FOR_AUTO_INCREMENT rpc by one background flush, up to kMaxRefillBatch
+     *        servlet_ids per rpc. Ids returned are unique and increasing per servlet_id in one process,
+     *        but not continuous, the unused part of a range is skipped when it can not hold a request.
+     *        It keeps its own DiscoverySender, because the auto increment leader may differ
+     *        from the discovery leader.
+     * @code
+     *      AutoIdClient::get_instance()->init("127.0.0.1:8010");
+     *      uint64_t start_id;
+     *      auto rs = AutoIdClient::get_instance()->gen_id(servlet_id, start_id, 10);
+     *      if(!rs.ok()) {
+     *          LOG(ERROR) << "gen id error:" << rs.message();
+     *          return;
+     *      }
+     * @endcode
+     */
+    class AutoIdClient {
+    public:
+        static const uint64_t kDefaultBufferSize = 1000;
+        static const int kDefaultRefillPercent = 20;
+        static const int kMaxRefillBatch = 256;
+
+        static AutoIdClient *get_instance() {
+            static AutoIdClient ins;
+            return &ins;
+        }
+
+        AutoIdClient() = default;
+
+        /**
+         * @brief init is used to initialize the AutoIdClient. It must be called before using the AutoIdClient.
+         * @param raft_nodes [input] is the raft nodes of the discovery server.
+         * @return Status::OK if the AutoIdClient was initialized successfully. Otherwise, an error status is returned.
+         */
+        turbo::Status init(const std::string &raft_nodes);
+
+        /**
+         * @brief sender is used to tune the underlying DiscoverySender, eg. timeout and retry.
+         * @return the DiscoverySender used by the AutoIdClient.
+         */
+        DiscoverySender &sender() {
+            return _sender;
+        }
+
+        /**
+         * @brief set_buffer_size is used to set the number of ids fetched by one refill.
+         *        It should be called before any gen_id.
+         * @param size [input] is the number of ids fetched by one refill, must be positive.
+         * @return AutoIdClient itself.
+         */
+        AutoIdClient &set_buffer_size(uint64_t size);
+
+        /**
+         * @brief set_refill_percent is used to set the watermark of the background refill.
+         *        It should be called before any gen_id.
+         * @param percent [input] the standby range is filled once the served range drops below
+         *        this percent of the buffer size, in [0, 100].
+         * @return AutoIdClient itself.
+         */
+        AutoIdClient &set_refill_percent(int percent);
+
+        /**
+         * @brief gen_id is used to get count continuous ids of a servlet, it blocks the calling
+         *        fiber only when the local ranges are used up. Requests larger than the buffer
+         *        size are sent to the server directly.
+         * @param servlet_id [input] is the servlet id, its auto increment must be added on the server.
+         * @param start_id [output] is the first id of the range [start_id, start_id + count).
+         * @param count [input] is the number of ids, must be positive.
+         * @return Status::OK if the ids were allocated. Otherwise, an error status is returned.
+         */
+        turbo::Status gen_id(int64_t servlet_id, uint64_t &start_id, uint64_t count = 1);
+
+        /**
+         * @brief reset is used to drop the local ranges of a servlet, eg. after its
+         *        auto increment was updated or dropped on the server.
+         * @param servlet_id [input] is the servlet id.
+         */
+        void reset(int64_t servlet_id);
+
+    private:
+        struct IdBuffer {
+            IdBuffer() {
+                fiber_mutex_init(&mutex, nullptr);
+                fiber_cond_init(&cond, nullptr);
+            }
+
+            ~IdBuffer() {
+                fiber_cond_destroy(&cond);
+                fiber_mutex_destroy(&mutex);
+            }
+
+            fiber_mutex_t mutex;  // protect all fields
+            fiber_cond_t cond;    // signaled when a refill finishes
+            uint64_t next_id{0};
+            uint64_t end_id{0};
+            uint64_t standby_start{0};
+            uint64_t standby_end{0};
+            bool refilling{false};
+            // bumped when a refill finishes, with the status of that refill
+            uint64_t refill_seq{0};
+            turbo::Status refill_status;
+            // bumped by reset, a refill started before it is dropped
+            uint64_t generation{0};
+        };
+
+        struct RefillTask {
+            int64_t servlet_id;
+            std::shared_ptr<IdBuffer> buffer;
+            uint64_t generation;
+        };
+
+        std::shared_ptr<IdBuffer> get_buffer(int64_t servlet_id);
+
+        /// queue a refill of the standby range, buffer mutex is held by the caller
+        void schedule_refill(int64_t servlet_id, const std::shared_ptr<IdBuffer> &buffer);
+
+        /// send queued refills until the queue is empty
+        void flush();
+
+        /// fetch ranges for all tasks in one rpc and install them into the buffers
+        void refill_batch(std::vector<RefillTask> &batch);
+
+        /// fetch count ids of a servlet from the server
+        turbo::Status fetch(int64_t servlet_id, uint64_t count, uint64_t &start_id, uint64_t &end_id);
+
+    private:
+        DiscoverySender _sender;
+        std::mutex _buffer_mutex;
+        std::unordered_map<int64_t, std::shared_ptr<IdBuffer>> _buffers;
+        std::mutex _refill_mutex;
+        std::vector<RefillTask> _refills;
+        bool _in_flight{false};
+        uint64_t _buffer_size{kDefaultBufferSize};
+        int _refill_percent{kDefaultRefillPercent};
+        bool _is_inited{false};
+    };
+
+}  // namespace sirius::client
@@ -25,6 +25,7 @@
 #include <sirius/client/loader.h>
 #include <sirius/client/dumper.h>
 #include <turbo/strings/substitute.h>
+#include <algorithm>
 
 namespace sirius::client {
 
@@ -1320,5 +1321,113 @@ namespace sirius::client {
 
     }
 
+    turbo::Status DiscoveryClient::batch_manager(const std::vector<sirius::proto::DiscoveryManagerRequest> &requests,
+                                                 std::vector<sirius::proto::DiscoveryManagerResponse> &responses,
+                                                 int *retry_time) {
+        if (requests.empty()) {
+            return turbo::OkStatus();
+        }
+        if (requests.size() > static_cast<size_t>(kMaxBatchOps)) {
+            return turbo::invalid_argument_error("too many requests in one batch");
+        }
+        sirius::proto::DiscoveryManagerRequest request;
+        sirius::proto::DiscoveryManagerResponse response;
+        request.set_op_type(sirius::proto::OP_BATCH);
+        for (auto &sub_request: requests) {
+            *request.add_sub_requests() = sub_request;
+        }
+        auto rs = discovery_manager(request, response, retry_time);
+        if (!rs.ok()) {
+            return rs;
+        }
+        responses.assign(response.sub_responses().begin(), response.sub_responses().end());
+        if (response.errcode() != sirius::proto::SUCCESS) {
+            return turbo::unavailable_error(response.errmsg());
+        }
+        return turbo::OkStatus();
+    }
+
+    turbo::Status DiscoveryClient::bulk_create_by_json(const std::vector<std::string> &app_jsons,
+                                                       const std::vector<std::string> &zone_jsons,
+                                                       const std::vector<std::string> &servlet_jsons,
+                                                       int *retry_time) {
+        std::vector<sirius::proto::DiscoveryManagerRequest> requests;
+        requests.reserve(app_jsons.size() + zone_jsons.size() + servlet_jsons.size());
+        for (auto &json_str: app_jsons) {
+            auto &request = requests.emplace_back();
+            request.set_op_type(sirius::proto::OP_CREATE_NAMESPACE);
+            auto rs = Loader::load_proto(json_str, *request.mutable_app_info());
+            if (!rs.ok()) {
+                return rs;
+            }
+        }
+        for (auto &json_str: zone_jsons) {
+            auto &request = requests.emplace_back();
+            request.set_op_type(sirius::proto::OP_CREATE_ZONE);
+            auto rs = Loader::load_proto(json_str, *request.mutable_zone_info());
+            if (!rs.ok()) {
+                return rs;
+            }
+        }
+        for (auto &json_str: servlet_jsons) {
+            auto &request = requests.emplace_back();
+            request.set_op_type(sirius::proto::OP_CREATE_SERVLET);
+            auto rs = Loader::load_proto(json_str, *request.mutable_servlet_info());
+            if (!rs.ok()) {
+                return rs;
+            }
+        }
+        return send_in_batches(requests, retry_time);
+    }
+
+    turbo::Status DiscoveryClient::bulk_create_by_file(const std::vector<std::string> &app_paths,
+                                                       const std::vector<std::string> &zone_paths,
+                                                       const std::vector<std::string> &servlet_paths,
+                                                       int *retry_time) {
+        std::vector<sirius::proto::DiscoveryManagerRequest> requests;
+        requests.reserve(app_paths.size() + zone_paths.size() + servlet_paths.size());
+        for (auto &path: app_paths) {
+            auto &request = requests.emplace_back();
+            request.set_op_type(sirius::proto::OP_CREATE_NAMESPACE);
+            auto rs = Loader::load_proto_from_file(path, *request.mutable_app_info());
+            if (!rs.ok()) {
+                return rs;
+            }
+        }
+        for (auto &path: zone_paths) {
+            auto &request = requests.emplace_back();
+            request.set_op_type(sirius::proto::OP_CREATE_ZONE);
+            auto rs = Loader::load_proto_from_file(path, *request.mutable_zone_info());
+            if (!rs.ok()) {
+                return rs;
+            }
+        }
+        for (auto &path: servlet_paths) {
+            auto &request = requests.emplace_back();
+            request.set_op_type(sirius::proto::OP_CREATE_SERVLET);
+            auto rs = Loader::load_proto_from_file(path, *request.mutable_servlet_info());
+            if (!rs.ok()) {
+                return rs;
+            }
+        }
+        return send_in_batches(requests, retry_time);
+    }
+
+    turbo::Status DiscoveryClient::send_in_batches(const std::vector<sirius::proto::DiscoveryManagerRequest> &requests,
+                                                   int *retry_time) {
+        for (size_t start = 0; start < requests.size(); start += kMaxBatchOps) {
+            size_t end = std::min(requests.size(), start + static_cast<size_t>(kMaxBatchOps));
+            std::vector<sirius::proto::DiscoveryManagerRequest> batch(requests.begin() + start,
+                                                                      requests.begin() + end);
+            std::vector<sirius::proto::DiscoveryManagerResponse> responses;
+            auto rs = batch_manager(batch, responses, retry_time);
+            if (!rs.ok()) {
+                return turbo::unavailable_error(turbo::substitute("batch of requests [$0, $1) fail: $2",
+                                                                  start, end, rs.message()));
+            }
+        }
+        return turbo::OkStatus();
+    }
+
 }  // namespace sirius::client
 
@@ -26,6 +26,7 @@
 #include <melon/rpc/server.h>
 #include <melon/rpc/controller.h>
 #include <string>
+#include <vector>
 #include <sirius/base/log.h>
 #include <sirius/flags/sirius.h>
 #include <google/protobuf/descriptor.h>
@@ -73,6 +74,9 @@ namespace sirius::client {
      */
     class DiscoveryClient {
     public:
+        /// max sub requests in one batch, the same as the default of sirius_batch_max_ops
+        static const int kMaxBatchOps = 1000;
+
         static DiscoveryClient *get_instance() {
             static DiscoveryClient ins;
             return &ins;
@@ -881,6 +885,47 @@ namespace sirius::client {
                           const std::string &json_path,
                           int *retry_time = nullptr);
 
+        /**
+         * @brief batch_manager is used to send several DiscoveryManagerRequests in one rpc, it is a synchronous call.
+         *        They are applied in order as one raft entry, either all or none of them take effect.
+         * @param requests [input] are the requests to send, at most kMaxBatchOps of them.
+         * @param responses [output] are the results of the requests, in request order.
+         * @param retry_time [input] is the retry times of the batch.
+         * @return Status::OK if all requests were applied. Otherwise, an error status is returned.
+         */
+        turbo::Status batch_manager(const std::vector<sirius::proto::DiscoveryManagerRequest> &requests,
+                                    std::vector<sirius::proto::DiscoveryManagerResponse> &responses,
+                                    int *retry_time = nullptr);
+
+        /**
+         * @brief bulk_create_by_json is used to create apps, zones and servlets by json strings in batches,
+         *        it is a synchronous call. Apps are created first, then zones, then servlets. Each batch of
+         *        kMaxBatchOps requests is applied atomically, a failed batch stops the import.
+         * @param app_jsons [input] are the json strings of the apps to create.
+         * @param zone_jsons [input] are the json strings of the zones to create.
+         * @param servlet_jsons [input] are the json strings of the servlets to create.
+         * @param retry_time [input] is the retry times of each batch.
+         * @return Status::OK if all were created successfully. Otherwise, an error status is returned.
+         */
+        turbo::Status bulk_create_by_json(const std::vector<std::string> &app_jsons,
+                                          const std::vector<std::string> &zone_jsons,
+                                          const std::vector<std::string> &servlet_jsons,
+                                          int *retry_time = nullptr);
+
+        /**
+         * @brief bulk_create_by_file is used to create apps, zones and servlets by json files in batches,
+         *        it is a synchronous call. See bulk_create_by_json.
+         * @param app_paths [input] are the paths of the json files of the apps to create.
+         * @param zone_paths [input] are the paths of the json files of the zones to create.
+         * @param servlet_paths [input] are the paths of the json files of the servlets to create.
+         * @param retry_time [input] is the retry times of each batch.
+         * @return Status::OK if all were created successfully. Otherwise, an error status is returned.
+         */
+        turbo::Status bulk_create_by_file(const std::vector<std::string> &app_paths,
+                                          const std::vector<std::string> &zone_paths,
+                                          const std::vector<std::string> &servlet_paths,
+                                          int *retry_time = nullptr);
+
         /**
          * @brief discovery_manager is used to send a DiscoveryManagerRequest to the meta server.
          * @param request [input] is the DiscoveryManagerRequest to send.
@@ -902,6 +947,10 @@ namespace sirius::client {
                                  sirius::proto::DiscoveryQueryResponse &response, int *retry_time);
 
     private:
+        /// send requests in batches of kMaxBatchOps, stop at the first failed batch
+        turbo::Status send_in_batches(const std::vector<sirius::proto::DiscoveryManagerRequest> &requests,
+                                      int *retry_time);
+
         BaseMessageSender *_sender;
     };
 
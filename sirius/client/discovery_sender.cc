@@ -63,22 +63,43 @@ namespace sirius::client {
 
     turbo::Status DiscoverySender::discovery_query(const sirius::proto::DiscoveryQueryRequest &request,
                                          sirius::proto::DiscoveryQueryResponse &response, int retry_times) {
-        return send_request("discovery_query", request, response, retry_times);
+        return send_read_request("discovery_query", request, response, retry_times);
     }
 
     turbo::Status DiscoverySender::discovery_query(const sirius::proto::DiscoveryQueryRequest &request,
                                          sirius::proto::DiscoveryQueryResponse &response) {
-        return send_request("discovery_query", request, response, _retry_times);
+        return send_read_request("discovery_query", request, response, _retry_times);
     }
 
     turbo::Status DiscoverySender::discovery_naming(const sirius::proto::ServletNamingRequest &request,
                                     sirius::proto::ServletNamingResponse &response, int retry_time) {
-        return send_request("naming", request, response, retry_time);
+        if (request.has_servlets_in_attachment()) {
+            return send_read_request("naming", request, response, retry_time);
+        }
+        // servlets in the attachment are served from the cached bytes as is
+        sirius::proto::ServletNamingRequest attachment_request(request);
+        attachment_request.set_servlets_in_attachment(true);
+        return send_read_request("naming", attachment_request, response, retry_time);
     }
 
     turbo::Status DiscoverySender::discovery_naming(const sirius::proto::ServletNamingRequest &request,
                                                      sirius::proto::ServletNamingResponse &response) {
-        return send_request("naming", request, response, _retry_times);
+        return discovery_naming(request, response, _retry_times);
+    }
+
+    turbo::Status DiscoverySender::discovery_heartbeat(const sirius::proto::ServletHeartbeatRequest &request,
+                                                        sirius::proto::ServletHeartbeatResponse &response) {
+        return send_request("heartbeat", request, response, _retry_times);
+    }
+
+    turbo::Status DiscoverySender::discovery_watch(const sirius::proto::ServletNamingRequest &request,
+                                                    sirius::proto::ServletNamingResponse &response) {
+        sirius::proto::ServletNamingRequest watch_request(request);
+        if (!watch_request.has_servlets_in_attachment()) {
+            watch_request.set_servlets_in_attachment(true);
+        }
+        watch_request.set_watch_timeout_ms(std::min<int64_t>(watch_request.watch_timeout_ms(), _request_timeout / 2));
+        return send_read_request("watch", watch_request, response, _retry_times);
     }
 
 
@@ -107,5 +128,10 @@ namespace sirius::client {
         return *this;
     }
 
+    DiscoverySender &DiscoverySender::set_read_from_peers(bool enable) {
+        _read_from_peers = enable;
+        return *this;
+    }
+
 }  // sirius::client
 
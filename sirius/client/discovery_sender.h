@@ -24,9 +24,12 @@
 #include <melon/rpc/server.h>
 #include <melon/rpc/controller.h>
 #include <google/protobuf/descriptor.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <melon/utility/iobuf.h>
 #include <sirius/proto/discovery.interface.pb.h>
 #include <sirius/base/log.h>
 #include <sirius/client/base_message_sender.h>
+#include <algorithm>
 
 namespace sirius::client {
 
@@ -130,6 +133,17 @@ namespace sirius::client {
          */
         DiscoverySender &set_retry_time(int retry);
 
+        /**
+         * @brief set_read_from_peers is used to spread query and naming requests over all peers
+         *        instead of sending them to the leader. Requests sent this way are marked linearizable,
+         *        a follower confirms the read index with the leader before it answers, unless the
+         *        request sets max_staleness_ms, then any peer heard from the leader recently enough
+         *        answers from memory.
+         * @param enable [input] is the flag.
+         * @return DiscoverySender itself.
+         */
+        DiscoverySender &set_read_from_peers(bool enable);
+
         /**
          * @brief get_leader is used to get the leader address of the meta server.
          * @return the leader address of the meta server.
@@ -175,27 +189,66 @@ namespace sirius::client {
         turbo::Status discovery_query(const sirius::proto::DiscoveryQueryRequest &request,
                                  sirius::proto::DiscoveryQueryResponse &response) override;
 
+        /**
+         * @brief discovery_naming asks for the servlets in the response attachment unless the request
+         *        sets servlets_in_attachment itself, they are merged back into response.
+         *        set known_version to the version of a previous response to get not_modified instead
+         *        of the same servlets again.
+         */
         turbo::Status discovery_naming(const sirius::proto::ServletNamingRequest &request,
                                   sirius::proto::ServletNamingResponse &response, int retry_time) override;
 
         turbo::Status discovery_naming(const sirius::proto::ServletNamingRequest &request,
                                         sirius::proto::ServletNamingResponse &response) override;
 
+        /**
+         * @brief discovery_heartbeat is used to renew the leases of registered servlets on the leader.
+         *        It writes nothing to raft, call it well within the lease_ms of the response.
+         * @param request [input] is the ServletHeartbeatRequest to send.
+         * @param response [output] is the ServletHeartbeatResponse received from the meta server.
+         * @return Status::OK if the request was sent successfully. Otherwise, an error status is returned.
+         */
+        turbo::Status discovery_heartbeat(const sirius::proto::ServletHeartbeatRequest &request,
+                                          sirius::proto::ServletHeartbeatResponse &response);
+
+        /**
+         * @brief discovery_watch is naming that waits on the server until the servlets differ from
+         *        request.known_version, or watch_timeout_ms passes and not_modified comes back.
+         *        Pass the version of the last response as known_version of the next call, it holds
+         *        on any peer. ctime and mtime are not part of it, a change of them alone is not reported.
+         *        watch_timeout_ms is cut to half of the request timeout, so the rpc does not time out first.
+         * @param request [input] is the ServletNamingRequest to send.
+         * @param response [output] is the ServletNamingResponse received from the meta server.
+         * @return Status::OK if the request was sent successfully. Otherwise, an error status is returned.
+         */
+        turbo::Status discovery_watch(const sirius::proto::ServletNamingRequest &request,
+                                      sirius::proto::ServletNamingResponse &response);
+
         /**
          * @brief send_request is used to send a request to the meta server.
          * @param service_name [input] is the name of the service to send the request to.
          * @param request [input] is the request to send.
          * @param response [output] is the response received from the meta server.
          * @param retry_times [input] is the number of times to retry sending the request.
+         * @param any_peer [input] the first try goes to a random peer instead of the leader.
          * @return Status::OK if the request was sent successfully. Otherwise, an error status is returned. 
          */
         template<typename Request, typename Response>
         turbo::Status send_request(const std::string &service_name,
                                    const Request &request,
-                                   Response &response, int retry_times);
+                                   Response &response, int retry_times, bool any_peer = false);
 
     private:
 
+        /**
+         * @brief send_read_request sends a query or naming request, spread over peers
+         *        as linearizable reads if read_from_peers is set.
+         */
+        template<typename Request, typename Response>
+        turbo::Status send_read_request(const std::string &service_name,
+                                        const Request &request,
+                                        Response &response, int retry_times);
+
         /**
          *
          * @param addr
@@ -214,12 +267,39 @@ namespace sirius::client {
         int _between_meta_connect_error_ms{1000};
         int _retry_times{kRetryTimes};
         bool _verbose{false};
+        bool _read_from_peers{false};
     };
 
+    /// retry after hint of a RETRY_LATER response, only raft bound writes carry one
+    inline int64_t retry_after_ms(const sirius::proto::DiscoveryManagerResponse &response) {
+        return response.retry_after_ms();
+    }
+
+    template<typename Response>
+    inline int64_t retry_after_ms(const Response &) {
+        return 0;
+    }
+
+    /// naming servlets sent in the attachment are merged back, callers always read them from the response
+    inline bool merge_attachment(melon::Controller &cntl, sirius::proto::ServletNamingResponse &response) {
+        if (!response.servlets_in_attachment()) {
+            return true;
+        }
+        response.clear_servlets_in_attachment();
+        mutil::IOBufAsZeroCopyInputStream wrapper(cntl.response_attachment());
+        google::protobuf::io::CodedInputStream coded(&wrapper);
+        return response.MergePartialFromCodedStream(&coded);
+    }
+
+    template<typename Response>
+    inline bool merge_attachment(melon::Controller &, Response &) {
+        return true;
+    }
+
     template<typename Request, typename Response>
     inline turbo::Status DiscoverySender::send_request(const std::string &service_name,
                                                   const Request &request,
-                                                  Response &response, int retry_times) {
+                                                  Response &response, int retry_times, bool any_peer) {
         const ::google::protobuf::ServiceDescriptor *service_desc = sirius::proto::DiscoveryService::descriptor();
         const ::google::protobuf::MethodDescriptor *method =
                 service_desc->FindMethodByName(service_name);
@@ -229,9 +309,13 @@ namespace sirius::client {
         }
         int retry_time = 0;
         bool is_select_leader{false};
+        int64_t backoff_ms{0};
         uint64_t log_id = mutil::fast_rand();
         do {
-            if (!is_select_leader && retry_time > 0 && _between_meta_connect_error_ms > 0) {
+            if (backoff_ms > 0) {
+                fiber_usleep(1000 * backoff_ms);
+                backoff_ms = 0;
+            } else if (!is_select_leader && retry_time > 0 && _between_meta_connect_error_ms > 0) {
                 fiber_usleep(1000 * _between_meta_connect_error_ms);
             }
             melon::Controller cntl;
@@ -243,7 +327,12 @@ namespace sirius::client {
             channel_opt.timeout_ms = _request_timeout;
             channel_opt.connect_timeout_ms = _connect_timeout;
             melon::Channel short_channel;
-            is_select_leader = leader_address.ip == mutil::IP_ANY;
+            // a read may be answered by any peer, only its first try is spread
+            bool is_select_peer = any_peer && retry_time == 0;
+            is_select_leader = !is_select_peer && leader_address.ip == mutil::IP_ANY;
+            if (is_select_peer) {
+                leader_address = _servlet_nodes[mutil::fast_rand() % _servlet_nodes.size()];
+            }
             //store has leader address
             if (is_select_leader) {
                 LOG_IF(INFO, _verbose) << "master address null, select leader first";
@@ -264,13 +353,17 @@ namespace sirius::client {
             if (cntl.Failed()) {
                 LOG(ERROR) << "connect with server fail. send request fail, error:" << cntl.ErrorText()
                                           << ", log_id:" << cntl.log_id();
-                set_leader_address(mutil::EndPoint());
+                if (!is_select_peer) {
+                    set_leader_address(mutil::EndPoint());
+                }
                 ++retry_time;
                 continue;
             }
             if (response.errcode() == sirius::proto::HAVE_NOT_INIT) {
                 LOG_IF(WARNING, _verbose) << "connect with server fail. HAVE_NOT_INIT  log_id:" << cntl.log_id();
-                set_leader_address(mutil::EndPoint());
+                if (!is_select_peer) {
+                    set_leader_address(mutil::EndPoint());
+                }
                 ++retry_time;
                 continue;
             }
@@ -284,8 +377,21 @@ namespace sirius::client {
                 ++retry_time;
                 continue;
             }
+            if (response.errcode() == sirius::proto::RETRY_LATER) {
+                // the leader is overloaded, wait as told, with jitter so rejected clients spread out
+                int64_t hint_ms = std::max<int64_t>(retry_after_ms(response), 1);
+                backoff_ms = hint_ms + static_cast<int64_t>(mutil::fast_rand_less_than(hint_ms + 1));
+                LOG_IF(WARNING, _verbose) << "server busy, retry after " << backoff_ms << "ms, log_id:" << cntl.log_id();
+                ++retry_time;
+                continue;
+            }
+            if (!merge_attachment(cntl, response)) {
+                LOG(ERROR) << "parse response attachment fail, log_id:" << cntl.log_id();
+                ++retry_time;
+                continue;
+            }
             /// success, The node being tried happens to be leader
-            if (_master_leader_address.ip == mutil::IP_ANY && leader_address.ip != mutil::IP_ANY) {
+            if (!is_select_peer && _master_leader_address.ip == mutil::IP_ANY && leader_address.ip != mutil::IP_ANY) {
                 LOG_IF(INFO, _verbose) << "set leader ip:" << mutil::endpoint2str(leader_address).c_str();
                 set_leader_address(leader_address);
             }
@@ -294,5 +400,21 @@ namespace sirius::client {
         return turbo::unavailable_error("can not connect server after times try");
     }
 
+    template<typename Request, typename Response>
+    inline turbo::Status DiscoverySender::send_read_request(const std::string &service_name,
+                                                            const Request &request,
+                                                            Response &response, int retry_times) {
+        if (!_read_from_peers) {
+            return send_request(service_name, request, response, retry_times);
+        }
+        // a request that sets its own consistency, linearizable or bounded staleness, goes as is
+        if (request.linearizable() || request.has_max_staleness_ms()) {
+            return send_request(service_name, request, response, retry_times, true);
+        }
+        Request linearizable_request(request);
+        linearizable_request.set_linearizable(true);
+        return send_request(service_name, linearizable_request, response, retry_times, true);
+    }
+
 
 }  // namespace sirius::client
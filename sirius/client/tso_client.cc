@@ -0,0 +1,144 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <sirius/client/tso_client.h>
+
+namespace sirius::client {
+
+    turbo::Status TsoClient::init(const std::string &raft_nodes) {
+        if (_is_inited) {
+            return turbo::OkStatus();
+        }
+        auto rs = _sender.init(raft_nodes);
+        if (!rs.ok()) {
+            return rs;
+        }
+        _is_inited = true;
+        return turbo::OkStatus();
+    }
+
+    TsoClient &TsoClient::set_max_batch_count(int64_t count) {
+        _max_batch_count = count;
+        return *this;
+    }
+
+    TsoClient &TsoClient::set_domain(const std::string &domain) {
+        _domain = domain;
+        return *this;
+    }
+
+    turbo::Status TsoClient::gen_tso(sirius::proto::TsoTimestamp &start, int64_t count) {
+        FiberCond cond;
+        turbo::Status result;
+        cond.increase();
+        gen_tso_async(count, [&cond, &result, &start](const turbo::Status &status,
+                                                      const sirius::proto::TsoTimestamp &ts) {
+            result = status;
+            start.CopyFrom(ts);
+            cond.decrease_signal();
+        });
+        cond.wait();
+        return result;
+    }
+
+    void TsoClient::gen_tso_async(int64_t count, const TsoCallback &callback) {
+        if (!_is_inited) {
+            callback(turbo::unavailable_error("tso client not init"), sirius::proto::TsoTimestamp());
+            return;
+        }
+        if (count <= 0 || count > _max_batch_count) {
+            callback(turbo::invalid_argument_error("tso count should be in (0, max_batch_count]"),
+                     sirius::proto::TsoTimestamp());
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(_waiter_mutex);
+            _waiters.push_back({count, callback});
+            _waiter_count += count;
+            if (_in_flight) {
+                return;
+            }
+            _in_flight = true;
+        }
+        Fiber bth;
+        bth.run([this] {
+            flush();
+        });
+    }
+
+    void TsoClient::flush() {
+        while (true) {
+            std::vector<TsoWaiter> batch;
+            int64_t total = 0;
+            {
+                std::unique_lock<std::mutex> lock(_waiter_mutex);
+                if (_waiters.empty()) {
+                    _in_flight = false;
+                    return;
+                }
+                if (_waiter_count <= _max_batch_count) {
+                    batch.swap(_waiters);
+                    total = _waiter_count;
+                    _waiter_count = 0;
+                } else {
+                    size_t n = 0;
+                    while (n < _waiters.size() && total + _waiters[n].count <= _max_batch_count) {
+                        total += _waiters[n].count;
+                        ++n;
+                    }
+                    batch.assign(std::make_move_iterator(_waiters.begin()),
+                                 std::make_move_iterator(_waiters.begin() + n));
+                    _waiters.erase(_waiters.begin(), _waiters.begin() + n);
+                    _waiter_count -= total;
+                }
+            }
+            send_batch(batch, total);
+        }
+    }
+
+    void TsoClient::send_batch(std::vector<TsoWaiter> &batch, int64_t total) {
+        sirius::proto::TsoRequest request;
+        sirius::proto::TsoResponse response;
+        request.set_op_type(sirius::proto::OP_GEN_TSO);
+        request.set_count(total);
+        if (!_domain.empty()) {
+            request.set_domain(_domain);
+        }
+        auto rs = _sender.send_request("tso_service", request, response, DiscoverySender::kRetryTimes);
+        if (rs.ok() && response.errcode() != sirius::proto::SUCCESS) {
+            rs = turbo::unavailable_error(response.errmsg());
+        }
+        if (!rs.ok()) {
+            LOG(WARNING) << "gen tso fail, count:" << total << " error:" << rs.message();
+            for (auto &waiter: batch) {
+                waiter.callback(rs, sirius::proto::TsoTimestamp());
+            }
+            return;
+        }
+        int64_t offset = 0;
+        for (auto &waiter: batch) {
+            sirius::proto::TsoTimestamp ts;
+            ts.set_physical(response.start_timestamp().physical());
+            ts.set_logical(response.start_timestamp().logical() + offset);
+            offset += waiter.count;
+            waiter.callback(rs, ts);
+        }
+    }
+
+}  // namespace sirius::client
@@ -0,0 +1,139 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <turbo/utility/status.h>
+#include <sirius/proto/discovery.interface.pb.h>
+#include <sirius/client/discovery_sender.h>
+#include <sirius/base/fiber.h>
+
+namespace sirius::client {
+
+    /**
+     * @brief TsoCallback is called when a timestamp range is allocated or failed.
+     *        The range is [start, start + count) in logical part with the same physical part.
+     */
+    typedef std::function<void(const turbo::Status &status, const sirius::proto::TsoTimestamp &start)> TsoCallback;
+
+    /**
+     * @ingroup ea_rpc
+     * @brief TsoClient is used to get timestamps from the tso raft group.
+     *        All concurrent local callers are coalesced into one in-flight rpc,
+     *        the count field carries the sum of the callers, and the returned
+     *        range is split among them. Callers arriving while an rpc is in flight
+     *        are queued for the next one, so there is at most one rpc on the wire.
+     *        It keeps its own DiscoverySender, because the tso leader may differ
+     *        from the discovery leader.
+     * @code
+     *      TsoClient::get_instance()->init("127.0.0.1:8010");
+     *      sirius::proto::TsoTimestamp ts;
+     *      auto rs = TsoClient::get_instance()->gen_tso(ts);
+     *      if(!rs.ok()) {
+     *          LOG(ERROR) << "gen tso error:" << rs.message();
+     *          return;
+     *      }
+     * @endcode
+     */
+    class TsoClient {
+    public:
+        static const int64_t kMaxBatchCount = 4096;
+
+        static TsoClient *get_instance() {
+            static TsoClient ins;
+            return &ins;
+        }
+
+        TsoClient() = default;
+
+        /**
+         * @brief init is used to initialize the TsoClient. It must be called before using the TsoClient.
+         * @param raft_nodes [input] is the raft nodes of the discovery server.
+         * @return Status::OK if the TsoClient was initialized successfully. Otherwise, an error status is returned.
+         */
+        turbo::Status init(const std::string &raft_nodes);
+
+        /**
+         * @brief sender is used to tune the underlying DiscoverySender, eg. timeout and retry.
+         * @return the DiscoverySender used by the TsoClient.
+         */
+        DiscoverySender &sender() {
+            return _sender;
+        }
+
+        /**
+         * @brief set_max_batch_count is used to set the max sum of count in one rpc.
+         *        It must stay below the logical space of the tso server.
+         * @param count [input] is the max sum of count in one rpc.
+         * @return TsoClient itself.
+         */
+        TsoClient &set_max_batch_count(int64_t count);
+
+        /**
+         * @brief set_domain is used to choose the tso domain, the empty name is the default domain.
+         *        It should be called before any gen_tso.
+         * @param domain [input] is the name of the tso domain.
+         * @return TsoClient itself.
+         */
+        TsoClient &set_domain(const std::string &domain);
+
+        /**
+         * @brief gen_tso is used to get count timestamps, it blocks the calling fiber
+         *        until the shared rpc returns.
+         * @param start [output] is the first timestamp of the range.
+         * @param count [input] is the number of timestamps, must be positive.
+         * @return Status::OK if the timestamps were allocated. Otherwise, an error status is returned.
+         */
+        turbo::Status gen_tso(sirius::proto::TsoTimestamp &start, int64_t count = 1);
+
+        /**
+         * @brief gen_tso_async is used to get count timestamps without blocking,
+         *        callback is called in the fiber which finishes the shared rpc.
+         * @param count [input] is the number of timestamps, must be positive.
+         * @param callback [input] is called with the result, it should not block.
+         */
+        void gen_tso_async(int64_t count, const TsoCallback &callback);
+
+    private:
+        struct TsoWaiter {
+            int64_t count;
+            TsoCallback callback;
+        };
+
+        /// send queued waiters until the queue is empty
+        void flush();
+
+        /// send one rpc for the batch and dispatch the result
+        void send_batch(std::vector<TsoWaiter> &batch, int64_t total);
+
+    private:
+        DiscoverySender _sender;
+        std::mutex _waiter_mutex;
+        std::vector<TsoWaiter> _waiters;
+        int64_t _waiter_count{0};
+        bool _in_flight{false};
+        int64_t _max_batch_count{kMaxBatchCount};
+        std::string _domain;
+        bool _is_inited{false};
+    };
+
+}  // namespace sirius::client
@@ -0,0 +1,66 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <sirius/discovery/access_log.h>
+#include <atomic>
+#include <sirius/flags/sirius.h>
+#include <sirius/base/log.h>
+
+namespace sirius::discovery {
+
+    static std::atomic<uint64_t> g_access_count{0};
+
+    static bool is_slow(const AccessRecord &record) {
+        return FLAGS_sirius_slow_request_ms > 0 && record.total_time_us >= FLAGS_sirius_slow_request_ms * 1000;
+    }
+
+    bool AccessLog::sampled(const AccessRecord &record) {
+        if (record.errcode != sirius::proto::SUCCESS || is_slow(record)) {
+            return true;
+        }
+        int32_t rate = FLAGS_sirius_access_log_sample_rate;
+        if (rate <= 0) {
+            return false;
+        }
+        return g_access_count.fetch_add(1, std::memory_order_relaxed) % rate == 0;
+    }
+
+    void AccessLog::write(const AccessRecord &record,
+                          const google::protobuf::Message *request,
+                          const google::protobuf::Message *response) {
+        bool failed = record.errcode != sirius::proto::SUCCESS;
+        if (!failed && !is_slow(record)) {
+            LOG(INFO) << "access op:" << sirius::proto::OpType_Name(record.op_type)
+                      << " errcode:" << sirius::proto::ErrCode_Name(record.errcode)
+                      << " raft_us:" << record.raft_time_us << " total_us:" << record.total_time_us
+                      << " request_size:" << record.request_size
+                      << " remote_side:" << mutil::endpoint2str(record.remote_side).c_str();
+            return;
+        }
+        LOG(WARNING) << "access op:" << sirius::proto::OpType_Name(record.op_type)
+                     << " errcode:" << sirius::proto::ErrCode_Name(record.errcode)
+                     << " raft_us:" << record.raft_time_us << " total_us:" << record.total_time_us
+                     << " request_size:" << record.request_size
+                     << " remote_side:" << mutil::endpoint2str(record.remote_side).c_str()
+                     << (failed ? " failed" : " slow")
+                     << " request:" << (request ? request->ShortDebugString() : std::string())
+                     << " response:" << (response ? response->ShortDebugString() : std::string());
+    }
+
+}  // namespace sirius::discovery
@@ -0,0 +1,53 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <cstdint>
+#include <google/protobuf/message.h>
+#include <melon/utility/endpoint.h>
+#include <sirius/proto/discovery.interface.pb.h>
+
+namespace sirius::discovery {
+
+    /// \brief what the access log keeps of one raft write request, filled
+    ///        without formatting the request.
+    struct AccessRecord {
+        sirius::proto::OpType op_type{sirius::proto::OP_NONE};
+        sirius::proto::ErrCode errcode{sirius::proto::SUCCESS};
+        int64_t raft_time_us{0};
+        int64_t total_time_us{0};
+        size_t request_size{0};
+        mutil::EndPoint remote_side;
+    };
+
+    /// \brief sampled access log of the raft write path. failed requests and requests
+    ///        slower than sirius_slow_request_ms are always logged with the request and
+    ///        response, others one of every sirius_access_log_sample_rate without them.
+    class AccessLog {
+    public:
+        /// \brief cheap check done for every request, only sampled requests are formatted.
+        static bool sampled(const AccessRecord &record);
+
+        static void write(const AccessRecord &record,
+                          const google::protobuf::Message *request,
+                          const google::protobuf::Message *response);
+    };
+
+}  // namespace sirius::discovery
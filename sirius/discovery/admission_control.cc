@@ -0,0 +1,92 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <sirius/discovery/admission_control.h>
+#include <algorithm>
+#include <cmath>
+#include <sirius/flags/sirius.h>
+#include <sirius/flags/engine.h>
+
+namespace sirius::discovery {
+
+    AdmissionController::AdmissionController(const std::string &name) :
+            _reject_in_flight("sirius_" + name + "_admission_reject_in_flight"),
+            _reject_token("sirius_" + name + "_admission_reject_token") {
+        fiber_mutex_init(&_bucket_mutex, nullptr);
+    }
+
+    AdmissionController::~AdmissionController() {
+        fiber_mutex_destroy(&_bucket_mutex);
+    }
+
+    int64_t AdmissionController::admit(sirius::proto::OpType op_type) {
+        int64_t limit = FLAGS_sirius_max_in_flight_applies;
+        int64_t op_limit = FLAGS_sirius_max_in_flight_applies_per_op;
+        if (FLAGS_qos_need_reject != 0 && limit > 0) {
+            // one op type may not take more than qos_reject_ratio of the state machine
+            int64_t share = limit * FLAGS_qos_reject_ratio / 100;
+            op_limit = op_limit > 0 ? std::min(op_limit, share) : share;
+        }
+        // in flight is always counted, so release does not depend on the limits
+        int64_t in_flight = _in_flight.fetch_add(1, std::memory_order_relaxed);
+        int64_t op_in_flight = _op_in_flight[op_type].fetch_add(1, std::memory_order_relaxed);
+        if ((limit > 0 && in_flight >= limit) || (op_limit > 0 && op_in_flight >= op_limit)) {
+            release(op_type);
+            _reject_in_flight << 1;
+            return std::max(FLAGS_sirius_admission_retry_after_ms, 1);
+        }
+        if (FLAGS_use_token_bucket != 0) {
+            int64_t wait_ms = take_tokens(std::max<int64_t>(FLAGS_get_token_weight, 1));
+            if (wait_ms > 0) {
+                release(op_type);
+                _reject_token << 1;
+                return wait_ms;
+            }
+        }
+        return 0;
+    }
+
+    void AdmissionController::release(sirius::proto::OpType op_type) {
+        _op_in_flight[op_type].fetch_sub(1, std::memory_order_relaxed);
+        _in_flight.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    int64_t AdmissionController::take_tokens(int64_t tokens) {
+        double rate = static_cast<double>(FLAGS_max_tokens_per_second);
+        if (rate <= 0) {
+            return 0;
+        }
+        double capacity = std::max(rate * FLAGS_token_bucket_burst_window_ms / 1000.0,
+                                   static_cast<double>(tokens));
+        int64_t now_us = mutil::gettimeofday_us();
+        MELON_SCOPED_LOCK(_bucket_mutex);
+        if (_last_refill_us == 0) {
+            _tokens = capacity;
+        } else {
+            _tokens = std::min(capacity, _tokens + (now_us - _last_refill_us) * rate / 1000000.0);
+        }
+        _last_refill_us = now_us;
+        if (_tokens >= tokens) {
+            _tokens -= tokens;
+            return 0;
+        }
+        return std::max<int64_t>(1, static_cast<int64_t>(std::ceil((tokens - _tokens) * 1000.0 / rate)));
+    }
+
+}  // namespace sirius::discovery
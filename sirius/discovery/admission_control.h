@@ -0,0 +1,63 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <melon/var/var.h>
+#include <sirius/base/fiber.h>
+#include <sirius/proto/discovery.interface.pb.h>
+
+namespace sirius::discovery {
+
+    /// \brief admission control for raft bound writes on the leader. a write is admitted
+    ///        when the in flight applies of its state machine and of its op type are under
+    ///        their limits and, with use_token_bucket on, the token bucket has tokens left.
+    ///        a rejected write is answered with RETRY_LATER and a retry after hint.
+    class AdmissionController {
+    public:
+        explicit AdmissionController(const std::string &name);
+
+        ~AdmissionController();
+
+        /// \brief try to admit one write, an admitted write must be released once its
+        ///        closure runs.
+        /// \return 0 if admitted, otherwise the suggested retry after in ms
+        int64_t admit(sirius::proto::OpType op_type);
+
+        void release(sirius::proto::OpType op_type);
+
+    private:
+        /// \return 0 if the tokens were taken, otherwise ms until they are available
+        int64_t take_tokens(int64_t tokens);
+
+        std::atomic<int64_t> _in_flight{0};
+        std::array<std::atomic<int64_t>, sirius::proto::OpType_ARRAYSIZE> _op_in_flight{};
+
+        fiber_mutex_t _bucket_mutex;  // protect the token bucket
+        double _tokens{0};
+        int64_t _last_refill_us{0};
+
+        melon::var::Adder<int64_t> _reject_in_flight;
+        melon::var::Adder<int64_t> _reject_token;
+    };
+
+}  // namespace sirius::discovery
@@ -63,7 +63,7 @@ namespace sirius::discovery {
         set_app_info(app_info);
         set_max_app_id(tmp_app_id);
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(INFO) << "create app success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "create app success, request:" << request.ShortDebugString();
     }
 
     void AppManager::drop_app(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done) {
@@ -92,7 +92,7 @@ namespace sirius::discovery {
 
         erase_app_info(app_name);
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(INFO) << "drop app success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "drop app success, request:" << request.ShortDebugString();
     }
 
     void AppManager::modify_app(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done) {
@@ -109,6 +109,9 @@ namespace sirius::discovery {
         if (app_info.has_quota()) {
             tmp_info.set_quota(app_info.quota());
         }
+        if (app_info.has_lease_ms()) {
+            tmp_info.set_lease_ms(app_info.lease_ms());
+        }
         tmp_info.set_version(tmp_info.version() + 1);
 
         std::string app_value;
@@ -126,7 +129,7 @@ namespace sirius::discovery {
 
         set_app_info(tmp_info);
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(INFO) << "modify app success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "modify app success, request:" << request.ShortDebugString();
     }
 
     int AppManager::load_app_snapshot(const std::string &value) {
@@ -29,9 +29,189 @@
 #include <melon/raft/storage.h>
 #include "turbo/strings/numbers.h"
 #include <sirius/base/fiber.h>
+#include <sirius/discovery/binary_snapshot.h>
+#include <sirius/discovery/closure_pipeline.h>
+#include <sirius/flags/sirius.h>
+#include <algorithm>
 
 namespace sirius::discovery {
+
+    const std::string AutoIncrStateMachine::SNAPSHOT_MAX_ID_FILE_WITH_SLASH = "/max_id.bin";
+    const std::string AutoIncrStateMachine::SNAPSHOT_MAX_ID_JSON_FILE_WITH_SLASH = "/max_id.json";
+
+    void AutoIncrStateMachine::process(google::protobuf::RpcController *controller,
+                                       const sirius::proto::DiscoveryManagerRequest *request,
+                                       sirius::proto::DiscoveryManagerResponse *response,
+                                       google::protobuf::Closure *done) {
+        if (request->op_type() == sirius::proto::OP_BATCH_GEN_ID_FOR_AUTO_INCREMENT) {
+            bool has_floor = std::any_of(request->sub_requests().begin(), request->sub_requests().end(),
+                                         [](const sirius::proto::DiscoveryManagerRequest &sub_request) {
+                                             return sub_request.auto_increment().has_start_id();
+                                         });
+            if (FLAGS_sirius_auto_incr_segment_size <= 0 || has_floor || !_is_leader) {
+                BaseStateMachine::process(controller, request, response, done);
+                return;
+            }
+            melon::ClosureGuard done_guard(done);
+            for (auto &sub_request: request->sub_requests()) {
+                gen_id_from_segment(sub_request, response->add_sub_responses());
+            }
+            response->set_op_type(request->op_type());
+            response->set_errcode(sirius::proto::SUCCESS);
+            response->set_errmsg("success");
+            return;
+        }
+        // a start_id asks for ids above a floor, which a cached segment can not promise
+        if (request->op_type() != sirius::proto::OP_GEN_ID_FOR_AUTO_INCREMENT
+            || FLAGS_sirius_auto_incr_segment_size <= 0
+            || request->auto_increment().has_start_id()
+            || !_is_leader) {
+            BaseStateMachine::process(controller, request, response, done);
+            return;
+        }
+        melon::ClosureGuard done_guard(done);
+        gen_id_from_segment(*request, response);
+    }
+
+    void AutoIncrStateMachine::gen_id_from_segment(const sirius::proto::DiscoveryManagerRequest &request,
+                                                   sirius::proto::DiscoveryManagerResponse *response) {
+        int64_t servlet_id = request.auto_increment().servlet_id();
+        uint64_t count = request.auto_increment().count();
+        uint64_t segment_size = static_cast<uint64_t>(FLAGS_sirius_auto_incr_segment_size);
+        auto segment = get_segment(servlet_id);
+        MELON_SCOPED_LOCK(segment->mutex);
+        int64_t generation = segment->generation.load();
+        if (segment->filled_generation != generation) {
+            segment->next_id = segment->end_id = 0;
+            segment->prefetch_start = segment->prefetch_end = 0;
+            segment->filled_generation = generation;
+        }
+        if (segment->end_id - segment->next_id < count && segment->prefetch_end > segment->prefetch_start) {
+            // the rest of the current segment is skipped, ids stay unique and increasing
+            segment->next_id = segment->prefetch_start;
+            segment->end_id = segment->prefetch_end;
+            segment->prefetch_start = segment->prefetch_end = 0;
+        }
+        if (segment->end_id - segment->next_id < count) {
+            if (reserve_segment(servlet_id, std::max(segment_size, count), response) != 0) {
+                // a servlet without counter must not leave a segment behind
+                if (response->errcode() == sirius::proto::INPUT_PARAM_ERROR) {
+                    drop_segment(servlet_id, segment);
+                }
+                return;
+            }
+            segment->next_id = response->start_id();
+            segment->end_id = response->end_id();
+        }
+        response->set_errcode(sirius::proto::SUCCESS);
+        response->set_op_type(request.op_type());
+        response->set_start_id(segment->next_id);
+        response->set_end_id(segment->next_id + count);
+        response->set_errmsg("SUCCESS");
+        segment->next_id += count;
+
+        uint64_t watermark = segment_size * std::clamp(FLAGS_sirius_auto_incr_prefetch_percent, 0, 100) / 100;
+        if (!segment->prefetching
+            && segment->prefetch_end == segment->prefetch_start
+            && segment->end_id - segment->next_id <= watermark) {
+            segment->prefetching = true;
+            Fiber bth(&FIBER_ATTR_SMALL);
+            bth.run([this, servlet_id, segment, generation]() {
+                prefetch_segment(servlet_id, segment, generation);
+            });
+        }
+    }
+
+    int AutoIncrStateMachine::reserve_segment(int64_t servlet_id, uint64_t count,
+                                              sirius::proto::DiscoveryManagerResponse *response) {
+        sirius::proto::DiscoveryManagerRequest request;
+        request.set_op_type(sirius::proto::OP_GEN_ID_FOR_AUTO_INCREMENT);
+        request.mutable_auto_increment()->set_servlet_id(servlet_id);
+        request.mutable_auto_increment()->set_count(count);
+        mutil::IOBuf data;
+        mutil::IOBufAsZeroCopyOutputStream wrapper(&data);
+        if (!request.SerializeToZeroCopyStream(&wrapper)) {
+            LOG(ERROR) << "serialize gen id request fail, servlet_id:" << servlet_id;
+            response->set_errcode(sirius::proto::INTERNAL_ERROR);
+            response->set_errmsg("serialize request fail");
+            return -1;
+        }
+        FiberCond sync_cond;
+        sync_cond.increase();
+        DiscoveryServerClosure *closure = new DiscoveryServerClosure;
+        closure->cntl = nullptr;
+        closure->response = response;
+        closure->done = new ApplyraftClosure(sync_cond);
+        closure->common_state_machine = this;
+        melon::raft::Task task;
+        task.data = &data;
+        task.done = closure;
+        _node.apply(task);
+        sync_cond.wait();
+        if (response->errcode() != sirius::proto::SUCCESS) {
+            LOG(WARNING) << "reserve id segment fail, servlet_id:" << servlet_id << ", count:" << count
+                         << ", errmsg:" << response->errmsg();
+            return -1;
+        }
+        return 0;
+    }
+
+    void AutoIncrStateMachine::prefetch_segment(int64_t servlet_id, std::shared_ptr<AutoIncrSegment> segment,
+                                                int64_t generation) {
+        sirius::proto::DiscoveryManagerResponse response;
+        int ret = reserve_segment(servlet_id, static_cast<uint64_t>(FLAGS_sirius_auto_incr_segment_size),
+                                  &response);
+        MELON_SCOPED_LOCK(segment->mutex);
+        segment->prefetching = false;
+        // a segment reserved before the counter was changed is dropped
+        if (ret != 0 || segment->generation.load() != generation || segment->filled_generation != generation) {
+            return;
+        }
+        if (segment->prefetch_end == segment->prefetch_start && response.start_id() >= segment->end_id) {
+            segment->prefetch_start = response.start_id();
+            segment->prefetch_end = response.end_id();
+        }
+    }
+
+    std::shared_ptr<AutoIncrSegment> AutoIncrStateMachine::get_segment(int64_t servlet_id) {
+        MELON_SCOPED_LOCK(_segment_mutex);
+        auto &segment = _segments[servlet_id];
+        if (segment == nullptr) {
+            segment = std::make_shared<AutoIncrSegment>();
+        }
+        return segment;
+    }
+
+    void AutoIncrStateMachine::drop_segment(int64_t servlet_id, const std::shared_ptr<AutoIncrSegment> &segment) {
+        MELON_SCOPED_LOCK(_segment_mutex);
+        auto iter = _segments.find(servlet_id);
+        if (iter != _segments.end() && iter->second == segment) {
+            _segments.erase(iter);
+        }
+    }
+
+    void AutoIncrStateMachine::invalidate_segment(int64_t servlet_id) {
+        MELON_SCOPED_LOCK(_segment_mutex);
+        auto iter = _segments.find(servlet_id);
+        if (iter != _segments.end()) {
+            iter->second->generation.fetch_add(1);
+        }
+    }
+
+    void AutoIncrStateMachine::on_leader_stop() {
+        {
+            MELON_SCOPED_LOCK(_segment_mutex);
+            for (auto &segment: _segments) {
+                segment.second->generation.fetch_add(1);
+            }
+            _segments.clear();
+        }
+        BaseStateMachine::on_leader_stop();
+    }
+
     void AutoIncrStateMachine::on_apply(melon::raft::Iterator &iter) {
+        TimeCost apply_cost;
+        std::vector<melon::raft::Closure *> dones;
         for (; iter.valid(); iter.next()) {
             melon::raft::Closure *done = iter.done();
             melon::ClosureGuard done_guard(done);
@@ -47,7 +227,7 @@ namespace sirius::discovery {
                         ((DiscoveryServerClosure *) done)->response->set_errcode(sirius::proto::PARSE_FROM_PB_FAIL);
                         ((DiscoveryServerClosure *) done)->response->set_errmsg("parse from protobuf fail");
                     }
-                    melon::raft::run_closure_in_fiber(done_guard.release());
+                    dones.push_back(done_guard.release());
                 }
                 continue;
             }
@@ -58,30 +238,43 @@ namespace sirius::discovery {
                         << ", request op_type:" << sirius::proto::OpType_Name(request.op_type());
             switch (request.op_type()) {
                 case sirius::proto::OP_ADD_ID_FOR_AUTO_INCREMENT: {
+                    invalidate_segment(request.auto_increment().servlet_id());
                     add_servlet_id(request, done);
                     break;
                 }
                 case sirius::proto::OP_DROP_ID_FOR_AUTO_INCREMENT: {
+                    invalidate_segment(request.auto_increment().servlet_id());
                     drop_servlet_id(request, done);
                     break;
                 }
                 case sirius::proto::OP_GEN_ID_FOR_AUTO_INCREMENT: {
+                    // a floor moves the counter past ids the leader segment may still hand out
+                    if (request.auto_increment().has_start_id()) {
+                        invalidate_segment(request.auto_increment().servlet_id());
+                    }
                     gen_id(request, done);
                     break;
                 }
                 case sirius::proto::OP_UPDATE_FOR_AUTO_INCREMENT: {
+                    invalidate_segment(request.auto_increment().servlet_id());
                     update(request, done);
                     break;
                 }
+                case sirius::proto::OP_BATCH_GEN_ID_FOR_AUTO_INCREMENT: {
+                    gen_id_batch(request, done);
+                    break;
+                }
                 default: {
                     LOG(ERROR) << "unsupport request type, type:" << request.op_type();
                     IF_DONE_SET_RESPONSE(done, sirius::proto::UNKNOWN_REQ_TYPE, "unsupport request type");
                 }
             }
             if (done) {
-                melon::raft::run_closure_in_fiber(done_guard.release());
+                dones.push_back(done_guard.release());
             }
         }
+        ClosurePipeline::get_instance()->push(dones);
+        ClosurePipeline::get_instance()->add_apply_time(apply_cost.get_time());
     }
 
     void AutoIncrStateMachine::add_servlet_id(const sirius::proto::DiscoveryManagerRequest &request,
@@ -89,7 +282,7 @@ namespace sirius::discovery {
         auto &increment_info = request.auto_increment();
         int64_t servlet_id = increment_info.servlet_id();
         uint64_t start_id = increment_info.start_id();
-        if (_auto_increment_map.find(servlet_id) != _auto_increment_map.end()) {
+        if (_auto_increment_map.contains(servlet_id)) {
             IF_DONE_SET_RESPONSE(done, sirius::proto::INPUT_PARAM_ERROR, "servlet id has exist");
             LOG(ERROR) << "servlet_id: " << servlet_id << " has exist when add servlet id for auto increment";
             return;
@@ -101,14 +294,14 @@ namespace sirius::discovery {
             ((DiscoveryServerClosure *) done)->response->set_start_id(start_id);
             ((DiscoveryServerClosure *) done)->response->set_errmsg("SUCCESS");
         }
-        LOG(INFO) << "add servlet id for auto_increment success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "add servlet id for auto_increment success, request:" << request.ShortDebugString();
     }
 
     void AutoIncrStateMachine::drop_servlet_id(const sirius::proto::DiscoveryManagerRequest &request,
                                              melon::raft::Closure *done) {
         auto &increment_info = request.auto_increment();
         int64_t servlet_id = increment_info.servlet_id();
-        if (_auto_increment_map.find(servlet_id) == _auto_increment_map.end()) {
+        if (!_auto_increment_map.contains(servlet_id)) {
             IF_DONE_SET_RESPONSE(done, sirius::proto::INPUT_PARAM_ERROR, "servlet id not exist");
             LOG(WARNING) << "servlet id: " << servlet_id << " not exist when drop servlet id for auto increment";
             return;
@@ -119,19 +312,19 @@ namespace sirius::discovery {
             ((DiscoveryServerClosure *) done)->response->set_op_type(request.op_type());
             ((DiscoveryServerClosure *) done)->response->set_errmsg("SUCCESS");
         }
-        LOG(INFO) << "drop servlet id for auto_increment success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "drop servlet id for auto_increment success, request:" << request.ShortDebugString();
     }
 
     void AutoIncrStateMachine::gen_id(const sirius::proto::DiscoveryManagerRequest &request,
                                       melon::raft::Closure *done) {
         auto &increment_info = request.auto_increment();
         int64_t servlet_id = increment_info.servlet_id();
-        if (_auto_increment_map.find(servlet_id) == _auto_increment_map.end()) {
+        if (!_auto_increment_map.contains(servlet_id)) {
             LOG(WARNING) << "servlet id: " << servlet_id << " has no auto_increment field";
             IF_DONE_SET_RESPONSE(done, sirius::proto::INPUT_PARAM_ERROR, "servlet has no auto increment");
             return;
         }
-        uint64_t old_start_id = _auto_increment_map[servlet_id];
+        uint64_t old_start_id = *_auto_increment_map.seek(servlet_id);
         if (increment_info.has_start_id() && old_start_id < increment_info.start_id() + 1) {
             old_start_id = increment_info.start_id() + 1;
         }
@@ -140,17 +333,73 @@ namespace sirius::discovery {
             ((DiscoveryServerClosure *) done)->response->set_errcode(sirius::proto::SUCCESS);
             ((DiscoveryServerClosure *) done)->response->set_op_type(request.op_type());
             ((DiscoveryServerClosure *) done)->response->set_start_id(old_start_id);
-            ((DiscoveryServerClosure *) done)->response->set_end_id(_auto_increment_map[servlet_id]);
+            ((DiscoveryServerClosure *) done)->response->set_end_id(*_auto_increment_map.seek(servlet_id));
             ((DiscoveryServerClosure *) done)->response->set_errmsg("SUCCESS");
         }
-        LOG(INFO)<< "gen_id for auto_increment success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "gen_id for auto_increment success, request:" << request.ShortDebugString();
+    }
+
+    void AutoIncrStateMachine::gen_id_batch(const sirius::proto::DiscoveryManagerRequest &request,
+                                            melon::raft::Closure *done) {
+        sirius::proto::DiscoveryManagerResponse *response = nullptr;
+        if (done) {
+            response = ((DiscoveryServerClosure *) done)->response;
+        }
+        for (auto &sub_request: request.sub_requests()) {
+            sirius::proto::DiscoveryManagerResponse sub_response;
+            sub_response.set_op_type(sub_request.op_type());
+            if (sub_request.op_type() != sirius::proto::OP_GEN_ID_FOR_AUTO_INCREMENT) {
+                sub_response.set_errcode(sirius::proto::INPUT_PARAM_ERROR);
+                sub_response.set_errmsg("not a gen id request");
+            } else {
+                if (sub_request.auto_increment().has_start_id()) {
+                    invalidate_segment(sub_request.auto_increment().servlet_id());
+                }
+                // followers have no closure, sub requests still need one for their response
+                DiscoveryServerClosure sub_done;
+                sub_done.cntl = nullptr;
+                sub_done.common_state_machine = this;
+                sub_done.done = nullptr;
+                sub_done.response = &sub_response;
+                sub_response.set_errcode(sirius::proto::INTERNAL_ERROR);
+                gen_id(sub_request, &sub_done);
+            }
+            if (response) {
+                response->add_sub_responses()->Swap(&sub_response);
+            }
+        }
+        IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
+        DLOG(INFO) << "gen_id batch for auto_increment applied, sub requests:" << request.sub_requests_size();
+    }
+
+    bool AutoIncrStateMachine::check_gen_id_batch(const sirius::proto::DiscoveryManagerRequest &request,
+                                                  std::string *errmsg) {
+        if (request.sub_requests_size() == 0) {
+            *errmsg = "no sub requests";
+            return false;
+        }
+        if (request.sub_requests_size() > FLAGS_sirius_batch_max_ops) {
+            *errmsg = "too many sub requests, max:" + std::to_string(FLAGS_sirius_batch_max_ops);
+            return false;
+        }
+        for (auto &sub_request: request.sub_requests()) {
+            if (sub_request.op_type() != sirius::proto::OP_GEN_ID_FOR_AUTO_INCREMENT) {
+                *errmsg = "op_type not supported in gen id batch: " + sirius::proto::OpType_Name(sub_request.op_type());
+                return false;
+            }
+            if (!sub_request.has_auto_increment()) {
+                *errmsg = "no payload for " + sirius::proto::OpType_Name(sub_request.op_type());
+                return false;
+            }
+        }
+        return true;
     }
 
     void AutoIncrStateMachine::update(const sirius::proto::DiscoveryManagerRequest &request,
                                       melon::raft::Closure *done) {
         auto &increment_info = request.auto_increment();
         int64_t servlet_id = increment_info.servlet_id();
-        if (_auto_increment_map.find(servlet_id) == _auto_increment_map.end()) {
+        if (!_auto_increment_map.contains(servlet_id)) {
             LOG(WARNING) << "servlet id: " << servlet_id << " has no auto_increment field";
             IF_DONE_SET_RESPONSE(done, sirius::proto::INPUT_PARAM_ERROR, "servlet has no auto increment");
             return;
@@ -167,7 +416,7 @@ namespace sirius::discovery {
                                  "star_id and increment_id all exist");
             return;
         }
-        uint64_t old_start_id = _auto_increment_map[servlet_id];
+        uint64_t old_start_id = *_auto_increment_map.seek(servlet_id);
         // backwards
         if (increment_info.has_start_id()
             && old_start_id > increment_info.start_id() + 1
@@ -184,19 +433,21 @@ namespace sirius::discovery {
         if (done && ((DiscoveryServerClosure *) done)->response) {
             ((DiscoveryServerClosure *) done)->response->set_errcode(sirius::proto::SUCCESS);
             ((DiscoveryServerClosure *) done)->response->set_op_type(request.op_type());
-            ((DiscoveryServerClosure *) done)->response->set_start_id(_auto_increment_map[servlet_id]);
+            ((DiscoveryServerClosure *) done)->response->set_start_id(*_auto_increment_map.seek(servlet_id));
             ((DiscoveryServerClosure *) done)->response->set_errmsg("SUCCESS");
         }
-        LOG(INFO) << "update start_id for auto_increment success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "update start_id for auto_increment success, request:" << request.ShortDebugString();
     }
 
     void AutoIncrStateMachine::on_snapshot_save(melon::raft::SnapshotWriter *writer, melon::raft::Closure *done) {
         LOG(INFO) << "start on snapshot save";
-        std::string max_id_string;
-        save_auto_increment(max_id_string);
+        // capture the map in O(1), the copy and io are done off the apply thread
+        auto map_snapshot = _auto_increment_map.snapshot();
         Fiber bth(&FIBER_ATTR_SMALL);
-        std::function<void()> save_snapshot_function = [this, done, writer, max_id_string]() {
-            save_snapshot(done, writer, max_id_string);
+        std::function<void()> save_snapshot_function = [this, done, writer, map_snapshot]() {
+            std::vector<AutoIncrRecord> records;
+            save_auto_increment(map_snapshot, records);
+            save_snapshot(done, writer, records);
         };
         bth.run(save_snapshot_function);
     }
@@ -205,10 +456,17 @@ namespace sirius::discovery {
         LOG(INFO) << "start on snapshot load";
         std::vector<std::string> files;
         reader->list_files(&files);
+        bool has_binary = std::find(files.begin(), files.end(), SNAPSHOT_MAX_ID_FILE_WITH_SLASH) != files.end();
         for (auto &file: files) {
             LOG(INFO) << "snapshot load file:" << file;
-            if (file == "/max_id.json") {
-                std::string max_id_file = reader->get_path() + "/max_id.json";
+            if (file == SNAPSHOT_MAX_ID_FILE_WITH_SLASH) {
+                std::string max_id_file = reader->get_path() + SNAPSHOT_MAX_ID_FILE_WITH_SLASH;
+                if (load_auto_increment_binary(max_id_file) != 0) {
+                    LOG(WARNING) << "load auto increment max_id fail";
+                    return -1;
+                }
+            } else if (file == SNAPSHOT_MAX_ID_JSON_FILE_WITH_SLASH && !has_binary) {
+                std::string max_id_file = reader->get_path() + SNAPSHOT_MAX_ID_JSON_FILE_WITH_SLASH;
                 if (load_auto_increment(max_id_file) != 0) {
                     LOG(WARNING) << "load auto increment max_id fail";
                     return -1;
@@ -219,42 +477,51 @@ namespace sirius::discovery {
         return 0;
     }
 
-    void AutoIncrStateMachine::save_auto_increment(std::string &max_id_string) {
-        rapidjson::Document root;
-        root.SetObject();
-        rapidjson::Document::AllocatorType &alloc = root.GetAllocator();
-        for (auto &max_id_pair: _auto_increment_map) {
-            std::string servlet_id_string = std::to_string(max_id_pair.first);
-            rapidjson::Value servlet_id_val(rapidjson::kStringType);
-            servlet_id_val.SetString(servlet_id_string.c_str(), servlet_id_string.size(), alloc);
-
-            rapidjson::Value max_id_value(rapidjson::kNumberType);
-            max_id_value.SetUint64(max_id_pair.second);
-
-            root.AddMember(servlet_id_val, max_id_value, alloc);
-        }
-        rapidjson::StringBuffer buffer;
-        rapidjson::Writer<rapidjson::StringBuffer> json_writer(buffer);
-        root.Accept(json_writer);
-        max_id_string = buffer.GetString();
-        LOG(INFO) << "save auto increment success, max_id_string:" << max_id_string;
+    void AutoIncrStateMachine::save_auto_increment(const AutoIncrMap::Snapshot &map_snapshot,
+                                                   std::vector<AutoIncrRecord> &records) {
+        records.reserve(map_snapshot.size());
+        map_snapshot.for_each([&records](int64_t servlet_id, uint64_t max_id) {
+            records.push_back({servlet_id, max_id});
+        });
     }
 
     void AutoIncrStateMachine::save_snapshot(melon::raft::Closure *done,
                                              melon::raft::SnapshotWriter *writer,
-                                             std::string max_id_string) {
+                                             std::vector<AutoIncrRecord> &records) {
         melon::ClosureGuard done_guard(done);
+        std::sort(records.begin(), records.end(), [](const AutoIncrRecord &l, const AutoIncrRecord &r) {
+            return l.servlet_id < r.servlet_id;
+        });
         std::string snapshot_path = writer->get_path();
-        std::string max_id_path = snapshot_path + "/max_id.json";
-        std::ofstream extra_fs(max_id_path,
-                               std::ofstream::out | std::ofstream::trunc);
-        extra_fs.write(max_id_string.data(), max_id_string.size());
-        extra_fs.close();
-        if (writer->add_file("/max_id.json") != 0) {
+        std::string max_id_path = snapshot_path + SNAPSHOT_MAX_ID_FILE_WITH_SLASH;
+        std::string data(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(AutoIncrRecord));
+        if (write_binary_snapshot(max_id_path, BINARY_SNAPSHOT_AUTO_INCR, sizeof(AutoIncrRecord), data) != 0) {
+            done->status().set_error(EIO, "Fail to write max id file");
+            LOG(ERROR) << "Error while writing max id file";
+            return;
+        }
+        if (writer->add_file(SNAPSHOT_MAX_ID_FILE_WITH_SLASH) != 0) {
             done->status().set_error(EINVAL, "Fail to add file");
             LOG(ERROR) << "Error while adding file to writer";
             return;
         }
+        LOG(INFO) << "save auto increment success, count:" << records.size();
+    }
+
+    int AutoIncrStateMachine::load_auto_increment_binary(const std::string &max_id_file) {
+        std::string data;
+        uint64_t count = 0;
+        if (read_binary_snapshot(max_id_file, BINARY_SNAPSHOT_AUTO_INCR, sizeof(AutoIncrRecord), &data, &count) != 0) {
+            return -1;
+        }
+        _auto_increment_map.clear();
+        _auto_increment_map.reserve(count);
+        const AutoIncrRecord *records = reinterpret_cast<const AutoIncrRecord *>(data.data());
+        for (uint64_t i = 0; i < count; ++i) {
+            _auto_increment_map[records[i].servlet_id] = records[i].max_id;
+        }
+        LOG(INFO) << "load auto increment success, count:" << count;
+        return 0;
     }
 
     int AutoIncrStateMachine::load_auto_increment(const std::string &max_id_file) {
@@ -262,10 +529,18 @@ namespace sirius::discovery {
         std::ifstream extra_fs(max_id_file);
         std::string extra((std::istreambuf_iterator<char>(extra_fs)),
                           std::istreambuf_iterator<char>());
-        return parse_json_string(extra);
+        std::vector<AutoIncrRecord> records;
+        if (parse_max_id_json(extra, &records) != 0) {
+            return -1;
+        }
+        for (auto &record: records) {
+            LOG(INFO) << "load auto increment, servlet_id:" << record.servlet_id << ", max_id:" << record.max_id;
+            _auto_increment_map[record.servlet_id] = record.max_id;
+        }
+        return 0;
     }
 
-    int AutoIncrStateMachine::parse_json_string(const std::string &json_string) {
+    int AutoIncrStateMachine::parse_max_id_json(const std::string &json_string, std::vector<AutoIncrRecord> *records) {
         rapidjson::Document root;
         try {
             root.Parse<0>(json_string.c_str());
@@ -278,16 +553,22 @@ namespace sirius::discovery {
             LOG(WARNING) << "parse extra file error, json:" << json_string;
             return -1;
         }
+        if (!root.IsObject()) {
+            LOG(WARNING) << "max_id json is not an object, json:" << json_string;
+            return -1;
+        }
         for (auto json_iter = root.MemberBegin(); json_iter != root.MemberEnd(); ++json_iter) {
             int64_t servlet_id;
-            auto r = turbo::simple_atoi(json_iter->name.GetString(), &servlet_id);
-            if (r != 0) {
+            // simple_atoi returns true on success
+            if (!turbo::simple_atoi(json_iter->name.GetString(), &servlet_id)) {
                 LOG(WARNING) << "parse servlet_id fail, servlet_id:" << json_iter->name.GetString();
                 continue;
             }
-            uint64_t max_id = json_iter->value.GetUint64();
-            LOG(INFO) << "load auto increment, servlet_id:" << servlet_id << ", max_id:" << max_id;
-            _auto_increment_map[servlet_id] = max_id;
+            if (!json_iter->value.IsUint64()) {
+                LOG(WARNING) << "parse max_id fail, servlet_id:" << servlet_id;
+                continue;
+            }
+            records->push_back({servlet_id, json_iter->value.GetUint64()});
         }
         return 0;
     }
@@ -19,21 +19,70 @@
 #pragma once
 
 #include <unordered_map>
+#include <vector>
+#include <memory>
+#include <atomic>
 #include <sirius/discovery/base_state_machine.h>
 #include <sirius/discovery/sirius_constants.h>
+#include <sirius/base/cow_sharded_map.h>
 
 namespace sirius::discovery {
+
+    /// \brief one servlet counter in the binary snapshot, sorted by servlet_id.
+    struct AutoIncrRecord {
+        int64_t servlet_id;
+        uint64_t max_id;
+    };
+
+    /// \brief ids of one servlet reserved through raft and served from leader memory.
+    ///        [next_id, end_id) is being served, [prefetch_start, prefetch_end) is the
+    ///        following segment once a prefetch is committed. generation is bumped when
+    ///        the counter is changed by other ops or the leader stops, which drops both.
+    struct AutoIncrSegment {
+        AutoIncrSegment() {
+            fiber_mutex_init(&mutex, nullptr);
+        }
+
+        ~AutoIncrSegment() {
+            fiber_mutex_destroy(&mutex);
+        }
+
+        fiber_mutex_t mutex;  // protect all fields except generation
+        uint64_t next_id{0};
+        uint64_t end_id{0};
+        uint64_t prefetch_start{0};
+        uint64_t prefetch_end{0};
+        bool prefetching{false};
+        int64_t filled_generation{0};
+        std::atomic<int64_t> generation{0};
+    };
+
     class AutoIncrStateMachine : public BaseStateMachine {
     public:
 
         explicit AutoIncrStateMachine(const melon::raft::PeerId &peerId) :
-                BaseStateMachine(DiscoveryConstants::AutoIDMachineRegion, "auto_incr_raft", "/auto_incr", peerId) {}
+                BaseStateMachine(DiscoveryConstants::AutoIDMachineRegion, "auto_incr_raft", "/auto_incr", peerId) {
+            fiber_mutex_init(&_segment_mutex, nullptr);
+        }
 
-        ~AutoIncrStateMachine() override = default;
+        ~AutoIncrStateMachine() override {
+            fiber_mutex_destroy(&_segment_mutex);
+        }
+
+        ///
+        /// \brief gen id requests without start_id are served from the servlet segment
+        ///        when sirius_auto_incr_segment_size is set, others go through raft. a gen id
+        ///        batch is served from the segments sub request by sub request in that case.
+        void process(google::protobuf::RpcController *controller,
+                     const sirius::proto::DiscoveryManagerRequest *request,
+                     sirius::proto::DiscoveryManagerResponse *response,
+                     google::protobuf::Closure *done) override;
 
         /// state machine method override
         void on_apply(melon::raft::Iterator &iter) override;
 
+        void on_leader_stop() override;
+
         ///
         /// \brief servlet inc id initialize
         /// \param request [in]
@@ -52,6 +101,19 @@ namespace sirius::discovery {
         /// \param done [out]
         void gen_id(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done);
 
+        ///
+        /// \brief gen ids of several servlets in one entry, each sub request is applied
+        ///        like gen_id and answered in its own sub response, one failing servlet
+        ///        does not fail the others.
+        /// \param request [in]
+        /// \param done [out]
+        void gen_id_batch(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done);
+
+        ///
+        /// \brief check a OP_BATCH_GEN_ID_FOR_AUTO_INCREMENT request before proposing it.
+        /// \return false with errmsg set if it can not be applied
+        static bool check_gen_id_batch(const sirius::proto::DiscoveryManagerRequest &request, std::string *errmsg);
+
         ///
         /// \brief reset a servlet inc by start_id or increment_id, if backwards,
         ///        increment_info.force() should be enabled.
@@ -71,25 +133,66 @@ namespace sirius::discovery {
         /// \param done
         int on_snapshot_load(melon::raft::SnapshotReader *reader)  override;
 
+        static const std::string SNAPSHOT_MAX_ID_FILE_WITH_SLASH;
+        static const std::string SNAPSHOT_MAX_ID_JSON_FILE_WITH_SLASH;
+
+        ///
+        /// \brief parse the json max_id file of old versions, {"servlet_id": max_id, ...}.
+        ///        members that are not a servlet_id and a max_id are skipped.
+        /// \param json_string [in]
+        /// \param records [out]
+        /// \return -1 if it is not json
+        static int parse_max_id_json(const std::string &json_string, std::vector<AutoIncrRecord> *records);
+
     private:
-        void save_auto_increment(std::string &max_id_string);
+        typedef sirius::CowShardedMap<int64_t, uint64_t> AutoIncrMap;
+
+        ///
+        /// \brief serve a gen id request from the servlet segment, the segment is
+        ///        refilled through raft when it can not hold the requested count.
+        void gen_id_from_segment(const sirius::proto::DiscoveryManagerRequest &request,
+                                 sirius::proto::DiscoveryManagerResponse *response);
+
+        ///
+        /// \brief reserve count ids of a servlet through raft and wait for the commit.
+        /// \return 0 on success, response carries the reserved [start_id, end_id)
+        int reserve_segment(int64_t servlet_id, uint64_t count, sirius::proto::DiscoveryManagerResponse *response);
+
+        void prefetch_segment(int64_t servlet_id, std::shared_ptr<AutoIncrSegment> segment, int64_t generation);
+
+        std::shared_ptr<AutoIncrSegment> get_segment(int64_t servlet_id);
+
+        ///
+        /// \brief forget the segment of a servlet that has no counter, if it is still this one.
+        void drop_segment(int64_t servlet_id, const std::shared_ptr<AutoIncrSegment> &segment);
+
+        ///
+        /// \brief drop the cached ids of a servlet, called when its counter is changed by raft.
+        void invalidate_segment(int64_t servlet_id);
+
+        void save_auto_increment(const AutoIncrMap::Snapshot &map_snapshot, std::vector<AutoIncrRecord> &records);
 
         void save_snapshot(melon::raft::Closure *done,
                            melon::raft::SnapshotWriter *writer,
-                           std::string max_id_string);
+                           std::vector<AutoIncrRecord> &records);
+
+        ///
+        /// \brief load servlet_id --> max_id from binary snapshot file
+        /// \param max_id_file
+        /// \return
+        int load_auto_increment_binary(const std::string &max_id_file);
         ///
-        /// \brief load json servlet_id --> max_id from json file
+        /// \brief load json servlet_id --> max_id from json file, written by old versions
         /// \param max_id_file
         /// \return
 
         int load_auto_increment(const std::string &max_id_file);
 
-        ///
-        /// \param json_string
-        /// \return
-        int parse_json_string(const std::string &json_string);
+        // written by the apply thread only, snapshots read a captured version
+        AutoIncrMap _auto_increment_map;
 
-        std::unordered_map<int64_t, uint64_t> _auto_increment_map;
+        fiber_mutex_t _segment_mutex;  // protect _segments
+        std::unordered_map<int64_t, std::shared_ptr<AutoIncrSegment>> _segments;
     };
 
 } //namespace sirius::discovery
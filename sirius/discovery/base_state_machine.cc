@@ -19,6 +19,7 @@
 
 #include <sirius/discovery/base_state_machine.h>
 #include <sirius/flags/sirius.h>
+#include <sirius/discovery/access_log.h>
 
 namespace sirius::discovery {
 
@@ -32,15 +33,22 @@ namespace sirius::discovery {
                           << status().error_cstr();
         }
         total_time_cost = time_cost.get_time();
-        std::string remote_side;
-        if (cntl != nullptr) {
-            remote_side = mutil::endpoint2str(cntl->remote_side()).c_str();
+        if (admission != nullptr) {
+            admission->release(op_type);
         }
-
-        if (response != nullptr && response->op_type() != sirius::proto::OP_GEN_ID_FOR_AUTO_INCREMENT) {
-            LOG(INFO)
-            << "request:" << request << ", response:" << response->ShortDebugString() << ", raft_time_cost:["
-            << raft_time_cost << "], total_time_cost:[" << total_time_cost << "], remote_side:[" << remote_side << "]";
+        if (response != nullptr) {
+            AccessRecord record;
+            record.op_type = request != nullptr ? request->op_type() : response->op_type();
+            record.errcode = response->errcode();
+            record.raft_time_us = raft_time_cost;
+            record.total_time_us = total_time_cost;
+            record.request_size = request_size;
+            if (cntl != nullptr) {
+                record.remote_side = cntl->remote_side();
+            }
+            if (AccessLog::sampled(record)) {
+                AccessLog::write(record, request, response);
+            }
         }
         if (done != nullptr) {
             done->Run();
@@ -75,6 +83,9 @@ namespace sirius::discovery {
         options.log_uri = FLAGS_sirius_log_uri + std::to_string(_dummy_region_id);
         options.raft_meta_uri = FLAGS_sirius_stable_uri + _file_path;
         options.snapshot_uri = FLAGS_sirius_snapshot_uri + _file_path;
+        // a follower installing a snapshot links the files it already has with the same
+        // checksum instead of downloading them, files without checksum are always copied
+        options.filter_before_copy_remote = true;
         int ret = _node.init(options);
         if (ret < 0) {
             LOG(ERROR) << "raft node init fail";
@@ -95,7 +106,20 @@ namespace sirius::discovery {
                 response->set_errmsg("not leader");
                 response->set_leader(mutil::endpoint2str(_node.leader_id().addr).c_str());
             }
-            LOG(WARNING) << "state machine not leader, request: " << request->ShortDebugString();
+            LOG(WARNING) << "state machine not leader, request op_type: "
+                         << sirius::proto::OpType_Name(request->op_type());
+            return;
+        }
+        int64_t retry_after_ms = _admission.admit(request->op_type());
+        if (retry_after_ms > 0) {
+            if (response) {
+                response->set_errcode(sirius::proto::RETRY_LATER);
+                response->set_errmsg("too many writes in flight, retry later");
+                response->set_op_type(request->op_type());
+                response->set_retry_after_ms(retry_after_ms);
+            }
+            DLOG(WARNING) << "write rejected by admission control, request op_type: "
+                          << sirius::proto::OpType_Name(request->op_type());
             return;
         }
         melon::Controller *cntl =
@@ -103,11 +127,15 @@ namespace sirius::discovery {
         mutil::IOBuf data;
         mutil::IOBufAsZeroCopyOutputStream wrapper(&data);
         if (!request->SerializeToZeroCopyStream(&wrapper) && cntl) {
+            _admission.release(request->op_type());
             cntl->SetFailed(melon::EREQUEST, "Fail to serialize request");
             return;
         }
         DiscoveryServerClosure *closure = new DiscoveryServerClosure;
-        closure->request = request->ShortDebugString();
+        closure->admission = &_admission;
+        closure->op_type = request->op_type();
+        closure->request = request;
+        closure->request_size = data.size();
         closure->cntl = cntl;
         closure->response = response;
         closure->done = done_guard.release();
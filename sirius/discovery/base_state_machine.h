@@ -22,6 +22,7 @@
 #include <melon/raft/raft.h>
 #include <melon/rpc/server.h>
 #include <sirius/discovery/raft_control.h>
+#include <sirius/discovery/admission_control.h>
 #include <sirius/proto/discovery.interface.pb.h>
 #include <sirius/base/fiber.h>
 #include <sirius/base/time_cast.h>
@@ -36,9 +37,14 @@ struct DiscoveryServerClosure : public melon::raft::Closure {
         BaseStateMachine *common_state_machine;
         google::protobuf::Closure *done;
         sirius::proto::DiscoveryManagerResponse *response;
-        std::string request;
-        int64_t raft_time_cost;
-        int64_t total_time_cost;
+        // owned by the rpc, only formatted when the access log samples it
+        const sirius::proto::DiscoveryManagerRequest *request{nullptr};
+        size_t request_size{0};
+        // set when the write was admitted, released when the closure runs
+        AdmissionController *admission{nullptr};
+        sirius::proto::OpType op_type{sirius::proto::OP_NONE};
+        int64_t raft_time_cost{0};
+        int64_t total_time_cost{0};
         TimeCost time_cost;
     };
 
@@ -71,6 +77,23 @@ struct DiscoveryServerClosure : public melon::raft::Closure {
         FiberCond &cond;
     };
 
+    /// \brief owns a copy of a request the leader completes before proposing, the rpc
+    ///        request is const. the copy lives until the rpc done has run.
+    struct OwnedRequestClosure : public google::protobuf::Closure {
+        OwnedRequestClosure(const sirius::proto::DiscoveryManagerRequest &from, google::protobuf::Closure *done)
+                : request(from), done(done) {}
+
+        void Run() override {
+            if (done) {
+                done->Run();
+            }
+            delete this;
+        }
+
+        sirius::proto::DiscoveryManagerRequest request;
+        google::protobuf::Closure *done;
+    };
+
     class BaseStateMachine : public melon::raft::StateMachine {
     public:
 
@@ -80,6 +103,7 @@ struct DiscoveryServerClosure : public melon::raft::Closure {
                          const melon::raft::PeerId &peerId) :
                 _node(identify, peerId),
                 _is_leader(false),
+                _admission(identify),
                 _dummy_region_id(dummy_region_id),
                 _file_path(file_path) {}
 
@@ -157,6 +181,7 @@ struct DiscoveryServerClosure : public melon::raft::Closure {
     protected:
         melon::raft::Node _node;
         std::atomic<bool> _is_leader;
+        AdmissionController _admission;
         int64_t _dummy_region_id;
         std::string _file_path;
     private:
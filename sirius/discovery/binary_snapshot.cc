@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <sirius/discovery/binary_snapshot.h>
+#include <fstream>
+#include <melon/utility/crc32c.h>
+#include <sirius/base/log.h>
+
+namespace sirius::discovery {
+
+    int write_binary_snapshot(const std::string &path, uint32_t kind, uint32_t record_size,
+                              const std::string &records, uint32_t meta) {
+        BinarySnapshotHeader header;
+        header.magic = kBinarySnapshotMagic;
+        header.version = kBinarySnapshotVersion;
+        header.kind = kind;
+        header.record_size = record_size;
+        header.count = records.size() / record_size;
+        header.checksum = mutil::crc32c::Value(records.data(), records.size());
+        header.meta = meta;
+        std::string buffer;
+        buffer.reserve(sizeof(header) + records.size());
+        buffer.append(reinterpret_cast<const char *>(&header), sizeof(header));
+        buffer.append(records);
+        std::ofstream fs(path, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+        fs.write(buffer.data(), buffer.size());
+        fs.close();
+        if (!fs) {
+            LOG(WARNING) << "write binary snapshot fail, path:" << path;
+            return -1;
+        }
+        return 0;
+    }
+
+    int read_binary_snapshot(const std::string &path, uint32_t kind, uint32_t record_size,
+                             std::string *records, uint64_t *count, uint32_t *meta) {
+        std::ifstream fs(path, std::ifstream::in | std::ifstream::binary);
+        if (!fs) {
+            LOG(WARNING) << "open binary snapshot fail, path:" << path;
+            return -1;
+        }
+        BinarySnapshotHeader header;
+        if (!fs.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+            LOG(WARNING) << "binary snapshot too short, path:" << path;
+            return -1;
+        }
+        if (header.magic != kBinarySnapshotMagic || header.version != kBinarySnapshotVersion
+            || header.kind != kind || header.record_size != record_size) {
+            LOG(WARNING) << "binary snapshot header mismatch, path:" << path << " magic:" << header.magic
+                         << " version:" << header.version << " kind:" << header.kind
+                         << " record_size:" << header.record_size;
+            return -1;
+        }
+        // check the size before allocating, a corrupt count must not blow up memory
+        auto records_begin = fs.tellg();
+        fs.seekg(0, std::ifstream::end);
+        uint64_t records_size = static_cast<uint64_t>(fs.tellg() - records_begin);
+        fs.seekg(records_begin);
+        if (records_size != header.count * record_size) {
+            LOG(WARNING) << "binary snapshot size mismatch, path:" << path << " count:" << header.count
+                         << " records size:" << records_size;
+            return -1;
+        }
+        std::string buffer;
+        buffer.resize(records_size);
+        if (!fs.read(&buffer[0], buffer.size())) {
+            LOG(WARNING) << "binary snapshot size mismatch, path:" << path << " count:" << header.count;
+            return -1;
+        }
+        if (mutil::crc32c::Value(buffer.data(), buffer.size()) != header.checksum) {
+            LOG(WARNING) << "binary snapshot checksum mismatch, path:" << path;
+            return -1;
+        }
+        *count = header.count;
+        if (meta != nullptr) {
+            *meta = header.meta;
+        }
+        records->swap(buffer);
+        return 0;
+    }
+
+}  // namespace sirius::discovery
@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace sirius::discovery {
+
+    /// \brief fixed width binary snapshot file.
+    ///        layout, all integers in host (little endian) order:
+    ///        | magic | version | kind | record_size | count | checksum | meta | records... |
+    ///        records are count * record_size bytes, sorted by key by the writer,
+    ///        checksum is crc32c of the records, meta is a kind specific value, 0 if unset. loading is a header check and a crc,
+    ///        records are then read in place without any parsing.
+    struct BinarySnapshotHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t kind;
+        uint32_t record_size;
+        uint64_t count;
+        uint32_t checksum;
+        uint32_t meta;
+    };
+
+    static_assert(sizeof(BinarySnapshotHeader) == 32, "binary snapshot header must be 32 bytes");
+
+    constexpr uint32_t kBinarySnapshotMagic = 0x42535253;  // "SRSB"
+    constexpr uint32_t kBinarySnapshotVersion = 1;
+
+    enum BinarySnapshotKind : uint32_t {
+        BINARY_SNAPSHOT_AUTO_INCR = 1,
+        BINARY_SNAPSHOT_TSO = 2,
+    };
+
+    /// \brief write header and records with one write.
+    /// \param path [in] file to write, truncated if exists
+    /// \param kind [in] record kind
+    /// \param record_size [in] width of one record
+    /// \param records [in] count * record_size bytes, sorted by key
+    /// \param meta [in] kind specific value kept in the header
+    /// \return 0 on success, -1 on io error
+    int write_binary_snapshot(const std::string &path, uint32_t kind, uint32_t record_size,
+                              const std::string &records, uint32_t meta = 0);
+
+    /// \brief read a file written by write_binary_snapshot, checking magic,
+    ///        version, kind, record size and checksum.
+    /// \param records [out] raw records, count * record_size bytes
+    /// \param count [out] number of records
+    /// \param meta [out] kind specific value of the header, may be nullptr
+    /// \return 0 on success, -1 on io error or a corrupt file
+    int read_binary_snapshot(const std::string &path, uint32_t kind, uint32_t record_size,
+                             std::string *records, uint64_t *count, uint32_t *meta = nullptr);
+
+}  // namespace sirius::discovery
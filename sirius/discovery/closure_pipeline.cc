@@ -0,0 +1,92 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <sirius/discovery/closure_pipeline.h>
+#include <sirius/base/fiber.h>
+
+namespace sirius::discovery {
+
+    ClosurePipeline::ClosurePipeline() :
+            _queue_depth("sirius_apply_closure_queue_depth"),
+            _apply_busy_us("sirius_apply_busy_us"),
+            _apply_busy_us_second("sirius_apply_busy_us_second", &_apply_busy_us),
+            _drain_count("sirius_apply_closure_drain_count") {
+    }
+
+    void ClosurePipeline::push(std::vector<melon::raft::Closure *> &closures) {
+        if (closures.empty()) {
+            return;
+        }
+        _queue_depth << static_cast<int64_t>(closures.size());
+        Node *node = new Node;
+        node->closures.swap(closures);
+        Node *old_head = _head.load(std::memory_order_relaxed);
+        do {
+            node->next = old_head;
+        } while (!_head.compare_exchange_weak(old_head, node, std::memory_order_seq_cst,
+                                              std::memory_order_relaxed));
+        if (old_head != nullptr) {
+            // the fiber started by the push that saw the queue empty has not taken it yet
+            return;
+        }
+        // a drain still running the closures it took picks this node up on its next round
+        if (_draining.exchange(true, std::memory_order_seq_cst)) {
+            return;
+        }
+        Fiber bth(&FIBER_ATTR_SMALL);
+        bth.run([this]() {
+            drain();
+        });
+    }
+
+    void ClosurePipeline::drain() {
+        while (true) {
+            Node *head = _head.exchange(nullptr, std::memory_order_seq_cst);
+            if (head == nullptr) {
+                _draining.store(false, std::memory_order_seq_cst);
+                // a push between the exchange and the store saw _draining set and left its
+                // node to this fiber, take the role back unless a newer drain has it
+                if (_head.load(std::memory_order_seq_cst) == nullptr
+                    || _draining.exchange(true, std::memory_order_seq_cst)) {
+                    return;
+                }
+                continue;
+            }
+            _drain_count << 1;
+            // restore commit order
+            Node *ordered = nullptr;
+            while (head != nullptr) {
+                Node *next = head->next;
+                head->next = ordered;
+                ordered = head;
+                head = next;
+            }
+            while (ordered != nullptr) {
+                Node *next = ordered->next;
+                for (auto done: ordered->closures) {
+                    done->Run();
+                }
+                _queue_depth << -static_cast<int64_t>(ordered->closures.size());
+                delete ordered;
+                ordered = next;
+            }
+        }
+    }
+
+}  // namespace sirius::discovery
@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <melon/raft/raft.h>
+#include <melon/var/var.h>
+
+namespace sirius::discovery {
+
+    /// \brief runs the closures of committed raft entries off the apply thread.
+    ///        an apply loop hands over all closures of one run with a single push,
+    ///        pushes are lock free and never block. the push that makes the queue
+    ///        non empty starts a fiber unless one is draining, the draining fiber
+    ///        takes every pending run at once and executes them in commit order, and
+    ///        goes on until the queue stays empty. one fiber drains at a time.
+    class ClosurePipeline {
+    public:
+        static ClosurePipeline *get_instance() {
+            static ClosurePipeline ins;
+            return &ins;
+        }
+
+        /// \brief hand over the closures of one apply run, closures is left empty.
+        void push(std::vector<melon::raft::Closure *> &closures);
+
+        /// \brief account the time an apply loop spent in one run.
+        void add_apply_time(int64_t cost_us) {
+            _apply_busy_us << cost_us;
+        }
+
+    private:
+        ClosurePipeline();
+
+        struct Node {
+            std::vector<melon::raft::Closure *> closures;
+            Node *next{nullptr};
+        };
+
+        void drain();
+
+        // pushed nodes, newest first
+        std::atomic<Node *> _head{nullptr};
+        // held by the one fiber draining _head
+        std::atomic<bool> _draining{false};
+        // closures pushed but not run yet
+        melon::var::Adder<int64_t> _queue_depth;
+        // microseconds spent in on_apply, per second it is the apply loop utilization
+        melon::var::Adder<int64_t> _apply_busy_us;
+        melon::var::PerSecond<melon::var::Adder<int64_t>> _apply_busy_us_second;
+        melon::var::Adder<int64_t> _drain_count;
+    };
+
+}  // namespace sirius::discovery
@@ -0,0 +1,161 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <sirius/discovery/lease_manager.h>
+#include <sirius/flags/sirius.h>
+
+namespace sirius::discovery {
+
+    void LeaseManager::add_listener(LeaseListener listener) {
+        _listeners.push_back(std::move(listener));
+    }
+
+    void LeaseManager::renew(int64_t servlet_id, int64_t now_ms, int64_t lease_ms) {
+        MELON_SCOPED_LOCK(_lease_mutex);
+        auto &lease = _leases[servlet_id];
+        lease.deadline_ms = now_ms + lease_ms;
+        // a later deadline is found when the wheel hands out the earlier one
+        if (lease.scheduled_ms == 0 || lease.scheduled_ms > lease.deadline_ms) {
+            _wheel.add(servlet_id, lease.deadline_ms);
+            lease.scheduled_ms = lease.deadline_ms;
+        }
+        auto it = _alive.find(servlet_id);
+        if (it == _alive.end() || !it->second) {
+            _pending_alive.insert(servlet_id);
+        }
+    }
+
+    bool LeaseManager::take_changes(int64_t now_ms, bool full, sirius::proto::DiscoveryManagerRequest *request) {
+        MELON_SCOPED_LOCK(_lease_mutex);
+        std::vector<int64_t> due;
+        _wheel.advance(now_ms, &due);
+        for (auto servlet_id: due) {
+            auto it = _leases.find(servlet_id);
+            if (it == _leases.end()) {
+                continue;
+            }
+            auto &lease = it->second;
+            if (lease.deadline_ms > now_ms) {
+                // renewed since, a brought forward deadline may still be in the wheel
+                if (lease.scheduled_ms <= now_ms) {
+                    _wheel.add(servlet_id, lease.deadline_ms);
+                    lease.scheduled_ms = lease.deadline_ms;
+                }
+                continue;
+            }
+            _pending_alive.erase(servlet_id);
+            auto alive_it = _alive.find(servlet_id);
+            if (!full && alive_it != _alive.end() && alive_it->second) {
+                request->add_expired_servlet_ids(servlet_id);
+            }
+            _leases.erase(it);
+            _lease_expired << 1;
+        }
+        if (full) {
+            request->set_full_lease_sync(true);
+            for (auto &lease: _leases) {
+                request->add_alive_servlet_ids(lease.first);
+            }
+            _pending_alive.clear();
+            return true;
+        }
+        for (auto servlet_id: _pending_alive) {
+            request->add_alive_servlet_ids(servlet_id);
+        }
+        _pending_alive.clear();
+        return request->alive_servlet_ids_size() > 0 || request->expired_servlet_ids_size() > 0;
+    }
+
+    void LeaseManager::apply_changes(const sirius::proto::DiscoveryManagerRequest &request) {
+        std::vector<std::pair<int64_t, bool>> flips;
+        {
+            MELON_SCOPED_LOCK(_lease_mutex);
+            std::unordered_set<int64_t> alive_ids(request.alive_servlet_ids().begin(),
+                                                  request.alive_servlet_ids().end());
+            if (request.full_lease_sync()) {
+                for (auto &alive: _alive) {
+                    if (alive.second && alive_ids.count(alive.first) == 0) {
+                        alive.second = false;
+                        flips.emplace_back(alive.first, false);
+                    }
+                }
+            }
+            for (auto servlet_id: request.expired_servlet_ids()) {
+                auto it = _alive.find(servlet_id);
+                if (it == _alive.end() || it->second) {
+                    flips.emplace_back(servlet_id, false);
+                }
+                _alive[servlet_id] = false;
+            }
+            for (auto servlet_id: alive_ids) {
+                auto it = _alive.find(servlet_id);
+                if (it == _alive.end() || !it->second) {
+                    flips.emplace_back(servlet_id, true);
+                }
+                _alive[servlet_id] = true;
+            }
+        }
+        _lease_flipped << flips.size();
+        for (auto &flip: flips) {
+            for (auto &listener: _listeners) {
+                listener(flip.first, flip.second);
+            }
+        }
+    }
+
+    void LeaseManager::erase(int64_t servlet_id) {
+        MELON_SCOPED_LOCK(_lease_mutex);
+        // its wheel entry is skipped when it comes due
+        _alive.erase(servlet_id);
+        _leases.erase(servlet_id);
+        _pending_alive.erase(servlet_id);
+    }
+
+    LeaseManager::LeaseState LeaseManager::lease_state(int64_t servlet_id) {
+        MELON_SCOPED_LOCK(_lease_mutex);
+        auto it = _alive.find(servlet_id);
+        if (it == _alive.end()) {
+            return LEASE_NONE;
+        }
+        return it->second ? LEASE_ALIVE : LEASE_EXPIRED;
+    }
+
+    void LeaseManager::on_leader_start(int64_t now_ms) {
+        MELON_SCOPED_LOCK(_lease_mutex);
+        _leases.clear();
+        _pending_alive.clear();
+        _wheel.reset(FLAGS_sirius_lease_sync_interval_ms, now_ms);
+        for (auto &alive: _alive) {
+            if (alive.second) {
+                auto &lease = _leases[alive.first];
+                lease.deadline_ms = now_ms + FLAGS_sirius_lease_ms;
+                lease.scheduled_ms = lease.deadline_ms;
+                _wheel.add(alive.first, lease.deadline_ms);
+            }
+        }
+    }
+
+    void LeaseManager::on_leader_stop() {
+        MELON_SCOPED_LOCK(_lease_mutex);
+        _leases.clear();
+        _pending_alive.clear();
+        _wheel.reset(FLAGS_sirius_lease_sync_interval_ms, 0);
+    }
+
+}  // namespace sirius::discovery
@@ -0,0 +1,119 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <melon/fiber/mutex.h>
+#include <melon/var/var.h>
+#include <sirius/discovery/timing_wheel.h>
+#include <sirius/proto/discovery.interface.pb.h>
+
+namespace sirius::discovery {
+
+    ///
+    /// \brief servlet liveness kept in memory instead of refreshing mtime through raft.
+    ///        heartbeats renew leases on the leader only, the leader replicates just the
+    ///        changes of the alive state with OP_SYNC_LEASES, so every node answers naming
+    ///        from the same state. servlets that never heartbeat are judged by mtime.
+    ///        leases are not in snapshots, a restarted node learns them by the next full sync.
+    ///        deadlines live in a timing wheel, a renewal does not touch the wheel unless it
+    ///        brings the deadline forward, and a sync only visits the leases that came due.
+    class LeaseManager {
+    public:
+        enum LeaseState {
+            LEASE_NONE = -1,
+            LEASE_EXPIRED = 0,
+            LEASE_ALIVE = 1
+        };
+
+        /// called with a servlet whose replicated alive state changed, on every node
+        using LeaseListener = std::function<void(int64_t servlet_id, bool alive)>;
+
+        ~LeaseManager() {
+            fiber_mutex_destroy(&_lease_mutex);
+        }
+
+        static LeaseManager *get_instance() {
+            static LeaseManager instance;
+            return &instance;
+        }
+
+        ///
+        /// \brief must be called before the raft groups start, listeners are not locked.
+        void add_listener(LeaseListener listener);
+
+        ///
+        /// \brief renew the lease of a servlet on the leader for lease_ms.
+        void renew(int64_t servlet_id, int64_t now_ms, int64_t lease_ms);
+
+        ///
+        /// \brief take the changes the leader has not replicated yet, leases expired
+        ///        before now_ms are dropped. a full sync lists every leased servlet.
+        /// \return false if there is nothing to replicate
+        bool take_changes(int64_t now_ms, bool full, sirius::proto::DiscoveryManagerRequest *request);
+
+        ///
+        /// \brief apply a OP_SYNC_LEASES entry, on every node.
+        void apply_changes(const sirius::proto::DiscoveryManagerRequest &request);
+
+        ///
+        /// \brief forget a dropped servlet, on every node.
+        void erase(int64_t servlet_id);
+
+        ///
+        /// \brief replicated state of a servlet, LEASE_NONE if it never heartbeat.
+        LeaseState lease_state(int64_t servlet_id);
+
+        ///
+        /// \brief a new leader grants every alive servlet one lease, its old leases
+        ///        were on the previous leader.
+        void on_leader_start(int64_t now_ms);
+
+        void on_leader_stop();
+
+    private:
+        LeaseManager() : _lease_expired("sirius_lease_expired"), _lease_flipped("sirius_lease_flipped") {
+            fiber_mutex_init(&_lease_mutex, nullptr);
+        }
+
+        struct Lease {
+            int64_t deadline_ms{0};
+            // earliest time this lease is in the wheel for, 0 if it is not
+            int64_t scheduled_ms{0};
+        };
+
+        fiber_mutex_t _lease_mutex;
+        // replicated, servlet id --> alive
+        std::unordered_map<int64_t, bool> _alive;
+        // leader only
+        std::unordered_map<int64_t, Lease> _leases;
+        TimingWheel _wheel;
+        // leader only, renewed but not replicated alive yet
+        std::unordered_set<int64_t> _pending_alive;
+        std::vector<LeaseListener> _listeners;
+        melon::var::Adder<int64_t> _lease_expired;
+        melon::var::Adder<int64_t> _lease_flipped;
+    };
+
+}  // namespace sirius::discovery
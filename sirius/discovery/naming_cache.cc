@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <sirius/discovery/naming_cache.h>
+#include <sirius/flags/sirius.h>
+
+namespace sirius::discovery {
+
+    NamingCacheEntryPtr NamingCache::get(const std::string &key, int64_t generation, int64_t now) {
+        MELON_SCOPED_LOCK(_cache_mutex);
+        auto it = _entries.find(key);
+        if (it == _entries.end() || it->second->generation != generation || now > it->second->valid_until) {
+            _cache_miss << 1;
+            return nullptr;
+        }
+        _cache_hit << 1;
+        return it->second;
+    }
+
+    void NamingCache::put(const std::string &key, NamingCacheEntryPtr entry) {
+        if (FLAGS_sirius_naming_cache_size <= 0) {
+            return;
+        }
+        MELON_SCOPED_LOCK(_cache_mutex);
+        if (_entries.size() >= static_cast<size_t>(FLAGS_sirius_naming_cache_size) && _entries.count(key) == 0) {
+            _entries.clear();
+        }
+        _entries[key] = std::move(entry);
+    }
+
+    void NamingCache::seal(NamingCacheEntry *entry) {
+        std::string data;
+        entry->servlets.SerializePartialToString(&data);
+        // ctime and mtime are stamped by the clock of each node when the entry applies,
+        // they are left out so the same answer has the same version on every node
+        sirius::proto::ServletNamingResponse digest_servlets = entry->servlets;
+        for (auto &servlet: *digest_servlets.mutable_servlets()) {
+            servlet.clear_ctime();
+            servlet.clear_mtime();
+        }
+        std::string digest_data;
+        digest_servlets.SerializePartialToString(&digest_data);
+        // fnv-1a, std::hash is not guaranteed to be the same across builds
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c: digest_data) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        // 0 is left for no version
+        entry->version = hash == 0 ? 1 : static_cast<int64_t>(hash);
+        entry->servlets_data.clear();
+        entry->servlets_data.append(data);
+    }
+
+    std::string NamingCache::make_cache_key(int64_t app_id, const std::vector<int64_t> &zone_ids,
+                                            const std::vector<std::string> &envs,
+                                            const std::vector<std::string> &colors) {
+        std::string key;
+        key.append((char *) &app_id, sizeof(int64_t));
+        uint64_t zone_count = zone_ids.size();
+        key.append((char *) &zone_count, sizeof(uint64_t));
+        for (auto zone_id: zone_ids) {
+            key.append((char *) &zone_id, sizeof(int64_t));
+        }
+        key.append("\002");
+        for (auto &env: envs) {
+            key.append(env);
+            key.append("\001");
+        }
+        key.append("\002");
+        for (auto &color: colors) {
+            key.append(color);
+            key.append("\001");
+        }
+        return key;
+    }
+
+}  // namespace sirius::discovery
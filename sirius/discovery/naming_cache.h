@@ -0,0 +1,99 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <melon/fiber/mutex.h>
+#include <melon/utility/iobuf.h>
+#include <melon/var/var.h>
+#include <sirius/proto/discovery.interface.pb.h>
+
+namespace sirius::discovery {
+
+    ///
+    /// \brief a naming answer computed once and shared by every request of the same query.
+    struct NamingCacheEntry {
+        /// NamingIndex::app_generation the answer was computed at
+        int64_t generation{0};
+        /// the answer holds until this second, when a servlet without lease times out by mtime
+        int64_t valid_until{0};
+        /// fnv-1a of servlets without ctime and mtime, which differ between nodes. the same
+        /// answer has the same version on every node
+        int64_t version{0};
+        /// only servlets are set
+        sirius::proto::ServletNamingResponse servlets;
+        /// servlets serialized, appended to attachments without copying
+        mutil::IOBuf servlets_data;
+    };
+
+    using NamingCacheEntryPtr = std::shared_ptr<const NamingCacheEntry>;
+
+    ///
+    /// \brief naming answers by resolved query, (app_id, zone ids, env, color). an entry is
+    ///        served while the generation of its app is unchanged, it is replaced on the next
+    ///        miss, no write path has to know the cache. the cache is dropped as a whole
+    ///        when it reaches sirius_naming_cache_size entries.
+    class NamingCache {
+    public:
+        ~NamingCache() {
+            fiber_mutex_destroy(&_cache_mutex);
+        }
+
+        static NamingCache *get_instance() {
+            static NamingCache instance;
+            return &instance;
+        }
+
+        ///
+        /// \return nullptr if there is no entry of this generation valid at now
+        NamingCacheEntryPtr get(const std::string &key, int64_t generation, int64_t now);
+
+        void put(const std::string &key, NamingCacheEntryPtr entry);
+
+        ///
+        /// \brief fill servlets_data and version from servlets, ctime and mtime are not
+        ///        part of the version.
+        static void seal(NamingCacheEntry *entry);
+
+        ///
+        /// \param zone_ids sorted and unique
+        /// \param envs sorted and unique
+        /// \param colors sorted and unique
+        static std::string make_cache_key(int64_t app_id, const std::vector<int64_t> &zone_ids,
+                                          const std::vector<std::string> &envs,
+                                          const std::vector<std::string> &colors);
+
+    private:
+        NamingCache() : _cache_hit("sirius_naming_cache_hit"), _cache_miss("sirius_naming_cache_miss") {
+            fiber_mutex_init(&_cache_mutex, nullptr);
+        }
+
+    private:
+        fiber_mutex_t _cache_mutex;
+        std::unordered_map<std::string, NamingCacheEntryPtr> _entries;
+        melon::var::Adder<int64_t> _cache_hit;
+        melon::var::Adder<int64_t> _cache_miss;
+    };
+
+}  // namespace sirius::discovery
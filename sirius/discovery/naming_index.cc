@@ -0,0 +1,163 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <sirius/discovery/naming_index.h>
+#include <sirius/discovery/lease_manager.h>
+#include <sirius/discovery/naming_watcher.h>
+
+namespace sirius::discovery {
+
+    void NamingIndex::init() {
+        LeaseManager::get_instance()->add_listener([this](int64_t servlet_id, bool alive) {
+            on_lease_changed(servlet_id, alive);
+        });
+    }
+
+    void NamingIndex::upsert(const sirius::proto::ServletInfo &servlet_info) {
+        int64_t servlet_id = servlet_info.servlet_id();
+        std::string key = make_index_key(servlet_info.app_id(), servlet_info.zone_id(), servlet_info.env(),
+                                         servlet_info.color());
+        auto instance = std::make_shared<Instance>(servlet_info);
+        MELON_SCOPED_LOCK(_index_mutex);
+        // read under the index lock, a lease change applied meanwhile waits for it in on_lease_changed
+        instance->lease_state.store(LeaseManager::get_instance()->lease_state(servlet_id), std::memory_order_relaxed);
+        auto it = _instances.find(servlet_id);
+        if (it != _instances.end()) {
+            if (it->second.first != key) {
+                remove_from_bucket(it->second.first, servlet_id);
+            }
+            auto &old_info = it->second.second->info;
+            auto zit = _zone_sizes.find({old_info.app_id(), old_info.zone_id()});
+            if (zit != _zone_sizes.end() && --zit->second == 0) {
+                _zone_sizes.erase(zit);
+            }
+            if (old_info.app_id() != servlet_info.app_id()) {
+                bump_generation(old_info.app_id());
+            }
+        }
+        auto bucket = std::make_shared<Bucket>();
+        auto bit = _buckets.find(key);
+        if (bit != _buckets.end()) {
+            bucket->reserve(bit->second->size() + 1);
+            for (auto &entry: *bit->second) {
+                if (entry->info.servlet_id() != servlet_id) {
+                    bucket->push_back(entry);
+                }
+            }
+        }
+        bucket->push_back(instance);
+        _buckets[key] = std::move(bucket);
+        _instances[servlet_id] = std::make_pair(std::move(key), instance);
+        ++_zone_sizes[{servlet_info.app_id(), servlet_info.zone_id()}];
+        bump_generation(servlet_info.app_id());
+    }
+
+    void NamingIndex::erase(int64_t servlet_id) {
+        MELON_SCOPED_LOCK(_index_mutex);
+        auto it = _instances.find(servlet_id);
+        if (it == _instances.end()) {
+            return;
+        }
+        remove_from_bucket(it->second.first, servlet_id);
+        auto &info = it->second.second->info;
+        auto zit = _zone_sizes.find({info.app_id(), info.zone_id()});
+        if (zit != _zone_sizes.end() && --zit->second == 0) {
+            _zone_sizes.erase(zit);
+        }
+        bump_generation(info.app_id());
+        _instances.erase(it);
+    }
+
+    void NamingIndex::lookup(int64_t app_id, const std::vector<int64_t> &zone_ids,
+                             const std::vector<std::string> &envs, const std::vector<std::string> &colors,
+                             std::vector<BucketPtr> &buckets) {
+        MELON_SCOPED_LOCK(_index_mutex);
+        for (auto zone_id: zone_ids) {
+            for (auto &env: envs) {
+                for (auto &color: colors) {
+                    auto it = _buckets.find(make_index_key(app_id, zone_id, env, color));
+                    if (it != _buckets.end()) {
+                        buckets.push_back(it->second);
+                    }
+                }
+            }
+        }
+    }
+
+    size_t NamingIndex::zone_size(int64_t app_id, int64_t zone_id) {
+        MELON_SCOPED_LOCK(_index_mutex);
+        auto it = _zone_sizes.find({app_id, zone_id});
+        return it == _zone_sizes.end() ? 0 : it->second;
+    }
+
+    int64_t NamingIndex::app_generation(int64_t app_id) {
+        MELON_SCOPED_LOCK(_index_mutex);
+        auto it = _app_generations.find(app_id);
+        return it == _app_generations.end() ? 0 : it->second;
+    }
+
+    std::string NamingIndex::make_index_key(int64_t app_id, int64_t zone_id, const std::string &env,
+                                            const std::string &color) {
+        std::string key;
+        key.reserve(sizeof(int64_t) * 2 + env.size() + color.size() + 1);
+        key.append((char *) &app_id, sizeof(int64_t));
+        key.append((char *) &zone_id, sizeof(int64_t));
+        key.append(env);
+        key.append("\001");
+        key.append(color);
+        return key;
+    }
+
+    void NamingIndex::on_lease_changed(int64_t servlet_id, bool alive) {
+        MELON_SCOPED_LOCK(_index_mutex);
+        auto it = _instances.find(servlet_id);
+        if (it == _instances.end()) {
+            return;
+        }
+        int lease_state = alive ? LeaseManager::LEASE_ALIVE : LeaseManager::LEASE_EXPIRED;
+        if (it->second.second->lease_state.exchange(lease_state, std::memory_order_relaxed) != lease_state) {
+            bump_generation(it->second.second->info.app_id());
+        }
+    }
+
+    void NamingIndex::bump_generation(int64_t app_id) {
+        _app_generations[app_id] = ++_generation;
+        NamingWatcher::get_instance()->notify(app_id);
+    }
+
+    void NamingIndex::remove_from_bucket(const std::string &key, int64_t servlet_id) {
+        auto it = _buckets.find(key);
+        if (it == _buckets.end()) {
+            return;
+        }
+        auto bucket = std::make_shared<Bucket>();
+        bucket->reserve(it->second->size());
+        for (auto &entry: *it->second) {
+            if (entry->info.servlet_id() != servlet_id) {
+                bucket->push_back(entry);
+            }
+        }
+        if (bucket->empty()) {
+            _buckets.erase(it);
+        } else {
+            it->second = std::move(bucket);
+        }
+    }
+
+}  // namespace sirius::discovery
@@ -0,0 +1,125 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <melon/fiber/mutex.h>
+#include <sirius/proto/discovery.interface.pb.h>
+
+namespace sirius::discovery {
+
+    ///
+    /// \brief secondary index of servlets by (app_id, zone_id, env, color), kept by
+    ///        ServletManager on every write it applies, so naming reads one bucket per
+    ///        key instead of looking up and copying every servlet of the zones.
+    ///        a bucket is immutable once published, writers replace it by a new one and
+    ///        readers keep the old one alive by its shared_ptr, no lock is held while a
+    ///        reader walks a bucket. the lease state is the only mutable part of an entry.
+    ///        every change bumps the generation of its app, answers cached for an older
+    ///        generation are stale.
+    class NamingIndex {
+    public:
+        struct Instance {
+            explicit Instance(const sirius::proto::ServletInfo &servlet_info) : info(servlet_info) {}
+
+            const sirius::proto::ServletInfo info;
+            /// LeaseManager::LeaseState, updated in place by the lease listener
+            std::atomic<int> lease_state;
+        };
+
+        using InstancePtr = std::shared_ptr<Instance>;
+        using Bucket = std::vector<InstancePtr>;
+        using BucketPtr = std::shared_ptr<const Bucket>;
+
+        ~NamingIndex() {
+            fiber_mutex_destroy(&_index_mutex);
+        }
+
+        static NamingIndex *get_instance() {
+            static NamingIndex instance;
+            return &instance;
+        }
+
+        ///
+        /// \brief subscribe to lease changes, must be called before the raft groups start.
+        void init();
+
+        ///
+        /// \brief add or replace a servlet, it moves to another bucket if its env or color changed.
+        void upsert(const sirius::proto::ServletInfo &servlet_info);
+
+        ///
+        /// \brief remove a servlet, nothing happens if it is not indexed.
+        void erase(int64_t servlet_id);
+
+        ///
+        /// \brief buckets of every (zone, env, color) combination of an app that has servlets.
+        /// \param buckets appended, may stay empty
+        void lookup(int64_t app_id, const std::vector<int64_t> &zone_ids,
+                    const std::vector<std::string> &envs, const std::vector<std::string> &colors,
+                    std::vector<BucketPtr> &buckets);
+
+        ///
+        /// \return number of servlets of a zone in any env and color
+        size_t zone_size(int64_t app_id, int64_t zone_id);
+
+        ///
+        /// \brief changes on every write to the servlets or leases of an app, never goes back
+        ///        to an earlier value, so it tags answers computed from the index.
+        /// \return 0 if nothing of the app was ever indexed
+        int64_t app_generation(int64_t app_id);
+
+        static std::string make_index_key(int64_t app_id, int64_t zone_id, const std::string &env,
+                                          const std::string &color);
+
+    private:
+        NamingIndex() {
+            fiber_mutex_init(&_index_mutex, nullptr);
+        }
+
+        void on_lease_changed(int64_t servlet_id, bool alive);
+
+        /// \brief copy a bucket without one servlet, called with _index_mutex held.
+        void remove_from_bucket(const std::string &key, int64_t servlet_id);
+
+        /// \brief called with _index_mutex held, wakes the naming watches of the app.
+        void bump_generation(int64_t app_id);
+
+    private:
+        fiber_mutex_t _index_mutex;
+        //! index key --> servlets of it
+        std::unordered_map<std::string, BucketPtr> _buckets;
+        //! servlet id --> index key and entry
+        std::unordered_map<int64_t, std::pair<std::string, InstancePtr>> _instances;
+        //! (app id, zone id) --> servlet count
+        std::map<std::pair<int64_t, int64_t>, size_t> _zone_sizes;
+        //! app id --> generation, drawn from one counter so a value is never reused
+        std::unordered_map<int64_t, int64_t> _app_generations;
+        int64_t _generation{0};
+    };
+
+}  // namespace sirius::discovery
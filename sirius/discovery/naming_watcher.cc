@@ -0,0 +1,180 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <sirius/discovery/naming_watcher.h>
+#include <sirius/discovery/naming_index.h>
+#include <sirius/discovery/query_app_manager.h>
+#include <sirius/base/log.h>
+#include <limits>
+
+namespace sirius::discovery {
+
+    int64_t NamingWatcher::recheck_time_us(int64_t valid_until) {
+        if (valid_until >= std::numeric_limits<int64_t>::max() / 1000000 - 1) {
+            return 0;
+        }
+        // the answer holds through valid_until, it changes in the next second
+        return (valid_until + 1) * 1000000;
+    }
+
+    void NamingWatcher::init() {
+        _watch_bth.run([this]() { run(); });
+    }
+
+    void NamingWatcher::stop() {
+        {
+            MELON_SCOPED_LOCK(_watch_mutex);
+            if (_shutdown) {
+                return;
+            }
+            _shutdown = true;
+            fiber_cond_signal(&_watch_cond);
+        }
+        _watch_bth.join();
+        LOG(INFO) << "naming watcher stopped";
+    }
+
+    void NamingWatcher::park(const Watch &watch, int64_t generation) {
+        bool shutdown = false;
+        {
+            MELON_SCOPED_LOCK(_watch_mutex);
+            shutdown = _shutdown;
+            if (!shutdown) {
+                _watches[watch.app_id].push_back(watch);
+                _parked << 1;
+            }
+        }
+        if (shutdown) {
+            Watch answer = watch;
+            check(answer, 0, true, nullptr);
+            return;
+        }
+        // a change applied between the first answer and parking notified nobody
+        if (NamingIndex::get_instance()->app_generation(watch.app_id) != generation) {
+            notify(watch.app_id);
+        }
+    }
+
+    void NamingWatcher::notify(int64_t app_id) {
+        MELON_SCOPED_LOCK(_watch_mutex);
+        if (_watches.count(app_id) == 0) {
+            return;
+        }
+        _changed_apps.insert(app_id);
+        fiber_cond_signal(&_watch_cond);
+    }
+
+    void NamingWatcher::run() {
+        while (true) {
+            std::vector<Watch> woken;
+            std::vector<Watch> due;
+            bool shutdown = false;
+            int64_t now_us = 0;
+            {
+                MELON_SCOPED_LOCK(_watch_mutex);
+                if (_changed_apps.empty() && !_shutdown) {
+                    timespec tm = mutil::microseconds_from_now(kCheckIntervalUs);
+                    fiber_cond_timedwait(&_watch_cond, &_watch_mutex, &tm);
+                }
+                shutdown = _shutdown;
+                for (auto app_id: _changed_apps) {
+                    auto it = _watches.find(app_id);
+                    if (it == _watches.end()) {
+                        continue;
+                    }
+                    woken.insert(woken.end(), it->second.begin(), it->second.end());
+                    _watches.erase(it);
+                }
+                _changed_apps.clear();
+                now_us = mutil::gettimeofday_us();
+                for (auto it = _watches.begin(); it != _watches.end();) {
+                    auto &watches = it->second;
+                    for (size_t i = 0; i < watches.size();) {
+                        if (shutdown || watches[i].deadline_us <= now_us) {
+                            due.push_back(watches[i]);
+                            watches[i] = watches.back();
+                            watches.pop_back();
+                        } else if (watches[i].recheck_us != 0 && watches[i].recheck_us <= now_us) {
+                            woken.push_back(watches[i]);
+                            watches[i] = watches.back();
+                            watches.pop_back();
+                        } else {
+                            ++i;
+                        }
+                    }
+                    if (watches.empty()) {
+                        it = _watches.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                _parked << -static_cast<int64_t>(woken.size() + due.size());
+            }
+            std::vector<std::pair<Watch, int64_t>> still_parked;
+            for (auto &watch: woken) {
+                int64_t generation = 0;
+                if (!check(watch, now_us, shutdown, &generation)) {
+                    still_parked.emplace_back(watch, generation);
+                }
+            }
+            for (auto &watch: due) {
+                check(watch, now_us, true, nullptr);
+            }
+            if (!still_parked.empty()) {
+                {
+                    MELON_SCOPED_LOCK(_watch_mutex);
+                    for (auto &parked: still_parked) {
+                        _watches[parked.first.app_id].push_back(parked.first);
+                    }
+                    _parked << still_parked.size();
+                }
+                // the same race as in park, a change while checking
+                auto *naming_index = NamingIndex::get_instance();
+                for (auto &parked: still_parked) {
+                    if (naming_index->app_generation(parked.first.app_id) != parked.second) {
+                        notify(parked.first.app_id);
+                    }
+                }
+            }
+            if (shutdown) {
+                return;
+            }
+        }
+    }
+
+    bool NamingWatcher::check(Watch &watch, int64_t now_us, bool force, int64_t *generation) {
+        if (generation != nullptr) {
+            *generation = NamingIndex::get_instance()->app_generation(watch.app_id);
+        }
+        sirius::proto::ServletNamingResponse response;
+        mutil::IOBuf attachment;
+        int64_t valid_until = std::numeric_limits<int64_t>::max();
+        QueryAppManager::get_instance()->naming(watch.request, &response, &attachment, &valid_until);
+        if (!force && response.errcode() == sirius::proto::SUCCESS && response.not_modified()
+            && watch.deadline_us > now_us) {
+            watch.recheck_us = recheck_time_us(valid_until);
+            return false;
+        }
+        watch.response->Swap(&response);
+        watch.cntl->response_attachment().swap(attachment);
+        watch.done->Run();
+        return true;
+    }
+
+}  // namespace sirius::discovery
@@ -0,0 +1,115 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <melon/fiber/mutex.h>
+#include <melon/rpc/controller.h>
+#include <melon/var/var.h>
+#include <sirius/base/fiber.h>
+#include <sirius/proto/discovery.interface.pb.h>
+
+namespace sirius::discovery {
+
+    ///
+    /// \brief naming watches parked until the answer of their query changes or they time out.
+    ///        a watch is parked by its app, NamingIndex notifies the app on every change it
+    ///        applies, on the leader and on followers alike. one fiber re-checks the watches
+    ///        of changed apps against the naming cache and answers those whose version moved,
+    ///        the others stay parked. a servlet without lease leaves the answer by mtime with
+    ///        no change applied, so a watch is also re-checked when its answer expires. the
+    ///        version leaves out the times each node stamps, a watch may move between peers.
+    ///        a parked watch holds no fiber, only its rpc closure.
+    class NamingWatcher {
+    public:
+        struct Watch {
+            melon::Controller *cntl{nullptr};
+            const sirius::proto::ServletNamingRequest *request{nullptr};
+            sirius::proto::ServletNamingResponse *response{nullptr};
+            google::protobuf::Closure *done{nullptr};
+            int64_t app_id{0};
+            int64_t deadline_us{0};
+            /// when the answer expires by mtime, 0 if it does not
+            int64_t recheck_us{0};
+        };
+
+        ///
+        /// \brief the time a watch answered at valid_until has to be checked again.
+        /// \param valid_until NamingCacheEntry::valid_until, in seconds
+        static int64_t recheck_time_us(int64_t valid_until);
+
+        static constexpr int64_t kCheckIntervalUs = 100 * 1000;
+
+        ~NamingWatcher() {
+            fiber_cond_destroy(&_watch_cond);
+            fiber_mutex_destroy(&_watch_mutex);
+        }
+
+        static NamingWatcher *get_instance() {
+            static NamingWatcher instance;
+            return &instance;
+        }
+
+        ///
+        /// \brief start the fiber answering watches.
+        void init();
+
+        ///
+        /// \brief answer every parked watch with what it has now and stop.
+        void stop();
+
+        ///
+        /// \brief park a watch whose answer is not modified yet, the watcher owns its done.
+        /// \param generation NamingIndex::app_generation read before the watch was answered
+        void park(const Watch &watch, int64_t generation);
+
+        ///
+        /// \brief wake the watches of an app, called by NamingIndex with its lock held.
+        void notify(int64_t app_id);
+
+    private:
+        NamingWatcher() : _parked("sirius_naming_watch_parked") {
+            fiber_mutex_init(&_watch_mutex, nullptr);
+            fiber_cond_init(&_watch_cond, nullptr);
+        }
+
+        void run();
+
+        ///
+        /// \brief answer a watch again from the cache.
+        /// \param generation set to NamingIndex::app_generation read before the check, may be nullptr
+        /// \return true if it is answered, false if it is still not modified and not due
+        bool check(Watch &watch, int64_t now_us, bool force, int64_t *generation);
+
+    private:
+        fiber_mutex_t _watch_mutex;
+        fiber_cond_t _watch_cond;
+        //! app id --> parked watches
+        std::unordered_map<int64_t, std::vector<Watch>> _watches;
+        std::unordered_set<int64_t> _changed_apps;
+        bool _shutdown{false};
+        Fiber _watch_bth;
+        melon::var::Adder<int64_t> _parked;
+    };
+
+}  // namespace sirius::discovery
@@ -107,7 +107,7 @@ namespace sirius::discovery {
         MELON_SCOPED_LOCK(_user_mutex);
         _user_privilege[username] = user_privilege;
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(INFO) << "create user success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "create user success, request:" << request.ShortDebugString();
     }
 
     void PrivilegeManager::drop_user(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done) {
@@ -130,7 +130,7 @@ namespace sirius::discovery {
         MELON_SCOPED_LOCK(_user_mutex);
         _user_privilege.erase(username);
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(INFO) << "drop user success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "drop user success, request:" << request.ShortDebugString();
     }
 
     void PrivilegeManager::add_privilege(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done) {
@@ -181,7 +181,7 @@ namespace sirius::discovery {
         MELON_SCOPED_LOCK(_user_mutex);
         _user_privilege[username] = tmp_mem_privilege;
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(INFO) << "add privilege success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "add privilege success, request:" << request.ShortDebugString();
     }
 
     void PrivilegeManager::drop_privilege(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done) {
@@ -235,7 +235,7 @@ namespace sirius::discovery {
         MELON_SCOPED_LOCK(_user_mutex);
         _user_privilege[username] = tmp_mem_privilege;
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(INFO) << "drop privilege success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "drop privilege success, request:" << request.ShortDebugString();
     }
 
 
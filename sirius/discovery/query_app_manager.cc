@@ -20,90 +20,121 @@
 #include <sirius/discovery/query_app_manager.h>
 #include <sirius/discovery/query_zone_manager.h>
 #include <sirius/discovery/query_servlet_manager.h>
+#include <sirius/discovery/lease_manager.h>
+#include <sirius/discovery/naming_index.h>
+#include <sirius/discovery/zone_manager.h>
 #include <sirius/base/log.h>
+#include <sirius/flags/sirius.h>
 #include <turbo/times/time.h>
 #include <turbo/container/flat_hash_set.h>
+#include <algorithm>
+#include <limits>
 
 namespace sirius::discovery {
 
     void QueryAppManager::naming(const sirius::proto::ServletNamingRequest *request,
-                sirius::proto::ServletNamingResponse *response) {
-        AppManager *manager = AppManager::get_instance();
-        std::set<int64_t> zone_ids;
-        {
-            MELON_SCOPED_LOCK(manager->_app_mutex);
-            auto it = manager->_app_id_map.find(request->app_name());
-            if (it == manager->_app_id_map.end()) {
-                response->set_errcode(sirius::proto::INPUT_PARAM_ERROR);
-                response->set_errmsg("app not exist");
-                return;
-            }
-            auto app_id = it->second;
-            zone_ids = manager->_zone_ids[app_id];
-        }
-        if(zone_ids.empty()) {
+                sirius::proto::ServletNamingResponse *response, mutil::IOBuf *attachment,
+                int64_t *valid_until) {
+        int64_t app_id = AppManager::get_instance()->get_app_id(request->app_name());
+        if (app_id == 0) {
             response->set_errcode(sirius::proto::INPUT_PARAM_ERROR);
-            response->set_errmsg("app has no zone");
+            response->set_errmsg("app not exist");
             return;
         }
         auto *zone_manager = ZoneManager::get_instance();
-        auto &query_zone = request->zones();
-        std::vector<std::string> zone_names(query_zone.size());
-        for (auto &zone: query_zone) {
-            zone_names.push_back(zone);
-        }
-        std::vector<int64_t> query_zone_id;
-        zone_manager->get_zone_ids(request->app_name(), zone_names, query_zone_id);
-        std::set<int64_t> query_zone_ids;
-        for (auto &id: query_zone_id) {
-            if (zone_ids.find(id) != zone_ids.end()) {
-                query_zone_ids.insert(id);
-            }
-        }
+        std::vector<std::string> zone_names(request->zones().begin(), request->zones().end());
+        std::vector<int64_t> query_zone_ids;
+        zone_manager->get_zone_ids(request->app_name(), zone_names, query_zone_ids);
+        std::sort(query_zone_ids.begin(), query_zone_ids.end());
+        query_zone_ids.erase(std::unique(query_zone_ids.begin(), query_zone_ids.end()), query_zone_ids.end());
+        query_zone_ids.erase(std::remove(query_zone_ids.begin(), query_zone_ids.end(), 0), query_zone_ids.end());
         if (query_zone_ids.empty()) {
             response->set_errcode(sirius::proto::INPUT_PARAM_ERROR);
             response->set_errmsg("zone not exist");
             return;
         }
+        // sorted and unique, duplicated env or color would return a servlet twice
+        std::set<std::string> env_set(request->env().begin(), request->env().end());
+        std::set<std::string> color_set(request->color().begin(), request->color().end());
+        std::vector<std::string> envs(env_set.begin(), env_set.end());
+        std::vector<std::string> colors(color_set.begin(), color_set.end());
 
-        std::set<int64_t> server_ids;
-        for(auto &zone_id: query_zone_ids) {
-            std::set<int64_t> tmp_server_ids;
-            zone_manager->get_servlet_ids(zone_id, tmp_server_ids);
-            server_ids.insert(tmp_server_ids.begin(), tmp_server_ids.end());
-        }
-        if (server_ids.empty()) {
-            response->set_errcode(sirius::proto::INPUT_PARAM_ERROR);
-            response->set_errmsg("zone has no server");
-            return;
-        }
-
-        std::set<std::string> env_set;
-        env_set.insert(request->env().begin(), request->env().end());
-        std::set<std::string> color_set;
-        color_set.insert(request->color().begin(), request->color().end());
+        auto *naming_index = NamingIndex::get_instance();
+        auto *naming_cache = NamingCache::get_instance();
+        auto cache_key = NamingCache::make_cache_key(app_id, query_zone_ids, envs, colors);
+        // read before the index, a write racing the build leaves the entry stale, not wrong
+        int64_t generation = naming_index->app_generation(app_id);
         auto tnow = turbo::Time::to_time_t(turbo::Time::current_time());
-        auto *servlet_manager = ServletManager::get_instance();
-        int time_out = 50;
-        for(auto &server_id: server_ids) {
-            sirius::proto::ServletInfo servlet_info;
-            if (servlet_manager->get_servlet_info(server_id, servlet_info) != 0) {
-                continue;
+        auto entry = naming_cache->get(cache_key, generation, tnow);
+        if (entry == nullptr) {
+            size_t zone_servlets = 0;
+            for (auto zone_id: query_zone_ids) {
+                zone_servlets += naming_index->zone_size(app_id, zone_id);
             }
-            LOG(INFO) << "server_id: " << server_id<< " env: " << servlet_info.env() << " color: " << servlet_info.color() << " mtime: " << servlet_info.mtime() << " tnow: " << tnow;
-            if (env_set.find(servlet_info.env()) == env_set.end()) {
-                continue;
-            }
-            if (color_set.find(servlet_info.color()) == color_set.end()) {
-                continue;
-            }
-            if (tnow - servlet_info.mtime() > time_out) {
-                continue;
+            if (zone_servlets == 0) {
+                response->set_errcode(sirius::proto::INPUT_PARAM_ERROR);
+                response->set_errmsg("zone has no server");
+                return;
             }
-            *(response->add_servlets()) = servlet_info;
+            entry = build_naming(app_id, query_zone_ids, envs, colors, generation, tnow);
+            naming_cache->put(cache_key, entry);
+        }
+
+        if (valid_until != nullptr) {
+            *valid_until = entry->valid_until;
+        }
+        response->set_version(entry->version);
+        if (request->has_known_version() && request->known_version() == entry->version) {
+            response->set_not_modified(true);
+        } else if (attachment != nullptr && request->servlets_in_attachment()) {
+            attachment->append(entry->servlets_data);
+            response->set_servlets_in_attachment(true);
+        } else {
+            response->mutable_servlets()->CopyFrom(entry->servlets.servlets());
         }
         response->set_errcode(sirius::proto::SUCCESS);
     }
+
+    NamingCacheEntryPtr QueryAppManager::build_naming(int64_t app_id, const std::vector<int64_t> &zone_ids,
+                                                      const std::vector<std::string> &envs,
+                                                      const std::vector<std::string> &colors,
+                                                      int64_t generation, int64_t tnow) {
+        std::vector<NamingIndex::BucketPtr> buckets;
+        NamingIndex::get_instance()->lookup(app_id, zone_ids, envs, colors, buckets);
+        std::vector<const NamingIndex::Instance *> instances;
+        int64_t time_out = FLAGS_sirius_servlet_mtime_timeout_s;
+        auto entry = std::make_shared<NamingCacheEntry>();
+        entry->generation = generation;
+        entry->valid_until = std::numeric_limits<int64_t>::max();
+        for (auto &bucket: buckets) {
+            for (auto &instance: *bucket) {
+                // a servlet heartbeating by lease is judged by it, others by mtime
+                auto lease_state = instance->lease_state.load(std::memory_order_relaxed);
+                if (lease_state == LeaseManager::LEASE_EXPIRED) {
+                    continue;
+                }
+                if (lease_state == LeaseManager::LEASE_NONE) {
+                    int64_t deadline = static_cast<int64_t>(instance->info.mtime()) + time_out;
+                    if (tnow > deadline) {
+                        continue;
+                    }
+                    entry->valid_until = std::min(entry->valid_until, deadline);
+                }
+                instances.push_back(instance.get());
+            }
+        }
+        // bucket order depends on apply order, sort so every node serializes the same bytes
+        std::sort(instances.begin(), instances.end(),
+                  [](const NamingIndex::Instance *lhs, const NamingIndex::Instance *rhs) {
+                      return lhs->info.servlet_id() < rhs->info.servlet_id();
+                  });
+        entry->servlets.mutable_servlets()->Reserve(instances.size());
+        for (auto *instance: instances) {
+            *(entry->servlets.add_servlets()) = instance->info;
+        }
+        NamingCache::seal(entry.get());
+        return entry;
+    }
     void QueryAppManager::get_app_info(const sirius::proto::DiscoveryQueryRequest *request,
                                                    sirius::proto::DiscoveryQueryResponse *response) {
         AppManager *manager = AppManager::get_instance();
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <sirius/discovery/app_manager.h>
+#include <sirius/discovery/naming_cache.h>
 
 namespace sirius::discovery {
     class QueryAppManager {
@@ -31,8 +32,13 @@ namespace sirius::discovery {
             return &instance;
         }
 
+        ///
+        /// \brief answer naming from the cache, the index when it misses.
+        /// \param attachment takes the servlets serialized if the request asks for it, may be nullptr
+        /// \param valid_until set to the second the answer holds until, may be nullptr
         void naming(const sirius::proto::ServletNamingRequest *request,
-                    sirius::proto::ServletNamingResponse *response);
+                    sirius::proto::ServletNamingResponse *response, mutil::IOBuf *attachment,
+                    int64_t *valid_until = nullptr);
         ///
         /// \param request
         /// \param response
@@ -40,5 +46,10 @@ namespace sirius::discovery {
 
     private:
         QueryAppManager() {}
+
+        NamingCacheEntryPtr build_naming(int64_t app_id, const std::vector<int64_t> &zone_ids,
+                                         const std::vector<std::string> &envs,
+                                         const std::vector<std::string> &colors,
+                                         int64_t generation, int64_t tnow);
     };
 } // namespace sirius::discovery
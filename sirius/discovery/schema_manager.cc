@@ -190,6 +190,8 @@ namespace sirius::discovery {
                 return -1;
             }
         }
+        // zones were reloaded, servlets of shards are not in this snapshot
+        ServletManager::get_instance()->link_shard_servlets();
         LOG(INFO) << "SchemaManager load_snapshot done...";
         return 0;
     }
@@ -21,6 +21,7 @@
 #include <sirius/discovery/base_state_machine.h>
 #include <sirius/discovery/sirius_db.h>
 #include <sirius/discovery/app_manager.h>
+#include <sirius/discovery/lease_manager.h>
 
 namespace sirius::discovery {
     void ServletManager::create_servlet(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done) {
@@ -85,7 +86,7 @@ namespace sirius::discovery {
         set_max_servlet_id(tmp_servlet_id);
         ZoneManager::get_instance()->add_servlet_id(app_id, tmp_servlet_id);
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(WARNING) << "create zone success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "create zone success, request:" << request.ShortDebugString();
     }
 
     void ServletManager::drop_servlet(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done) {
@@ -126,8 +127,9 @@ namespace sirius::discovery {
         erase_servlet_info(servlet_name);
         // update namespace memory info
         ZoneManager::get_instance()->delete_servlet_id(zone_id, servlet_id);
+        LeaseManager::get_instance()->erase(servlet_id);
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(WARNING) << "drop zone success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "drop zone success, request:" << request.ShortDebugString();
     }
 
     void ServletManager::modify_servlet(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done) {
@@ -186,7 +188,7 @@ namespace sirius::discovery {
         // update zone values in memory
         set_servlet_info(tmp_servlet_info);
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(INFO) << "modify zone success, request:" << tmp_servlet_info.ShortDebugString();
+        DLOG(INFO) << "modify zone success, request:" << tmp_servlet_info.ShortDebugString();
     }
 
     int ServletManager::load_servlet_snapshot(const std::string &value) {
@@ -202,4 +204,39 @@ namespace sirius::discovery {
                 servlet_pb.zone_id(), servlet_pb.servlet_id());
         return 0;
     }
+
+    void ServletManager::clear_shard(int shard) {
+        std::vector<std::pair<int64_t, int64_t>> zone_links;
+        {
+            MELON_SCOPED_LOCK(_servlet_mutex);
+            for (auto it = _servlet_info_map.begin(); it != _servlet_info_map.end();) {
+                if (shard_of_servlet_id(it->first) != shard) {
+                    ++it;
+                    continue;
+                }
+                zone_links.emplace_back(it->second.zone_id(), it->first);
+                _servlet_id_map.erase(make_servlet_key(it->second.app_name(), it->second.zone(), it->second.servlet_name()));
+                NamingIndex::get_instance()->erase(it->first);
+                it = _servlet_info_map.erase(it);
+            }
+        }
+        for (auto &link: zone_links) {
+            ZoneManager::get_instance()->delete_servlet_id(link.first, link.second);
+        }
+    }
+
+    void ServletManager::link_shard_servlets() {
+        std::vector<std::pair<int64_t, int64_t>> zone_links;
+        {
+            MELON_SCOPED_LOCK(_servlet_mutex);
+            for (auto &it: _servlet_info_map) {
+                if (shard_of_servlet_id(it.first) >= 0) {
+                    zone_links.emplace_back(it.second.zone_id(), it.first);
+                }
+            }
+        }
+        for (auto &link: zone_links) {
+            ZoneManager::get_instance()->add_servlet_id(link.first, link.second);
+        }
+    }
 }  //  namespace sirius::discovery
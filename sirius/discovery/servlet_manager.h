@@ -23,6 +23,7 @@
 #include <set>
 #include <mutex>
 #include <sirius/discovery/sirius_constants.h>
+#include <sirius/discovery/naming_index.h>
 #include <sirius/proto/discovery.interface.pb.h>
 #include <melon/fiber/mutex.h>
 #include <melon/raft/raft.h>
@@ -31,6 +32,11 @@ namespace sirius::discovery {
     class ServletManager {
     public:
         friend class QueryServletManager;
+        friend class ServletShardStateMachine;
+
+        /// servlet ids of shard i are (i + 1) << kShardIdShift | local id, below it are
+        /// the servlets of the discovery raft group
+        static constexpr int kShardIdShift = 48;
 
         ~ServletManager() {
             fiber_mutex_destroy(&_servlet_mutex);
@@ -78,9 +84,28 @@ namespace sirius::discovery {
         int load_servlet_snapshot(const std::string &value);
 
         ///
-        /// \brief clear data in memory
+        /// \brief clear data in memory, servlets of shards are kept,
+        ///        they are owned by their own raft groups
         void clear();
 
+        ///
+        /// \brief clear the servlets of one shard in memory, and their zone links
+        void clear_shard(int shard);
+
+        ///
+        /// \brief link the servlets of all shards to their zones again, called after
+        ///        zones are reloaded
+        void link_shard_servlets();
+
+        static int64_t make_shard_servlet_id(int shard, int64_t local_id) {
+            return (static_cast<int64_t>(shard + 1) << kShardIdShift) | local_id;
+        }
+
+        /// \return the shard of a servlet id, -1 for the discovery raft group
+        static int shard_of_servlet_id(int64_t servlet_id) {
+            return static_cast<int>(servlet_id >> kShardIdShift) - 1;
+        }
+
         ///
         /// \brief set max servlet id
         /// \param max_servlet_id
@@ -164,6 +189,7 @@ namespace sirius::discovery {
         std::string servlet_name = make_servlet_key(servlet_info.app_name(), servlet_info.zone(), servlet_info.servlet_name());
         _servlet_id_map[servlet_name] = servlet_info.servlet_id();
         _servlet_info_map[servlet_info.servlet_id()] = servlet_info;
+        NamingIndex::get_instance()->upsert(servlet_info);
     }
 
     inline void ServletManager::erase_servlet_info(const std::string &servlet_name) {
@@ -171,6 +197,7 @@ namespace sirius::discovery {
         int64_t servlet_id = _servlet_id_map[servlet_name];
         _servlet_id_map.erase(servlet_name);
         _servlet_info_map.erase(servlet_id);
+        NamingIndex::get_instance()->erase(servlet_id);
     }
 
     inline int64_t ServletManager::get_servlet_id(const std::string &servlet_name) {
@@ -190,8 +217,16 @@ namespace sirius::discovery {
     }
 
     inline void ServletManager::clear() {
-        _servlet_id_map.clear();
-        _servlet_info_map.clear();
+        MELON_SCOPED_LOCK(_servlet_mutex);
+        for (auto it = _servlet_info_map.begin(); it != _servlet_info_map.end();) {
+            if (shard_of_servlet_id(it->first) >= 0) {
+                ++it;
+                continue;
+            }
+            _servlet_id_map.erase(make_servlet_key(it->second.app_name(), it->second.zone(), it->second.servlet_name()));
+            NamingIndex::get_instance()->erase(it->first);
+            it = _servlet_info_map.erase(it);
+        }
     }
 
     inline ServletManager::ServletManager() : _max_servlet_id(0) {
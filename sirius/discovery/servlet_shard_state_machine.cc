@@ -0,0 +1,397 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <sirius/discovery/servlet_shard_state_machine.h>
+#include <melon/raft/util.h>
+#include <melon/raft/storage.h>
+#include <sirius/discovery/servlet_manager.h>
+#include <sirius/discovery/zone_manager.h>
+#include <sirius/discovery/app_manager.h>
+#include <sirius/discovery/closure_pipeline.h>
+#include <sirius/discovery/lease_manager.h>
+#include <sirius/storage/rocks_storage.h>
+#include <sirius/storage/sst_file_writer.h>
+#include <sirius/flags/sirius.h>
+
+namespace sirius::discovery {
+
+    const std::string ServletShardStateMachine::SNAPSHOT_SHARD_FILE = "servlet_shard.sst";
+    const std::string ServletShardStateMachine::SNAPSHOT_SHARD_FILE_WITH_SLASH = "/" + SNAPSHOT_SHARD_FILE;
+
+    static std::string shard_key_prefix(int shard) {
+        std::string prefix = DiscoveryConstants::SERVLET_SHARD_IDENTIFY;
+        // big endian, so the key ranges of shards follow each other
+        for (int i = 3; i >= 0; --i) {
+            prefix.push_back(static_cast<char>((static_cast<uint32_t>(shard) >> (i * 8)) & 0xFF));
+        }
+        return prefix;
+    }
+
+    ServletShardStateMachine::ServletShardStateMachine(int shard, const melon::raft::PeerId &peerId) :
+            BaseStateMachine(DiscoveryConstants::ServletShardMachineRegionBase + shard,
+                             FLAGS_sirius_raft_group + "_servlet_" + std::to_string(shard),
+                             "/servlet_shard_" + std::to_string(shard), peerId),
+            _shard(shard),
+            _key_start(shard_key_prefix(shard)),
+            _key_end(shard_key_prefix(shard + 1)),
+            _handle(RocksStorage::get_instance()->get_meta_info_handle()) {
+    }
+
+    int ServletShardStateMachine::shard_of(const std::string &app_name, int shard_count) {
+        // fnv-1a, std::hash is not guaranteed to be the same across builds
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c: app_name) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        return static_cast<int>(hash % static_cast<uint64_t>(shard_count));
+    }
+
+    void ServletShardStateMachine::process(google::protobuf::RpcController *controller,
+                                           const sirius::proto::DiscoveryManagerRequest *request,
+                                           sirius::proto::DiscoveryManagerResponse *response,
+                                           google::protobuf::Closure *done) {
+        melon::ClosureGuard done_guard(done);
+        if (is_leader() && request->op_type() == sirius::proto::OP_CREATE_SERVLET) {
+            auto &servlet_info = request->servlet_info();
+            int64_t app_id = AppManager::get_instance()->get_app_id(servlet_info.app_name());
+            if (app_id == 0) {
+                SET_RESPONSE(response, sirius::proto::SERVLET_NO_APP, "app not exist");
+                return;
+            }
+            int64_t zone_id = ZoneManager::get_instance()->get_zone_id(
+                    servlet_info.app_name() + "\001" + servlet_info.zone());
+            if (zone_id == 0) {
+                SET_RESPONSE(response, sirius::proto::SERVLET_NO_ZONE, "zone not exist");
+                return;
+            }
+            // the ids go into the proposed copy, the rpc request stays as the caller sent it
+            auto *owned = new OwnedRequestClosure(*request, done_guard.release());
+            owned->request.mutable_servlet_info()->set_app_id(app_id);
+            owned->request.mutable_servlet_info()->set_zone_id(zone_id);
+            BaseStateMachine::process(controller, &owned->request, response, owned);
+            return;
+        }
+        BaseStateMachine::process(controller, request, response, done_guard.release());
+    }
+
+    void ServletShardStateMachine::on_apply(melon::raft::Iterator &iter) {
+        TimeCost apply_cost;
+        std::vector<melon::raft::Closure *> dones;
+        mizar::WriteBatch batch;
+        size_t entry_count = 0;
+        for (; iter.valid(); iter.next()) {
+            ++entry_count;
+            melon::raft::Closure *done = iter.done();
+            melon::ClosureGuard done_guard(done);
+            if (done) {
+                ((DiscoveryServerClosure *) done)->raft_time_cost = ((DiscoveryServerClosure *) done)->time_cost.get_time();
+            }
+            mutil::IOBufAsZeroCopyInputStream wrapper(iter.data());
+            sirius::proto::DiscoveryManagerRequest request;
+            if (!request.ParseFromZeroCopyStream(&wrapper)) {
+                LOG(ERROR) << "parse from protobuf fail when on_apply, shard:" << _shard;
+                IF_DONE_SET_RESPONSE(done, sirius::proto::PARSE_FROM_PB_FAIL, "parse from protobuf fail");
+                if (done) {
+                    dones.push_back(done_guard.release());
+                }
+                continue;
+            }
+            if (done && ((DiscoveryServerClosure *) done)->response) {
+                ((DiscoveryServerClosure *) done)->response->set_op_type(request.op_type());
+            }
+            switch (request.op_type()) {
+                case sirius::proto::OP_CREATE_SERVLET: {
+                    create_servlet(request, &batch, done);
+                    break;
+                }
+                case sirius::proto::OP_DROP_SERVLET: {
+                    drop_servlet(request, &batch, done);
+                    break;
+                }
+                case sirius::proto::OP_MODIFY_SERVLET: {
+                    modify_servlet(request, &batch, done);
+                    break;
+                }
+                default: {
+                    LOG(ERROR) << "unknown request type, type:" << request.op_type() << ", shard:" << _shard;
+                    IF_DONE_SET_RESPONSE(done, sirius::proto::UNKNOWN_REQ_TYPE, "unknown request type");
+                }
+            }
+            if (done) {
+                dones.push_back(done_guard.release());
+            }
+        }
+        if (batch.Count() > 0) {
+            mizar::WriteOptions write_option;
+            write_option.disableWAL = true;
+            auto status = RocksStorage::get_instance()->write(write_option, &batch);
+            if (!status.ok()) {
+                // servlet memory already holds the writes, stop the shard so it replays the
+                // entries from the last durable index on restart. raft runs the closures of the
+                // rolled back entries with an error, they answer NOT_LEADER.
+                LOG(ERROR) << "write apply batch fail, stop applying, shard:" << _shard
+                           << ", entries:" << entry_count << ", err_msg:" << status.ToString();
+                set_have_data(false);
+                iter.set_error_and_rollback(entry_count);
+                return;
+            }
+        }
+        ClosurePipeline::get_instance()->push(dones);
+        ClosurePipeline::get_instance()->add_apply_time(apply_cost.get_time());
+    }
+
+    void ServletShardStateMachine::create_servlet(const sirius::proto::DiscoveryManagerRequest &request,
+                                                  mizar::WriteBatch *batch, melon::raft::Closure *done) {
+        auto *manager = ServletManager::get_instance();
+        const auto &request_info = request.servlet_info();
+        if (!request_info.has_app_id() || !request_info.has_zone_id()) {
+            IF_DONE_SET_RESPONSE(done, sirius::proto::INPUT_PARAM_ERROR, "app or zone not resolved");
+            return;
+        }
+        // the zone was resolved when proposing, a drop applied since then would orphan the servlet
+        sirius::proto::ZoneInfo zone_info;
+        if (ZoneManager::get_instance()->get_zone_info(request_info.zone_id(), zone_info) != 0
+            || zone_info.app_id() != request_info.app_id()) {
+            LOG(WARNING) << "zone " << request_info.zone_id() << " dropped before servlet create applied, shard:"
+                         << _shard;
+            IF_DONE_SET_RESPONSE(done, sirius::proto::SERVLET_NO_ZONE, "zone not exist");
+            return;
+        }
+        std::string servlet_name = ServletManager::make_servlet_key(request_info.app_name(), request_info.zone(),
+                                                                    request_info.servlet_name());
+        if (manager->get_servlet_id(servlet_name) != 0) {
+            LOG(WARNING) << "request servlet: " << servlet_name << " already exist";
+            IF_DONE_SET_RESPONSE(done, sirius::proto::SERVLET_EXISTS, "servlet already exist");
+            return;
+        }
+        sirius::proto::ServletInfo servlet_info = request_info;
+        int64_t local_id = _max_local_id + 1;
+        int64_t servlet_id = ServletManager::make_shard_servlet_id(_shard, local_id);
+        servlet_info.set_servlet_id(servlet_id);
+        auto t = turbo::Time::current_seconds();
+        servlet_info.set_ctime(t);
+        servlet_info.set_mtime(t);
+        std::string servlet_value;
+        if (!servlet_info.SerializeToString(&servlet_value)) {
+            LOG(WARNING) << "request serializeToArray fail, request:" << request.ShortDebugString();
+            IF_DONE_SET_RESPONSE(done, sirius::proto::PARSE_TO_PB_FAIL, "serializeToArray fail");
+            return;
+        }
+        std::string max_id_value;
+        max_id_value.append((char *) &local_id, sizeof(int64_t));
+        batch->Put(_handle, servlet_key(servlet_id), servlet_value);
+        batch->Put(_handle, max_id_key(), max_id_value);
+
+        manager->set_servlet_info(servlet_info);
+        _max_local_id = local_id;
+        ZoneManager::get_instance()->add_servlet_id(servlet_info.zone_id(), servlet_id);
+        IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
+        DLOG(INFO) << "create servlet success, shard:" << _shard << ", request:" << request.ShortDebugString();
+    }
+
+    void ServletShardStateMachine::drop_servlet(const sirius::proto::DiscoveryManagerRequest &request,
+                                                mizar::WriteBatch *batch, melon::raft::Closure *done) {
+        auto *manager = ServletManager::get_instance();
+        const auto &request_info = request.servlet_info();
+        std::string servlet_name = ServletManager::make_servlet_key(request_info.app_name(), request_info.zone(),
+                                                                    request_info.servlet_name());
+        int64_t servlet_id = manager->get_servlet_id(servlet_name);
+        sirius::proto::ServletInfo servlet_info;
+        if (servlet_id == 0 || manager->get_servlet_info(servlet_id, servlet_info) != 0) {
+            LOG(WARNING) << "request servlet: " << servlet_name << " not exist";
+            IF_DONE_SET_RESPONSE(done, sirius::proto::INPUT_PARAM_ERROR, "servlet not exist");
+            return;
+        }
+        if (ServletManager::shard_of_servlet_id(servlet_id) != _shard) {
+            IF_DONE_SET_RESPONSE(done, sirius::proto::INPUT_PARAM_ERROR, "servlet owned by another raft group");
+            return;
+        }
+        batch->Delete(_handle, servlet_key(servlet_id));
+        manager->erase_servlet_info(servlet_name);
+        ZoneManager::get_instance()->delete_servlet_id(servlet_info.zone_id(), servlet_id);
+        LeaseManager::get_instance()->erase(servlet_id);
+        IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
+        DLOG(INFO) << "drop servlet success, shard:" << _shard << ", request:" << request.ShortDebugString();
+    }
+
+    void ServletShardStateMachine::modify_servlet(const sirius::proto::DiscoveryManagerRequest &request,
+                                                  mizar::WriteBatch *batch, melon::raft::Closure *done) {
+        auto *manager = ServletManager::get_instance();
+        const auto &request_info = request.servlet_info();
+        std::string servlet_name = ServletManager::make_servlet_key(request_info.app_name(), request_info.zone(),
+                                                                    request_info.servlet_name());
+        int64_t servlet_id = manager->get_servlet_id(servlet_name);
+        sirius::proto::ServletInfo servlet_info;
+        if (servlet_id == 0 || manager->get_servlet_info(servlet_id, servlet_info) != 0) {
+            LOG(WARNING) << "request servlet: " << servlet_name << " not exist";
+            IF_DONE_SET_RESPONSE(done, sirius::proto::INPUT_PARAM_ERROR, "servlet not exist");
+            return;
+        }
+        if (ServletManager::shard_of_servlet_id(servlet_id) != _shard) {
+            IF_DONE_SET_RESPONSE(done, sirius::proto::INPUT_PARAM_ERROR, "servlet owned by another raft group");
+            return;
+        }
+        if (request_info.has_deleted()) {
+            servlet_info.set_deleted(request_info.deleted());
+        }
+        if (request_info.has_status()) {
+            servlet_info.set_status(request_info.status());
+        }
+        if (request_info.has_color()) {
+            servlet_info.set_color(request_info.color());
+        }
+        servlet_info.set_env(request_info.env());
+        servlet_info.set_address(request_info.address());
+        servlet_info.set_mtime(turbo::Time::current_seconds());
+        std::string servlet_value;
+        if (!servlet_info.SerializeToString(&servlet_value)) {
+            LOG(ERROR) << "request serializeToArray fail, request:" << request.ShortDebugString();
+            IF_DONE_SET_RESPONSE(done, sirius::proto::PARSE_TO_PB_FAIL, "serializeToArray fail");
+            return;
+        }
+        batch->Put(_handle, servlet_key(servlet_id), servlet_value);
+        manager->set_servlet_info(servlet_info);
+        IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
+        DLOG(INFO) << "modify servlet success, shard:" << _shard << ", request:" << servlet_info.ShortDebugString();
+    }
+
+    void ServletShardStateMachine::on_snapshot_save(melon::raft::SnapshotWriter *writer, melon::raft::Closure *done) {
+        LOG(WARNING) << "start on snapshot save, shard:" << _shard << ", max_local_id:" << _max_local_id;
+        mizar::ReadOptions read_options;
+        read_options.prefix_same_as_start = false;
+        read_options.total_order_seek = true;
+        auto iter = RocksStorage::get_instance()->new_iterator(read_options, _handle);
+        iter->Seek(_key_start);
+        Fiber bth(&FIBER_ATTR_SMALL);
+        std::function<void()> save_snapshot_function = [this, done, iter, writer]() {
+            save_snapshot(done, iter, writer);
+        };
+        bth.run(save_snapshot_function);
+    }
+
+    void ServletShardStateMachine::save_snapshot(melon::raft::Closure *done,
+                                                 mizar::Iterator *iter,
+                                                 melon::raft::SnapshotWriter *writer) {
+        melon::ClosureGuard done_guard(done);
+        std::unique_ptr<mizar::Iterator> iter_lock(iter);
+        // an sst can not be empty, a shard without servlets snapshots no file
+        if (!iter->Valid() || iter->key().compare(_key_end) >= 0) {
+            return;
+        }
+        std::string sst_file_path = writer->get_path() + SNAPSHOT_SHARD_FILE_WITH_SLASH;
+        mizar::Options option = RocksStorage::get_instance()->get_options(_handle);
+        SstFileWriter sst_writer(option);
+        auto s = sst_writer.open(sst_file_path);
+        if (!s.ok()) {
+            LOG(WARNING) << "Error while opening file " << sst_file_path << ", Error " << s.ToString();
+            done->status().set_error(EINVAL, "Fail to open SstFileWriter");
+            return;
+        }
+        for (; iter->Valid() && iter->key().compare(_key_end) < 0; iter->Next()) {
+            auto res = sst_writer.put(iter->key(), iter->value());
+            if (!res.ok()) {
+                LOG(WARNING) << "Error while adding Key: " << iter->key().ToString() << ", Error: " << res.ToString();
+                done->status().set_error(EINVAL, "Fail to write SstFileWriter");
+                return;
+            }
+        }
+        s = sst_writer.finish();
+        if (!s.ok()) {
+            LOG(WARNING) << "Error while finishing file " << sst_file_path << ", Error " << s.ToString();
+            done->status().set_error(EINVAL, "Fail to finish SstFileWriter");
+            return;
+        }
+        if (writer->add_file(SNAPSHOT_SHARD_FILE_WITH_SLASH) != 0) {
+            done->status().set_error(EINVAL, "Fail to add file");
+            LOG(ERROR) << "Error while adding file to writer";
+            return;
+        }
+    }
+
+    int ServletShardStateMachine::on_snapshot_load(melon::raft::SnapshotReader *reader) {
+        LOG(WARNING) << "start on snapshot load, shard:" << _shard;
+        mizar::WriteOptions options;
+        auto status = RocksStorage::get_instance()->remove_range(options, _handle, _key_start, _key_end, false);
+        if (!status.ok()) {
+            LOG(ERROR) << "remove range error when on snapshot load, shard:" << _shard << ", msg=" << status.ToString();
+            return -1;
+        }
+        ServletManager::get_instance()->clear_shard(_shard);
+        _max_local_id = 0;
+        std::vector<std::string> files;
+        reader->list_files(&files);
+        for (auto &file: files) {
+            if (file != SNAPSHOT_SHARD_FILE_WITH_SLASH) {
+                continue;
+            }
+            std::string snapshot_path = reader->get_path() + SNAPSHOT_SHARD_FILE_WITH_SLASH;
+            mizar::IngestExternalFileOptions ifo;
+            auto res = RocksStorage::get_instance()->ingest_external_file(_handle, {snapshot_path}, ifo);
+            if (!res.ok()) {
+                LOG(ERROR) << "Error while ingest file " << snapshot_path << ", Error " << res.ToString();
+                return -1;
+            }
+        }
+        if (load_shard() != 0) {
+            return -1;
+        }
+        set_have_data(true);
+        return 0;
+    }
+
+    int ServletShardStateMachine::load_shard() {
+        std::string servlet_prefix = _key_start + DiscoveryConstants::SERVLET_SCHEMA_IDENTIFY;
+        std::string max_key = max_id_key();
+        mizar::ReadOptions read_options;
+        read_options.prefix_same_as_start = false;
+        read_options.total_order_seek = true;
+        std::unique_ptr<mizar::Iterator> iter(RocksStorage::get_instance()->new_iterator(read_options, _handle));
+        for (iter->Seek(_key_start); iter->Valid() && iter->key().compare(_key_end) < 0; iter->Next()) {
+            if (iter->key() == max_key) {
+                _max_local_id = *(int64_t *) (iter->value().data());
+                continue;
+            }
+            if (!iter->key().starts_with(servlet_prefix)) {
+                LOG(ERROR) << "unknown key when load servlet shard:" << _shard;
+                continue;
+            }
+            sirius::proto::ServletInfo servlet_info;
+            if (!servlet_info.ParseFromArray(iter->value().data(), iter->value().size())) {
+                LOG(ERROR) << "parse servlet fail when load servlet shard:" << _shard;
+                return -1;
+            }
+            ServletManager::get_instance()->set_servlet_info(servlet_info);
+            ZoneManager::get_instance()->add_servlet_id(servlet_info.zone_id(), servlet_info.servlet_id());
+        }
+        LOG(WARNING) << "load servlet shard:" << _shard << " done, max_local_id:" << _max_local_id;
+        return 0;
+    }
+
+    std::string ServletShardStateMachine::servlet_key(int64_t servlet_id) const {
+        std::string key = _key_start + DiscoveryConstants::SERVLET_SCHEMA_IDENTIFY;
+        key.append((char *) &servlet_id, sizeof(int64_t));
+        return key;
+    }
+
+    std::string ServletShardStateMachine::max_id_key() const {
+        return _key_start + DiscoveryConstants::MAX_ID_SCHEMA_IDENTIFY;
+    }
+
+}  // namespace sirius::discovery
@@ -0,0 +1,106 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <mizar/db.h>
+#include <sirius/discovery/base_state_machine.h>
+#include <sirius/discovery/sirius_constants.h>
+
+namespace sirius::discovery {
+
+    ///
+    /// \brief one raft group of the servlet registry when sirius_servlet_shards is set.
+    ///        apps are hashed to shards by name, a shard applies the servlet writes of its
+    ///        apps, keeps them in its own key range and snapshots only that range.
+    ///        servlet memory is shared with the discovery raft group in ServletManager,
+    ///        so queries and naming see all servlets.
+    class ServletShardStateMachine : public BaseStateMachine {
+    public:
+        ServletShardStateMachine(int shard, const melon::raft::PeerId &peerId);
+
+        ~ServletShardStateMachine() override = default;
+
+        ///
+        /// \brief app and zone of a new servlet are resolved here on the leader and carried
+        ///        in the entry. applying checks the zone id is still known, a zone dropped
+        ///        in between is refused with SERVLET_NO_ZONE instead of leaving an orphan.
+        ///        the discovery raft group of a follower may lag, so a create racing a zone
+        ///        drop within that lag can be applied on the follower and refused on the
+        ///        leader, drop and create of the same zone should not be issued together.
+        void process(google::protobuf::RpcController *controller,
+                     const sirius::proto::DiscoveryManagerRequest *request,
+                     sirius::proto::DiscoveryManagerResponse *response,
+                     google::protobuf::Closure *done) override;
+
+        void on_apply(melon::raft::Iterator &iter) override;
+
+        void on_snapshot_save(melon::raft::SnapshotWriter *writer, melon::raft::Closure *done) override;
+
+        int on_snapshot_load(melon::raft::SnapshotReader *reader) override;
+
+        int shard() const {
+            return _shard;
+        }
+
+        ///
+        /// \brief the shard of an app, stable across nodes and restarts.
+        static int shard_of(const std::string &app_name, int shard_count);
+
+        static bool is_servlet_op(sirius::proto::OpType op_type) {
+            return op_type == sirius::proto::OP_CREATE_SERVLET
+                   || op_type == sirius::proto::OP_DROP_SERVLET
+                   || op_type == sirius::proto::OP_MODIFY_SERVLET;
+        }
+
+        static const std::string SNAPSHOT_SHARD_FILE;
+        static const std::string SNAPSHOT_SHARD_FILE_WITH_SLASH;
+
+    private:
+        void create_servlet(const sirius::proto::DiscoveryManagerRequest &request,
+                            mizar::WriteBatch *batch, melon::raft::Closure *done);
+
+        void drop_servlet(const sirius::proto::DiscoveryManagerRequest &request,
+                          mizar::WriteBatch *batch, melon::raft::Closure *done);
+
+        void modify_servlet(const sirius::proto::DiscoveryManagerRequest &request,
+                            mizar::WriteBatch *batch, melon::raft::Closure *done);
+
+        ///
+        /// \brief load the servlets of this shard from rocksdb into memory.
+        int load_shard();
+
+        void save_snapshot(melon::raft::Closure *done,
+                           mizar::Iterator *iter,
+                           melon::raft::SnapshotWriter *writer);
+
+        std::string servlet_key(int64_t servlet_id) const;
+
+        std::string max_id_key() const;
+
+        int _shard;
+        // [_key_start, _key_end) is the key range of this shard
+        std::string _key_start;
+        std::string _key_end;
+        // only touched by the apply and snapshot load of this shard
+        int64_t _max_local_id{0};
+        mizar::ColumnFamilyHandle *_handle{nullptr};
+    };
+
+}  // namespace sirius::discovery
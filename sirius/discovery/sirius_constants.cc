@@ -18,6 +18,9 @@
 
 
 #include <sirius/discovery/sirius_constants.h>
+#include <algorithm>
+#include <sirius/flags/sirius.h>
+#include <sirius/base/log.h>
 
 namespace sirius::discovery {
 
@@ -40,6 +43,7 @@ namespace sirius::discovery {
 
 
     const std::string DiscoveryConstants::MAX_IDENTIFY(1, 0xFF);
+    const std::string DiscoveryConstants::SERVLET_SHARD_IDENTIFY(1, 0xFF);
 
     /// for schema
     const std::string DiscoveryConstants::MAX_CONFIG_ID_KEY = "max_config_id";
@@ -51,4 +55,35 @@ namespace sirius::discovery {
     const int DiscoveryConstants::DiscoveryMachineRegion = 0;
     const int DiscoveryConstants::AutoIDMachineRegion = 1;
     const int DiscoveryConstants::TsoMachineRegion = 2;
+    const int DiscoveryConstants::ServletShardMachineRegionBase = 3;
+
+    namespace tso {
+
+        static TsoOptions g_tso_options;
+
+        const TsoOptions &options() {
+            return g_tso_options;
+        }
+
+        void init_options() {
+            TsoOptions opt;
+            opt.logical_bits = FLAGS_sirius_tso_logical_bits;
+            if (opt.logical_bits < min_logical_bits || opt.logical_bits > pack_logical_bits) {
+                LOG(WARNING) << "invalid tso logical bits:" << opt.logical_bits << ", use default:"
+                             << default_logical_bits;
+                opt.logical_bits = default_logical_bits;
+            }
+            opt.max_logical = 1LL << opt.logical_bits;
+            opt.update_timestamp_interval_ms = std::max<int64_t>(FLAGS_sirius_tso_update_interval_ms, 1);
+            // the save window must cover several update ticks, or every tick would need a new window
+            opt.save_interval_ms = std::max<int64_t>(FLAGS_sirius_tso_save_interval_ms,
+                                                     opt.update_timestamp_interval_ms * 2);
+            opt.adaptive_pacing = FLAGS_sirius_tso_adaptive_pacing;
+            g_tso_options = opt;
+            LOG(INFO) << "tso options logical_bits:" << opt.logical_bits << " update_interval_ms:"
+                      << opt.update_timestamp_interval_ms << " save_interval_ms:" << opt.save_interval_ms
+                      << " adaptive_pacing:" << opt.adaptive_pacing;
+        }
+
+    }  // namespace tso
 }  // namespace sirius::discovery
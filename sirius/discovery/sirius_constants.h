@@ -21,6 +21,8 @@
 #define EA_DISCOVERY_DISCOVERY_CONSTANTS_H_
 
 #include <string>
+#include <cstdint>
+#include <ctime>
 
 namespace sirius::discovery {
 
@@ -43,6 +45,9 @@ namespace sirius::discovery {
         static const std::string CONFIG_CONTENT_IDENTIFY;
 
         static const std::string MAX_IDENTIFY;
+        /// servlet shard keys sort at or above MAX_IDENTIFY, out of the range of
+        /// the discovery state machine snapshot
+        static const std::string SERVLET_SHARD_IDENTIFY;
 
         /// for schema
         static const std::string MAX_CONFIG_ID_KEY;
@@ -54,15 +59,50 @@ namespace sirius::discovery {
         static const int DiscoveryMachineRegion;
         static const int AutoIDMachineRegion;
         static const int TsoMachineRegion;
+        /// servlet shard i is region ServletShardMachineRegionBase + i
+        static const int ServletShardMachineRegionBase;
     };
 
     namespace tso {
-        constexpr int64_t update_timestamp_interval_ms = 50LL; // 50ms
         constexpr int64_t update_timestamp_guard_ms = 1LL; // 1ms
-        constexpr int64_t save_interval_ms = 3000LL;  // 3000ms
         constexpr int64_t base_timestamp_ms = 1577808000000LL; // 2020-01-01 12:00:00
-        constexpr int logical_bits = 18;
-        constexpr int64_t max_logical = 1 << logical_bits;
+        constexpr int default_logical_bits = 18;
+        constexpr int min_logical_bits = 10;
+        // the in memory word always reserves this many bits for logical, so the
+        // packing does not depend on the configured logical bits. 42 bits of
+        // physical milliseconds last until 2159.
+        constexpr int pack_logical_bits = 22;
+
+        /// \brief tso options, loaded once from flags by init_options when
+        ///        the tso state machine starts, not changed afterwards.
+        struct TsoOptions {
+            int logical_bits{default_logical_bits};
+            int64_t max_logical{1LL << default_logical_bits};
+            int64_t save_interval_ms{3000};
+            int64_t update_timestamp_interval_ms{50};
+            bool adaptive_pacing{false};
+        };
+
+        const TsoOptions &options();
+
+        /// \brief load options from flags, invalid values are clamped.
+        void init_options();
+
+        inline int logical_bits() {
+            return options().logical_bits;
+        }
+
+        inline int64_t max_logical() {
+            return options().max_logical;
+        }
+
+        inline int64_t save_interval_ms() {
+            return options().save_interval_ms;
+        }
+
+        inline int64_t update_timestamp_interval_ms() {
+            return options().update_timestamp_interval_ms;
+        }
 
         inline int64_t clock_realtime_ms() {
             struct timespec tp;
@@ -71,7 +111,21 @@ namespace sirius::discovery {
         }
 
         inline uint32_t get_timestamp_internal(int64_t offset) {
-            return ((offset >> 18) + base_timestamp_ms) / 1000;
+            return ((offset >> logical_bits()) + base_timestamp_ms) / 1000;
+        }
+
+        /// \brief pack physical and logical into one word, physical in the
+        ///        high bits, so packed values order the same as (physical, logical).
+        inline uint64_t pack_timestamp(int64_t physical, int64_t logical) {
+            return (static_cast<uint64_t>(physical) << pack_logical_bits) | static_cast<uint64_t>(logical);
+        }
+
+        inline int64_t extract_physical(uint64_t packed) {
+            return static_cast<int64_t>(packed >> pack_logical_bits);
+        }
+
+        inline int64_t extract_logical(uint64_t packed) {
+            return static_cast<int64_t>(packed & ((1ULL << pack_logical_bits) - 1));
         }
 
     } // namespace tso
@@ -41,6 +41,11 @@ namespace sirius::discovery {
     }
 
     int DiscoveryRocksdb::put_discovery_info(const std::string &key, const std::string &value) {
+        mark_dirty(key);
+        if (_apply_batch != nullptr) {
+            _apply_batch->Put(_handle, mizar::Slice(key), mizar::Slice(value));
+            return 0;
+        }
         mizar::WriteOptions write_option;
         write_option.disableWAL = true;
         auto status = _rocksdb->put(write_option, _handle, mizar::Slice(key), mizar::Slice(value));
@@ -57,18 +62,16 @@ namespace sirius::discovery {
             LOG(WARNING) << "input keys'size is not equal to values' size";
             return -1;
         }
-        mizar::WriteOptions write_option;
-        write_option.disableWAL = true;
-        mizar::WriteBatch batch;
+        mizar::WriteBatch local_batch;
+        mizar::WriteBatch *batch = _apply_batch != nullptr ? _apply_batch.get() : &local_batch;
         for (size_t i = 0; i < keys.size(); ++i) {
-            batch.Put(_handle, keys[i], values[i]);
+            mark_dirty(keys[i]);
+            batch->Put(_handle, keys[i], values[i]);
         }
-        auto status = _rocksdb->write(write_option, &batch);
-        if (!status.ok()) {
-            LOG(WARNING) << "put batch to rocksdb fail, err msg: " << status.ToString();
-            return -1;
+        if (batch != &local_batch) {
+            return 0;
         }
-        return 0;
+        return write_batch(batch, "put");
     }
 
     int DiscoveryRocksdb::get_discovery_info(const std::string &key, std::string *value) {
@@ -81,18 +84,16 @@ namespace sirius::discovery {
     }
 
     int DiscoveryRocksdb::remove_discovery_info(const std::vector<std::string> &keys) {
-        mizar::WriteOptions write_option;
-        write_option.disableWAL = true;
-        mizar::WriteBatch batch;
+        mizar::WriteBatch local_batch;
+        mizar::WriteBatch *batch = _apply_batch != nullptr ? _apply_batch.get() : &local_batch;
         for (auto &key: keys) {
-            batch.Delete(_handle, key);
+            mark_dirty(key);
+            batch->Delete(_handle, key);
         }
-        auto status = _rocksdb->write(write_option, &batch);
-        if (!status.ok()) {
-            LOG(WARNING) << "delete batch to rocksdb fail,  " << status.ToString();
-            return -1;
+        if (batch != &local_batch) {
+            return 0;
         }
-        return 0;
+        return write_batch(batch, "delete");
     }
 
     int DiscoveryRocksdb::write_discovery_info(const std::vector<std::string> &put_keys,
@@ -102,18 +103,90 @@ namespace sirius::discovery {
             LOG(WARNING) << "input keys'size is not equal to values' size";
             return -1;
         }
-        mizar::WriteOptions write_option;
-        write_option.disableWAL = true;
-        mizar::WriteBatch batch;
+        mizar::WriteBatch local_batch;
+        mizar::WriteBatch *batch = _apply_batch != nullptr ? _apply_batch.get() : &local_batch;
         for (size_t i = 0; i < put_keys.size(); ++i) {
-            batch.Put(_handle, put_keys[i], put_values[i]);
+            mark_dirty(put_keys[i]);
+            batch->Put(_handle, put_keys[i], put_values[i]);
         }
         for (auto &delete_key: delete_keys) {
-            batch.Delete(_handle, delete_key);
+            mark_dirty(delete_key);
+            batch->Delete(_handle, delete_key);
+        }
+        if (batch != &local_batch) {
+            return 0;
+        }
+        return write_batch(batch, "write");
+    }
+
+    void DiscoveryRocksdb::begin_apply_batch() {
+        _apply_batch = std::make_unique<mizar::WriteBatch>();
+    }
+
+    int DiscoveryRocksdb::commit_apply_batch() {
+        std::unique_ptr<mizar::WriteBatch> batch;
+        batch.swap(_apply_batch);
+        if (batch == nullptr || batch->Count() == 0) {
+            return 0;
+        }
+        return write_batch(batch.get(), "apply");
+    }
+
+    void DiscoveryRocksdb::set_apply_save_point() {
+        if (_apply_batch != nullptr) {
+            _apply_batch->SetSavePoint();
+        }
+    }
+
+    int DiscoveryRocksdb::rollback_apply_save_point() {
+        if (_apply_batch == nullptr) {
+            return -1;
+        }
+        auto status = _apply_batch->RollbackToSavePoint();
+        if (!status.ok()) {
+            LOG(WARNING) << "rollback apply batch fail, err msg: " << status.ToString();
+            return -1;
         }
-        auto status = _rocksdb->write(write_option, &batch);
+        return 0;
+    }
+
+    void DiscoveryRocksdb::pop_apply_save_point() {
+        if (_apply_batch != nullptr) {
+            _apply_batch->PopSavePoint();
+        }
+    }
+
+    void DiscoveryRocksdb::take_dirty_keys(std::set<std::string> *keys) {
+        MELON_SCOPED_LOCK(_dirty_mutex);
+        keys->clear();
+        keys->swap(_dirty_keys);
+    }
+
+    void DiscoveryRocksdb::restore_dirty_keys(const std::set<std::string> &keys) {
+        MELON_SCOPED_LOCK(_dirty_mutex);
+        _dirty_keys.insert(keys.begin(), keys.end());
+    }
+
+    void DiscoveryRocksdb::clear_dirty_keys() {
+        MELON_SCOPED_LOCK(_dirty_mutex);
+        _dirty_keys.clear();
+    }
+
+    void DiscoveryRocksdb::mark_dirty(const std::string &key) {
+        if (FLAGS_sirius_snapshot_max_deltas <= 0) {
+            return;
+        }
+        // a rolled back write stays marked, a delta then just rewrites the current value
+        MELON_SCOPED_LOCK(_dirty_mutex);
+        _dirty_keys.insert(key);
+    }
+
+    int DiscoveryRocksdb::write_batch(mizar::WriteBatch *batch, const char *op) {
+        mizar::WriteOptions write_option;
+        write_option.disableWAL = true;
+        auto status = _rocksdb->write(write_option, batch);
         if (!status.ok()) {
-            LOG(WARNING) << "write batch to rocksdb fail,  " << status.ToString();
+            LOG(WARNING) << op << " batch to rocksdb fail, err msg: " << status.ToString();
             return -1;
         }
         return 0;
@@ -20,6 +20,9 @@
 #pragma once
 
 #include <sirius/storage/rocks_storage.h>
+#include <memory>
+#include <set>
+#include <sirius/base/fiber.h>
 
 namespace sirius::discovery {
     class DiscoveryRocksdb {
@@ -46,11 +49,49 @@ namespace sirius::discovery {
                             const std::vector<std::string> &put_values,
                             const std::vector<std::string> &delete_keys);
 
+        /// \brief collect the writes of the following entries of one raft apply run
+        ///        into one write batch instead of writing each of them. only the raft
+        ///        apply thread writes discovery info, so the batch is not locked.
+        void begin_apply_batch();
+
+        /// \brief write the batch collected since begin_apply_batch in one go.
+        /// \return 0 on success, -1 if the batch could not be written
+        int commit_apply_batch();
+
+        /// \brief mark the current end of the apply batch.
+        void set_apply_save_point();
+
+        /// \brief drop the writes collected since the last save point.
+        /// \return 0 on success, -1 if there is no save point
+        int rollback_apply_save_point();
+
+        /// \brief forget the last save point and keep the writes after it.
+        void pop_apply_save_point();
+
+        /// \brief move out the keys written or deleted since the previous call, a delta
+        ///        snapshot writes only these. not tracked when sirius_snapshot_max_deltas is 0.
+        void take_dirty_keys(std::set<std::string> *keys);
+
+        /// \brief give back keys taken by a snapshot that failed.
+        void restore_dirty_keys(const std::set<std::string> &keys);
+
+        void clear_dirty_keys();
+
     private:
-        DiscoveryRocksdb() {}
+        DiscoveryRocksdb() {
+            fiber_mutex_init(&_dirty_mutex, nullptr);
+        }
+
+        void mark_dirty(const std::string &key);
+
+        int write_batch(mizar::WriteBatch *batch, const char *op);
 
         RocksStorage *_rocksdb = nullptr;
         mizar::ColumnFamilyHandle *_handle = nullptr;
+        // not null between begin_apply_batch and commit_apply_batch
+        std::unique_ptr<mizar::WriteBatch> _apply_batch;
+        fiber_mutex_t _dirty_mutex;  // protect _dirty_keys
+        std::set<std::string> _dirty_keys;
     }; //class
 
 }  // namespace sirius::discovery
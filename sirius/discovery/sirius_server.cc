@@ -30,6 +30,16 @@
 #include <sirius/discovery/query_zone_manager.h>
 #include <sirius/discovery/query_servlet_manager.h>
 #include <sirius/discovery/sirius_db.h>
+#include <sirius/discovery/servlet_shard_state_machine.h>
+#include <sirius/discovery/lease_manager.h>
+#include <sirius/discovery/naming_index.h>
+#include <sirius/discovery/naming_watcher.h>
+#include <sirius/discovery/servlet_manager.h>
+#include <sirius/discovery/app_manager.h>
+#include <melon/rpc/channel.h>
+#include <algorithm>
+#include <limits>
+#include <map>
 
 namespace sirius::discovery {
 
@@ -46,6 +56,9 @@ namespace sirius::discovery {
         //addr.ip = mutil::my_ip();
         //addr.port = FLAGS_discovery_port;
         melon::raft::PeerId peer_id(addr, 0);
+        // before any raft group applies servlets or leases
+        NamingIndex::get_instance()->init();
+        NamingWatcher::get_instance()->init();
         _discovery_state_machine = new(std::nothrow)DiscoveryStateMachine(peer_id);
         if (_discovery_state_machine == nullptr) {
             LOG(ERROR) << "new discovery_state_machine fail";
@@ -83,6 +96,21 @@ namespace sirius::discovery {
         }
         LOG(INFO) << " tso state machine init success";
 
+        for (int i = 0; i < FLAGS_sirius_servlet_shards; ++i) {
+            auto *shard = new(std::nothrow)ServletShardStateMachine(i, peer_id);
+            if (shard == nullptr) {
+                LOG(ERROR) << "new servlet shard state machine fail, shard:" << i;
+                return -1;
+            }
+            _servlet_shards.push_back(shard);
+            ret = shard->init(peers);
+            if (ret != 0) {
+                LOG(ERROR) << "servlet shard state machine init fail, shard:" << i;
+                return -1;
+            }
+        }
+        LOG(INFO) << "servlet shard state machines init success, shards:" << _servlet_shards.size();
+
         SchemaManager::get_instance()->set_discovery_state_machine(_discovery_state_machine);
         ConfigManager::get_instance()->set_discovery_state_machine(_discovery_state_machine);
         PrivilegeManager::get_instance()->set_discovery_state_machine(_discovery_state_machine);
@@ -123,6 +151,22 @@ namespace sirius::discovery {
             log_id = cntl->log_id();
         }
         RETURN_IF_NOT_INIT(_init_success, response, log_id);
+        if (!_servlet_shards.empty() && ServletShardStateMachine::is_servlet_op(request->op_type())) {
+            if (!request->has_servlet_info()) {
+                ERROR_SET_RESPONSE(response, sirius::proto::INPUT_PARAM_ERROR,
+                                   "no servlet info", request->op_type(), log_id);
+                return;
+            }
+            auto *shard = _servlet_shards[ServletShardStateMachine::shard_of(request->servlet_info().app_name(),
+                                                                             _servlet_shards.size())];
+            // a forwarded write is not forwarded again, the client retries from the start
+            if (!shard->is_leader() && !request->forwarded()) {
+                forward_to_shard_leader(shard, request, response, log_id);
+                return;
+            }
+            shard->process(controller, request, response, done_guard.release());
+            return;
+        }
         if (request->op_type() == sirius::proto::OP_CREATE_USER
             || request->op_type() == sirius::proto::OP_DROP_USER
             || request->op_type() == sirius::proto::OP_ADD_PRIVILEGE
@@ -158,6 +202,24 @@ namespace sirius::discovery {
                                                                done_guard.release());
             return;
         }
+        if (request->op_type() == sirius::proto::OP_BATCH) {
+            std::string errmsg;
+            if (!DiscoveryStateMachine::check_batch_request(*request, &errmsg)) {
+                ERROR_SET_RESPONSE(response, sirius::proto::INPUT_PARAM_ERROR, errmsg, request->op_type(), log_id);
+                return;
+            }
+            _discovery_state_machine->process(controller, request, response, done_guard.release());
+            return;
+        }
+        if (request->op_type() == sirius::proto::OP_BATCH_GEN_ID_FOR_AUTO_INCREMENT) {
+            std::string errmsg;
+            if (!AutoIncrStateMachine::check_gen_id_batch(*request, &errmsg)) {
+                ERROR_SET_RESPONSE(response, sirius::proto::INPUT_PARAM_ERROR, errmsg, request->op_type(), log_id);
+                return;
+            }
+            _auto_incr_state_machine->process(controller, request, response, done_guard.release());
+            return;
+        }
         if (request->op_type() == sirius::proto::OP_GEN_ID_FOR_AUTO_INCREMENT
             || request->op_type() == sirius::proto::OP_UPDATE_FOR_AUTO_INCREMENT
             || request->op_type() == sirius::proto::OP_ADD_ID_FOR_AUTO_INCREMENT
@@ -193,6 +255,23 @@ namespace sirius::discovery {
         TimeCost time_cost;
         response->set_errcode(sirius::proto::SUCCESS);
         response->set_errmsg("success");
+        if (request->op_type() != sirius::proto::QUERY_READ_INDEX) {
+            int64_t read_index = 0;
+            std::string errmsg;
+            if (prepare_read(request->linearizable(),
+                             request->has_max_staleness_ms() ? request->max_staleness_ms() : -1,
+                             &read_index, &errmsg) != 0) {
+                LOG(WARNING) << "consistent query fail, " << errmsg << ", log_id: " << log_id;
+                response->set_errcode(sirius::proto::NOT_LEADER);
+                response->set_errmsg(errmsg);
+                response->set_leader(mutil::endpoint2str(_discovery_state_machine->get_leader()).c_str());
+                return;
+            }
+            if (read_index > 0) {
+                response->set_read_index(read_index);
+            }
+            response->set_applied_index(_discovery_state_machine->applied_index());
+        }
         switch (request->op_type()) {
             case sirius::proto::QUERY_USER_PRIVILEGE: {
                 QueryPrivilegeManager::get_instance()->get_user_info(request, response);
@@ -228,6 +307,21 @@ namespace sirius::discovery {
                 break;
             }
 
+            case sirius::proto::QUERY_READ_INDEX: {
+                // only the leader hands out read indexes, followers redirect
+                int64_t read_index = 0;
+                std::string errmsg;
+                if (!_discovery_state_machine->is_leader()
+                    || _discovery_state_machine->read_index(&read_index, &errmsg) != 0) {
+                    response->set_errcode(sirius::proto::NOT_LEADER);
+                    response->set_errmsg(errmsg.empty() ? "not leader" : errmsg);
+                    response->set_leader(mutil::endpoint2str(_discovery_state_machine->get_leader()).c_str());
+                    break;
+                }
+                response->set_read_index(read_index);
+                break;
+            }
+
             default: {
                 LOG(WARNING) << "invalid op_type, request: " << request->ShortDebugString() << ", log_id: " << log_id;
                 response->set_errcode(sirius::proto::INPUT_PARAM_ERROR);
@@ -253,8 +347,153 @@ namespace sirius::discovery {
             log_id = cntl->log_id();
         }
         RETURN_IF_NOT_INIT(_init_success, response, log_id);
+        int64_t read_index = 0;
+        std::string errmsg;
+        if (prepare_read(request->linearizable(),
+                         request->has_max_staleness_ms() ? request->max_staleness_ms() : -1,
+                         &read_index, &errmsg) != 0) {
+            LOG(WARNING) << "consistent naming fail, " << errmsg << ", log_id: " << log_id;
+            response->set_errcode(sirius::proto::NOT_LEADER);
+            response->set_errmsg(errmsg);
+            response->set_leader(mutil::endpoint2str(_discovery_state_machine->get_leader()).c_str());
+            return;
+        }
+        response->set_applied_index(_discovery_state_machine->applied_index());
         auto * query_app_manager = QueryAppManager::get_instance();
-        query_app_manager->naming(request, response);
+        query_app_manager->naming(request, response, &cntl->response_attachment());
+    }
+
+    void DiscoveryServer::watch(google::protobuf::RpcController *controller,
+                                const sirius::proto::ServletNamingRequest *request,
+                                sirius::proto::ServletNamingResponse *response,
+                                google::protobuf::Closure *done) {
+        melon::ClosureGuard done_guard(done);
+        melon::Controller *cntl =
+                static_cast<melon::Controller *>(controller);
+        uint64_t log_id = 0;
+        if (cntl->has_log_id()) {
+            log_id = cntl->log_id();
+        }
+        RETURN_IF_NOT_INIT(_init_success, response, log_id);
+        int64_t read_index = 0;
+        std::string errmsg;
+        if (prepare_read(request->linearizable(),
+                         request->has_max_staleness_ms() ? request->max_staleness_ms() : -1,
+                         &read_index, &errmsg) != 0) {
+            LOG(WARNING) << "consistent watch fail, " << errmsg << ", log_id: " << log_id;
+            response->set_errcode(sirius::proto::NOT_LEADER);
+            response->set_errmsg(errmsg);
+            response->set_leader(mutil::endpoint2str(_discovery_state_machine->get_leader()).c_str());
+            return;
+        }
+        response->set_applied_index(_discovery_state_machine->applied_index());
+        int64_t app_id = AppManager::get_instance()->get_app_id(request->app_name());
+        // read before answering, so a change after the answer is seen when parking
+        int64_t generation = NamingIndex::get_instance()->app_generation(app_id);
+        int64_t valid_until = std::numeric_limits<int64_t>::max();
+        QueryAppManager::get_instance()->naming(request, response, &cntl->response_attachment(), &valid_until);
+        int64_t timeout_ms = std::min(request->watch_timeout_ms(), FLAGS_sirius_naming_watch_max_timeout_ms);
+        if (response->errcode() != sirius::proto::SUCCESS || !response->not_modified() || timeout_ms <= 0
+            || _shutdown) {
+            return;
+        }
+        NamingWatcher::Watch watch;
+        watch.cntl = cntl;
+        watch.request = request;
+        watch.response = response;
+        watch.app_id = app_id;
+        watch.deadline_us = mutil::gettimeofday_us() + timeout_ms * 1000;
+        watch.recheck_us = NamingWatcher::recheck_time_us(valid_until);
+        watch.done = done_guard.release();
+        NamingWatcher::get_instance()->park(watch, generation);
+    }
+
+    void DiscoveryServer::heartbeat(google::protobuf::RpcController *controller,
+                                    const sirius::proto::ServletHeartbeatRequest *request,
+                                    sirius::proto::ServletHeartbeatResponse *response,
+                                    google::protobuf::Closure *done) {
+        melon::ClosureGuard done_guard(done);
+        melon::Controller *cntl =
+                static_cast<melon::Controller *>(controller);
+        uint64_t log_id = 0;
+        if (cntl->has_log_id()) {
+            log_id = cntl->log_id();
+        }
+        RETURN_IF_NOT_INIT(_init_success, response, log_id);
+        if (FLAGS_sirius_lease_sync_interval_ms <= 0) {
+            response->set_errcode(sirius::proto::INPUT_PARAM_ERROR);
+            response->set_errmsg("lease heartbeat disabled");
+            return;
+        }
+        if (!_discovery_state_machine->is_leader()) {
+            response->set_errcode(sirius::proto::NOT_LEADER);
+            response->set_errmsg("not leader");
+            response->set_leader(mutil::endpoint2str(_discovery_state_machine->get_leader()).c_str());
+            return;
+        }
+        auto *servlet_manager = ServletManager::get_instance();
+        auto *lease_manager = LeaseManager::get_instance();
+        int64_t now_ms = mutil::gettimeofday_ms();
+        // app name --> lease of its servlets, an agent usually renews servlets of one app
+        std::map<std::string, int64_t> app_lease_ms;
+        for (auto &servlet: request->servlets()) {
+            int64_t servlet_id = servlet_manager->get_servlet_id(
+                    ServletManager::make_servlet_key(servlet.app_name(), servlet.zone(), servlet.servlet_name()));
+            if (servlet_id <= 0) {
+                *response->add_unknown_servlets() = servlet;
+                continue;
+            }
+            auto it = app_lease_ms.find(servlet.app_name());
+            if (it == app_lease_ms.end()) {
+                int64_t lease_ms = FLAGS_sirius_lease_ms;
+                sirius::proto::AppInfo app_info;
+                auto *app_manager = AppManager::get_instance();
+                if (app_manager->get_app_info(app_manager->get_app_id(servlet.app_name()), app_info) == 0
+                    && app_info.lease_ms() > 0) {
+                    lease_ms = app_info.lease_ms();
+                }
+                it = app_lease_ms.emplace(servlet.app_name(), lease_ms).first;
+            }
+            lease_manager->renew(servlet_id, now_ms, it->second);
+        }
+        response->set_errcode(sirius::proto::SUCCESS);
+        response->set_errmsg("success");
+        int64_t min_lease_ms = FLAGS_sirius_lease_ms;
+        if (!app_lease_ms.empty()) {
+            min_lease_ms = app_lease_ms.begin()->second;
+            for (auto &app_lease: app_lease_ms) {
+                min_lease_ms = std::min(min_lease_ms, app_lease.second);
+            }
+        }
+        response->set_lease_ms(min_lease_ms);
+    }
+
+    int DiscoveryServer::prepare_read(bool linearizable, int64_t max_staleness_ms,
+                                      int64_t *read_index, std::string *errmsg) {
+        if (linearizable) {
+            return wait_read_index(read_index, errmsg);
+        }
+        if (max_staleness_ms < 0) {
+            return 0;
+        }
+        int64_t staleness_ms = _discovery_state_machine->staleness_ms();
+        if (staleness_ms >= 0 && staleness_ms <= max_staleness_ms) {
+            return 0;
+        }
+        // too stale to answer from memory, catch up with the leader first
+        return wait_read_index(read_index, errmsg);
+    }
+
+    int DiscoveryServer::wait_read_index(int64_t *read_index, std::string *errmsg) {
+        if (_discovery_state_machine->read_index(read_index, errmsg) != 0) {
+            return -1;
+        }
+        if (!_discovery_state_machine->wait_applied(*read_index, FLAGS_sirius_read_index_timeout_ms * 1000LL)) {
+            *errmsg = "wait read index applied timeout, read_index:" + std::to_string(*read_index)
+                      + ", applied_index:" + std::to_string(_discovery_state_machine->applied_index());
+            return -1;
+        }
+        return 0;
     }
 
     void DiscoveryServer::raft_control(google::protobuf::RpcController *controller,
@@ -274,6 +513,11 @@ namespace sirius::discovery {
             _tso_state_machine->raft_control(controller, request, response, done_guard.release());
             return;
         }
+        int64_t shard = request->region_id() - DiscoveryConstants::ServletShardMachineRegionBase;
+        if (shard >= 0 && shard < static_cast<int64_t>(_servlet_shards.size())) {
+            _servlet_shards[shard]->raft_control(controller, request, response, done_guard.release());
+            return;
+        }
         response->set_region_id(request->region_id());
         response->set_errcode(sirius::proto::INPUT_PARAM_ERROR);
         response->set_errmsg("unmatch region id");
@@ -309,15 +553,62 @@ namespace sirius::discovery {
         if (_tso_state_machine != nullptr) {
             _tso_state_machine->shutdown_raft();
         }
+        for (auto *shard: _servlet_shards) {
+            shard->shutdown_raft();
+        }
     }
 
     bool DiscoveryServer::have_data() {
+        for (auto *shard: _servlet_shards) {
+            if (!shard->have_data()) {
+                return false;
+            }
+        }
         return _discovery_state_machine->have_data()
                && _auto_incr_state_machine->have_data()
                && _tso_state_machine->have_data();
     }
 
+    void DiscoveryServer::forward_to_shard_leader(ServletShardStateMachine *shard,
+                                                  const sirius::proto::DiscoveryManagerRequest *request,
+                                                  sirius::proto::DiscoveryManagerResponse *response,
+                                                  uint64_t log_id) {
+        response->set_op_type(request->op_type());
+        mutil::EndPoint leader = shard->get_leader();
+        if (leader.ip == mutil::IP_ANY) {
+            response->set_errcode(sirius::proto::NOT_LEADER);
+            response->set_errmsg("servlet shard has no leader");
+            return;
+        }
+        melon::ChannelOptions channel_opt;
+        channel_opt.timeout_ms = FLAGS_sirius_request_timeout;
+        channel_opt.connect_timeout_ms = FLAGS_sirius_connect_timeout;
+        melon::Channel channel;
+        if (channel.Init(leader, &channel_opt) != 0) {
+            ERROR_SET_RESPONSE(response, sirius::proto::INTERNAL_ERROR, "connect servlet shard leader fail",
+                               request->op_type(), log_id);
+            return;
+        }
+        sirius::proto::DiscoveryManagerRequest forward_request(*request);
+        forward_request.set_forwarded(true);
+        melon::Controller cntl;
+        cntl.set_log_id(log_id);
+        sirius::proto::DiscoveryService_Stub stub(&channel);
+        stub.discovery_manager(&cntl, &forward_request, response, nullptr);
+        if (cntl.Failed()) {
+            ERROR_SET_RESPONSE(response, sirius::proto::INTERNAL_ERROR,
+                               "forward to servlet shard leader fail, " + cntl.ErrorText(),
+                               request->op_type(), log_id);
+            return;
+        }
+        // the shard leader is not the leader clients cache for discovery writes
+        if (response->errcode() == sirius::proto::NOT_LEADER) {
+            response->clear_leader();
+        }
+    }
+
     void DiscoveryServer::close() {
+        NamingWatcher::get_instance()->stop();
         _flush_bth.join();
         LOG(INFO) << "DiscoveryServer flush joined";
     }
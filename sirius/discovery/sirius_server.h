@@ -31,6 +31,8 @@ namespace sirius::discovery {
 
     class TSOStateMachine;
 
+    class ServletShardStateMachine;
+
     class DiscoveryServer : public sirius::proto::DiscoveryService {
     public:
         ~DiscoveryServer() override;
@@ -70,6 +72,18 @@ namespace sirius::discovery {
                                  sirius::proto::TsoResponse *response,
                                  google::protobuf::Closure *done) override;
 
+        /// \brief naming that parks until its answer differs from known_version, any node.
+        void watch(google::protobuf::RpcController *controller,
+                   const sirius::proto::ServletNamingRequest *request,
+                   sirius::proto::ServletNamingResponse *response,
+                   google::protobuf::Closure *done) override;
+
+        /// \brief renew servlet leases on the leader, no raft write.
+        void heartbeat(google::protobuf::RpcController *controller,
+                       const sirius::proto::ServletHeartbeatRequest *request,
+                       sirius::proto::ServletHeartbeatResponse *response,
+                       google::protobuf::Closure *done) override;
+
 
         void flush_memtable_thread();
 
@@ -82,10 +96,29 @@ namespace sirius::discovery {
     private:
         DiscoveryServer() {}
 
+        /// \brief wait until this node has applied every write committed before the call,
+        ///        so a local read after it is linearizable.
+        /// \return 0 on success, -1 with errmsg set
+        int wait_read_index(int64_t *read_index, std::string *errmsg);
+
+        /// \brief prepare this node for a local read. a linearizable read always waits for
+        ///        the read index, a bounded staleness read only when the last applied leader
+        ///        heartbeat is older than max_staleness_ms, -1 means any staleness is fine.
+        /// \return 0 on success, -1 with errmsg set
+        int prepare_read(bool linearizable, int64_t max_staleness_ms, int64_t *read_index, std::string *errmsg);
+
+        /// \brief send a servlet write to the leader of its shard on another node and wait.
+        void forward_to_shard_leader(ServletShardStateMachine *shard,
+                                     const sirius::proto::DiscoveryManagerRequest *request,
+                                     sirius::proto::DiscoveryManagerResponse *response,
+                                     uint64_t log_id);
+
         fiber::Mutex discovery_nteract_mutex;
         DiscoveryStateMachine *_discovery_state_machine = nullptr;
         AutoIncrStateMachine *_auto_incr_state_machine = nullptr;
         TSOStateMachine *_tso_state_machine = nullptr;
+        // empty unless sirius_servlet_shards is set
+        std::vector<ServletShardStateMachine *> _servlet_shards;
         Fiber _flush_bth;
         bool _init_success = false;
         bool _shutdown = false;
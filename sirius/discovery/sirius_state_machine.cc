@@ -31,12 +31,111 @@
 #include <sirius/discovery/query_privilege_manager.h>
 #include <sirius/storage/sst_file_writer.h>
 #include <sirius/discovery/parse_path.h>
+#include <sirius/discovery/sirius_db.h>
+#include <sirius/discovery/closure_pipeline.h>
+#include <sirius/discovery/lease_manager.h>
+#include <sirius/discovery/servlet_shard_state_machine.h>
+#include <melon/rpc/channel.h>
+#include <melon/proto/raft/local_file_meta.pb.h>
+#include <alkaid/files/filesystem.h>
+#include <algorithm>
+#include <cinttypes>
+#include <map>
 
 namespace sirius::discovery {
 
+    /// \brief a key range of the discovery raft group written to its own full snapshot file.
+    struct SnapshotPart {
+        std::string name;
+        std::string start_key;
+        std::string end_key;
+    };
+
+    static const std::vector<SnapshotPart> &snapshot_parts() {
+        // ordered and adjacent, together they cover every key below MAX_IDENTIFY
+        static const std::vector<SnapshotPart> parts = {
+                {"schema", "", DiscoveryConstants::PRIVILEGE_IDENTIFY},
+                {"privilege", DiscoveryConstants::PRIVILEGE_IDENTIFY, DiscoveryConstants::DISCOVERY_IDENTIFY},
+                {"instance", DiscoveryConstants::DISCOVERY_IDENTIFY, DiscoveryConstants::CONFIG_IDENTIFY},
+                {"config", DiscoveryConstants::CONFIG_IDENTIFY, DiscoveryConstants::MAX_IDENTIFY},
+        };
+        return parts;
+    }
+
+    static std::string full_snapshot_file(int64_t index, const std::string &part) {
+        return "discovery_full_" + std::to_string(index) + "_" + part + ".sst";
+    }
+
+    static std::string delta_snapshot_file(int64_t from_index, int64_t to_index) {
+        return "discovery_delta_" + std::to_string(from_index) + "_" + std::to_string(to_index) + ".sst";
+    }
+
+    static bool parse_full_snapshot_file(const std::string &name, int64_t *index) {
+        char part[32];
+        char tail = 0;
+        return sscanf(name.c_str(), "discovery_full_%" SCNd64 "_%31[a-z].ss%c", index, part, &tail) == 3
+               && tail == 't';
+    }
+
+    static bool parse_delta_snapshot_file(const std::string &name, int64_t *from_index, int64_t *to_index) {
+        char tail = 0;
+        return sscanf(name.c_str(), "discovery_delta_%" SCNd64 "_%" SCNd64 ".ss%c",
+                      from_index, to_index, &tail) == 3 && tail == 't';
+    }
+
+    int ReadHeartbeatTimer::init(DiscoveryStateMachine *node, int timeout_ms) {
+        int ret = RepeatedTimerTask::init(timeout_ms);
+        _node = node;
+        return ret;
+    }
+
+    void ReadHeartbeatTimer::run() {
+        _node->propose_heartbeat();
+    }
+
+    int LeaseSyncTimer::init(DiscoveryStateMachine *node, int timeout_ms) {
+        int ret = RepeatedTimerTask::init(timeout_ms);
+        _node = node;
+        return ret;
+    }
+
+    void LeaseSyncTimer::run() {
+        _node->propose_lease_sync();
+    }
+
+    int DiscoveryStateMachine::init(const std::vector<melon::raft::PeerId> &peers) {
+        std::error_code ec;
+        alkaid::filesystem::create_directories(FLAGS_sirius_snapshot_file_path, ec);
+        if (ec) {
+            LOG(ERROR) << "create snapshot file path " << FLAGS_sirius_snapshot_file_path
+                       << " fail, error:" << ec.message();
+            return -1;
+        }
+        if (FLAGS_sirius_read_heartbeat_interval_ms > 0) {
+            _heartbeat_timer.init(this, FLAGS_sirius_read_heartbeat_interval_ms);
+        }
+        if (FLAGS_sirius_lease_sync_interval_ms > 0) {
+            _lease_sync_timer.init(this, FLAGS_sirius_lease_sync_interval_ms);
+        }
+        return BaseStateMachine::init(peers);
+    }
 
     void DiscoveryStateMachine::on_apply(melon::raft::Iterator &iter) {
+        // writes of all entries in this run go to rocksdb in one batch, memory is
+        // still updated entry by entry since later entries are checked against it.
+        // closures run after the batch is written.
+        TimeCost apply_cost;
+        std::vector<melon::raft::Closure *> dones;
+        size_t entry_count = 0;
+        int64_t last_index = 0;
+        DiscoveryRocksdb::get_instance()->begin_apply_batch();
         for (; iter.valid(); iter.next()) {
+            if (_apply_write_failed) {
+                // memory can not be trusted any more, the rest is replayed after restart
+                break;
+            }
+            ++entry_count;
+            last_index = iter.index();
             melon::raft::Closure *done = iter.done();
             melon::ClosureGuard done_guard(done);
             if (done) {
@@ -51,86 +150,291 @@ namespace sirius::discovery {
                         ((DiscoveryServerClosure *) done)->response->set_errcode(sirius::proto::PARSE_FROM_PB_FAIL);
                         ((DiscoveryServerClosure *) done)->response->set_errmsg("parse from protobuf fail");
                     }
-                    melon::raft::run_closure_in_fiber(done_guard.release());
+                    dones.push_back(done_guard.release());
                 }
                 continue;
             }
             if (done && ((DiscoveryServerClosure *) done)->response) {
                 ((DiscoveryServerClosure *) done)->response->set_op_type(request.op_type());
             }
-            LOG(INFO) << "on apply, term:" << iter.term() << ", index:" << iter.index()
+            DLOG(INFO) << "on apply, term:" << iter.term() << ", index:" << iter.index()
                          << ", request op_type:" << sirius::proto::OpType_Name(request.op_type());
-            switch (request.op_type()) {
-                case sirius::proto::OP_CREATE_USER: {
-                    PrivilegeManager::get_instance()->create_user(request, done);
-                    break;
-                }
-                case sirius::proto::OP_DROP_USER: {
-                    PrivilegeManager::get_instance()->drop_user(request, done);
-                    break;
-                }
-                case sirius::proto::OP_ADD_PRIVILEGE: {
-                    PrivilegeManager::get_instance()->add_privilege(request, done);
-                    break;
-                }
-                case sirius::proto::OP_DROP_PRIVILEGE: {
-                    PrivilegeManager::get_instance()->drop_privilege(request, done);
-                    break;
-                }
-                case sirius::proto::OP_CREATE_NAMESPACE: {
-                    AppManager::get_instance()->create_app(request, done);
-                    break;
+            apply_request(request, done);
+            if (done) {
+                dones.push_back(done_guard.release());
+            }
+        }
+        if (DiscoveryRocksdb::get_instance()->commit_apply_batch() != 0 || _apply_write_failed) {
+            // memory already holds the writes of this run and rocksdb does not, the entries are
+            // committed in the log. stop the node, it replays them from the last durable index
+            // on restart. raft runs the closures of the rolled back entries with an error, they
+            // answer NOT_LEADER and the client retries on the next leader.
+            LOG(ERROR) << "write apply batch fail, stop applying, entries:" << entry_count
+                       << ", last index:" << last_index << ", applied_index:" << applied_index();
+            _apply_write_failed = false;
+            set_have_data(false);
+            // a valid iterator stopped at an entry not applied yet, it is rolled back too
+            iter.set_error_and_rollback(iter.valid() ? entry_count + 1 : entry_count);
+            return;
+        }
+        // only durable entries count as applied, read barriers and snapshots follow it
+        _applied_index.store(last_index, std::memory_order_release);
+        notify_applied();
+        ClosurePipeline::get_instance()->push(dones);
+        ClosurePipeline::get_instance()->add_apply_time(apply_cost.get_time());
+    }
+
+    void DiscoveryStateMachine::apply_request(const sirius::proto::DiscoveryManagerRequest &request,
+                                              melon::raft::Closure *done) {
+        switch (request.op_type()) {
+            case sirius::proto::OP_CREATE_USER: {
+                PrivilegeManager::get_instance()->create_user(request, done);
+                break;
+            }
+            case sirius::proto::OP_DROP_USER: {
+                PrivilegeManager::get_instance()->drop_user(request, done);
+                break;
+            }
+            case sirius::proto::OP_ADD_PRIVILEGE: {
+                PrivilegeManager::get_instance()->add_privilege(request, done);
+                break;
+            }
+            case sirius::proto::OP_DROP_PRIVILEGE: {
+                PrivilegeManager::get_instance()->drop_privilege(request, done);
+                break;
+            }
+            case sirius::proto::OP_CREATE_NAMESPACE: {
+                AppManager::get_instance()->create_app(request, done);
+                break;
+            }
+            case sirius::proto::OP_DROP_NAMESPACE: {
+                AppManager::get_instance()->drop_app(request, done);
+                break;
+            }
+            case sirius::proto::OP_MODIFY_NAMESPACE: {
+                AppManager::get_instance()->modify_app(request, done);
+                break;
+            }
+            case sirius::proto::OP_CREATE_ZONE: {
+                ZoneManager::get_instance()->create_zone(request, done);
+                break;
+            }
+            case sirius::proto::OP_DROP_ZONE: {
+                ZoneManager::get_instance()->drop_zone(request, done);
+                break;
+            }
+            case sirius::proto::OP_MODIFY_ZONE: {
+                ZoneManager::get_instance()->modify_zone(request, done);
+                break;
+            }
+            case sirius::proto::OP_CREATE_SERVLET: {
+                ServletManager::get_instance()->create_servlet(request, done);
+                break;
+            }
+            case sirius::proto::OP_DROP_SERVLET: {
+                ServletManager::get_instance()->drop_servlet(request, done);
+                break;
+            }
+            case sirius::proto::OP_MODIFY_SERVLET: {
+                ServletManager::get_instance()->modify_servlet(request, done);
+                break;
+            }
+            case sirius::proto::OP_CREATE_CONFIG: {
+                ConfigManager::get_instance()->create_config(request, done);
+                break;
+            }
+            case sirius::proto::OP_REMOVE_CONFIG: {
+                ConfigManager::get_instance()->remove_config(request, done);
+                break;
+            }
+            case sirius::proto::OP_BATCH: {
+                apply_batch(request, done);
+                break;
+            }
+            case sirius::proto::OP_READ_BARRIER: {
+                if (request.has_heartbeat_ms()) {
+                    _heartbeat_leader_ms.store(request.heartbeat_ms(), std::memory_order_relaxed);
+                    _heartbeat_applied_ms.store(mutil::gettimeofday_ms(), std::memory_order_relaxed);
                 }
-                case sirius::proto::OP_DROP_NAMESPACE: {
-                    AppManager::get_instance()->drop_app(request, done);
-                    break;
+                IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
+                break;
+            }
+            case sirius::proto::OP_SYNC_LEASES: {
+                LeaseManager::get_instance()->apply_changes(request);
+                IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
+                break;
+            }
+            default: {
+                LOG(ERROR) << "unknown request type, type:" << request.op_type();
+                IF_DONE_SET_RESPONSE(done, sirius::proto::UNKNOWN_REQ_TYPE, "unknown request type");
+            }
+        }
+    }
+
+    void DiscoveryStateMachine::apply_batch(const sirius::proto::DiscoveryManagerRequest &request,
+                                            melon::raft::Closure *done) {
+        if (FLAGS_sirius_servlet_shards > 0) {
+            // checked before propose too, an entry from before sharding was enabled must not
+            // write servlets into this group
+            for (auto &sub_request: request.sub_requests()) {
+                if (ServletShardStateMachine::is_servlet_op(sub_request.op_type())) {
+                    LOG(WARNING) << "servlet write in batch while servlets are sharded, reject batch";
+                    IF_DONE_SET_RESPONSE(done, sirius::proto::INPUT_PARAM_ERROR,
+                                         "servlet writes are sharded, not allowed in batch");
+                    return;
                 }
-                case sirius::proto::OP_MODIFY_NAMESPACE: {
-                    AppManager::get_instance()->modify_app(request, done);
-                    break;
+            }
+        }
+        auto db = DiscoveryRocksdb::get_instance();
+        std::vector<sirius::proto::DiscoveryManagerResponse> sub_responses(request.sub_requests_size());
+        int failed_index = -1;
+        db->set_apply_save_point();
+        for (int i = 0; i < request.sub_requests_size(); ++i) {
+            auto &sub_request = request.sub_requests(i);
+            auto &sub_response = sub_responses[i];
+            sub_response.set_op_type(sub_request.op_type());
+            if (sub_request.op_type() == sirius::proto::OP_BATCH) {
+                sub_response.set_errcode(sirius::proto::INPUT_PARAM_ERROR);
+                sub_response.set_errmsg("nested batch");
+            } else {
+                // followers have no closure, sub requests still need one to report failures
+                DiscoveryServerClosure sub_done;
+                sub_done.cntl = nullptr;
+                sub_done.common_state_machine = this;
+                sub_done.done = nullptr;
+                sub_done.response = &sub_response;
+                sub_response.set_errcode(sirius::proto::INTERNAL_ERROR);
+                apply_request(sub_request, &sub_done);
+            }
+            if (sub_response.errcode() != sirius::proto::SUCCESS) {
+                failed_index = i;
+                break;
+            }
+        }
+        if (failed_index < 0) {
+            db->pop_apply_save_point();
+        } else {
+            LOG(WARNING) << "batch sub request " << failed_index << " fail, roll back "
+                         << request.sub_requests_size() << " sub requests";
+            if (db->rollback_apply_save_point() != 0) {
+                _apply_write_failed = true;
+            }
+            // a failed sub request leaves memory as it was, only the ones before it changed
+            // their managers. those are rebuilt from rocksdb, the others are left alone
+            bool reload_privilege = false;
+            bool reload_schema = false;
+            bool reload_config = false;
+            for (int i = 0; i < failed_index; ++i) {
+                switch (request.sub_requests(i).op_type()) {
+                    case sirius::proto::OP_CREATE_USER:
+                    case sirius::proto::OP_DROP_USER:
+                    case sirius::proto::OP_ADD_PRIVILEGE:
+                    case sirius::proto::OP_DROP_PRIVILEGE:
+                        reload_privilege = true;
+                        break;
+                    case sirius::proto::OP_CREATE_CONFIG:
+                    case sirius::proto::OP_REMOVE_CONFIG:
+                        reload_config = true;
+                        break;
+                    default:
+                        reload_schema = true;
+                        break;
                 }
-                case sirius::proto::OP_CREATE_ZONE: {
-                    ZoneManager::get_instance()->create_zone(request, done);
-                    break;
+            }
+            // a refused config create may leave an empty version map behind
+            if (request.sub_requests(failed_index).op_type() == sirius::proto::OP_CREATE_CONFIG) {
+                reload_config = true;
+            }
+            if (reload_privilege || reload_schema || reload_config) {
+                // write what this run has collected before the batch, the reload reads rocksdb
+                if (db->commit_apply_batch() != 0
+                    || load_managers(reload_privilege, reload_schema, reload_config) != 0) {
+                    LOG(ERROR) << "reload memory fail after batch roll back";
+                    _apply_write_failed = true;
                 }
-                case sirius::proto::OP_DROP_ZONE: {
-                    ZoneManager::get_instance()->drop_zone(request, done);
-                    break;
+                db->begin_apply_batch();
+            }
+            std::string rollback_msg = "rolled back, sub request " + std::to_string(failed_index) + " fail";
+            for (int i = 0; i < request.sub_requests_size(); ++i) {
+                if (i == failed_index) {
+                    continue;
                 }
-                case sirius::proto::OP_MODIFY_ZONE: {
-                    ZoneManager::get_instance()->modify_zone(request, done);
+                sub_responses[i].set_op_type(request.sub_requests(i).op_type());
+                sub_responses[i].set_errcode(sirius::proto::INTERNAL_ERROR);
+                sub_responses[i].set_errmsg(i < failed_index ? rollback_msg : "not applied");
+            }
+        }
+        if (done && ((DiscoveryServerClosure *) done)->response) {
+            auto response = ((DiscoveryServerClosure *) done)->response;
+            if (failed_index < 0) {
+                response->set_errcode(sirius::proto::SUCCESS);
+                response->set_errmsg("success");
+            } else {
+                response->set_errcode(sub_responses[failed_index].errcode());
+                response->set_errmsg("sub request " + std::to_string(failed_index) + " fail: "
+                                     + sub_responses[failed_index].errmsg());
+            }
+            for (auto &sub_response: sub_responses) {
+                response->add_sub_responses()->Swap(&sub_response);
+            }
+        }
+    }
+
+    bool DiscoveryStateMachine::check_batch_request(const sirius::proto::DiscoveryManagerRequest &request,
+                                                    std::string *errmsg) {
+        if (request.sub_requests_size() == 0) {
+            *errmsg = "no sub requests";
+            return false;
+        }
+        if (request.sub_requests_size() > FLAGS_sirius_batch_max_ops) {
+            *errmsg = "too many sub requests, max:" + std::to_string(FLAGS_sirius_batch_max_ops);
+            return false;
+        }
+        for (auto &sub_request: request.sub_requests()) {
+            bool has_payload = false;
+            switch (sub_request.op_type()) {
+                case sirius::proto::OP_CREATE_USER:
+                    has_payload = sub_request.has_user_privilege() && sub_request.user_privilege().has_password();
                     break;
-                }
-                case sirius::proto::OP_CREATE_SERVLET: {
-                    ServletManager::get_instance()->create_servlet(request, done);
+                case sirius::proto::OP_DROP_USER:
+                case sirius::proto::OP_ADD_PRIVILEGE:
+                case sirius::proto::OP_DROP_PRIVILEGE:
+                    has_payload = sub_request.has_user_privilege();
                     break;
-                }
-                case sirius::proto::OP_DROP_SERVLET: {
-                    ServletManager::get_instance()->drop_servlet(request, done);
+                case sirius::proto::OP_CREATE_NAMESPACE:
+                case sirius::proto::OP_DROP_NAMESPACE:
+                case sirius::proto::OP_MODIFY_NAMESPACE:
+                    has_payload = sub_request.has_app_info();
                     break;
-                }
-                case sirius::proto::OP_MODIFY_SERVLET: {
-                    ServletManager::get_instance()->modify_servlet(request, done);
+                case sirius::proto::OP_CREATE_ZONE:
+                case sirius::proto::OP_DROP_ZONE:
+                case sirius::proto::OP_MODIFY_ZONE:
+                    has_payload = sub_request.has_zone_info();
                     break;
-                }
-                case sirius::proto::OP_CREATE_CONFIG: {
-                    ConfigManager::get_instance()->create_config(request, done);
+                case sirius::proto::OP_CREATE_SERVLET:
+                case sirius::proto::OP_DROP_SERVLET:
+                case sirius::proto::OP_MODIFY_SERVLET:
+                    if (FLAGS_sirius_servlet_shards > 0) {
+                        // servlets live in other raft groups, one entry can not cover them
+                        *errmsg = "servlet writes are sharded, not allowed in batch";
+                        return false;
+                    }
+                    has_payload = sub_request.has_servlet_info();
                     break;
-                }
-                case sirius::proto::OP_REMOVE_CONFIG: {
-                    ConfigManager::get_instance()->remove_config(request, done);
+                case sirius::proto::OP_CREATE_CONFIG:
+                case sirius::proto::OP_REMOVE_CONFIG:
+                    has_payload = sub_request.has_config_info();
                     break;
-                }
-                default: {
-                    LOG(ERROR) << "unknown request type, type:" << request.op_type();
-                    IF_DONE_SET_RESPONSE(done, sirius::proto::UNKNOWN_REQ_TYPE, "unknown request type");
-                }
+                default:
+                    *errmsg = "op_type not supported in batch: " + sirius::proto::OpType_Name(sub_request.op_type());
+                    return false;
             }
-            _applied_index = iter.index();
-            if (done) {
-                melon::raft::run_closure_in_fiber(done_guard.release());
+            if (!has_payload) {
+                *errmsg = "no payload for " + sirius::proto::OpType_Name(sub_request.op_type());
+                return false;
             }
         }
+        return true;
     }
 
     void DiscoveryStateMachine::on_snapshot_save(melon::raft::SnapshotWriter *writer, melon::raft::Closure *done) {
@@ -138,58 +442,250 @@ namespace sirius::discovery {
         LOG(WARNING) << "max_app_id:" << AppManager::get_instance()->get_max_app_id()
                      << ", max_zone_id:" << ZoneManager::get_instance()->get_max_zone_id()<< " when on snapshot save";
         //创建snapshot
-        mizar::ReadOptions read_options;
-        read_options.prefix_same_as_start = false;
-        read_options.total_order_seek = true;
-        auto iter = RocksStorage::get_instance()->new_iterator(read_options,
-                                                               RocksStorage::get_instance()->get_meta_info_handle());
-        iter->SeekToFirst();
+        // the rocksdb snapshot and the dirty keys are both taken between two apply runs
+        const mizar::Snapshot *db_snapshot = RocksStorage::get_instance()->get_snapshot();
+        auto dirty_keys = std::make_shared<std::set<std::string>>();
+        DiscoveryRocksdb::get_instance()->take_dirty_keys(dirty_keys.get());
+        int64_t snapshot_index = applied_index();
         Fiber bth(&FIBER_ATTR_SMALL);
-        std::function<void()> save_snapshot_function = [this, done, iter, writer]() {
-            save_snapshot(done, iter, writer);
+        std::function<void()> save_snapshot_function = [this, done, db_snapshot, writer, dirty_keys,
+                                                        snapshot_index]() {
+            save_snapshot(done, db_snapshot, writer, dirty_keys, snapshot_index);
         };
         bth.run(save_snapshot_function);
     }
 
     void DiscoveryStateMachine::save_snapshot(melon::raft::Closure *done,
-                                         mizar::Iterator *iter,
-                                         melon::raft::SnapshotWriter *writer) {
+                                         const mizar::Snapshot *db_snapshot,
+                                         melon::raft::SnapshotWriter *writer,
+                                         std::shared_ptr<std::set<std::string>> dirty_keys,
+                                         int64_t snapshot_index) {
         melon::ClosureGuard done_guard(done);
-        std::unique_ptr<mizar::Iterator> iter_lock(iter);
+        ON_SCOPE_EXIT(([db_snapshot]() {
+            RocksStorage::get_instance()->release_snapshot(db_snapshot);
+        }));
 
         std::string snapshot_path = writer->get_path();
-        std::string sst_file_path = snapshot_path + "/discovery_info.sst";
+        LOG(INFO)<< "snapshot path:" << snapshot_path;
+        bool full = _snapshot_full_count == 0
+                    || static_cast<int64_t>(_snapshot_chain.size() - _snapshot_full_count)
+                       >= FLAGS_sirius_snapshot_max_deltas;
+        std::vector<std::string> chain;
+        if (!full) {
+            chain = _snapshot_chain;
+        }
+        std::vector<std::string> new_files;
+        int ret = 0;
+        if (full) {
+            // every part is written by its own fiber, a part without keys has no file
+            auto &parts = snapshot_parts();
+            std::vector<int> part_rets(parts.size(), 0);
+            ConcurrencyBthread part_bth(parts.size(), &FIBER_ATTR_SMALL);
+            for (size_t i = 0; i < parts.size(); ++i) {
+                std::string file_path = snapshot_path + "/" + full_snapshot_file(snapshot_index, parts[i].name);
+                part_bth.run([this, db_snapshot, &parts, &part_rets, i, file_path]() {
+                    part_rets[i] = write_full_snapshot_file(db_snapshot, parts[i].start_key,
+                                                            parts[i].end_key, file_path);
+                });
+            }
+            part_bth.join();
+            for (size_t i = 0; i < parts.size(); ++i) {
+                if (part_rets[i] < 0) {
+                    ret = -1;
+                } else if (part_rets[i] > 0) {
+                    new_files.push_back(full_snapshot_file(snapshot_index, parts[i].name));
+                }
+            }
+        } else if (!dirty_keys->empty()) {
+            new_files.push_back(delta_snapshot_file(_snapshot_chain_index, snapshot_index));
+            ret = write_delta_snapshot_file(db_snapshot, *dirty_keys, snapshot_path + "/" + new_files[0]);
+        }
+        if (ret != 0) {
+            DiscoveryRocksdb::get_instance()->restore_dirty_keys(*dirty_keys);
+            done->status().set_error(EINVAL, "Fail to write snapshot file");
+            return;
+        }
+        std::error_code ec;
+        for (auto &file: chain) {
+            alkaid::filesystem::create_hard_link(FLAGS_sirius_snapshot_file_path + "/" + file,
+                                                 snapshot_path + "/" + file, ec);
+            if (ec) {
+                LOG(WARNING) << "link snapshot file " << file << " fail, error:" << ec.message();
+                DiscoveryRocksdb::get_instance()->restore_dirty_keys(*dirty_keys);
+                done->status().set_error(EINVAL, "Fail to link snapshot file");
+                return;
+            }
+        }
+        for (auto &new_file: new_files) {
+            // a file of the same name covers the same indexes
+            alkaid::filesystem::remove(FLAGS_sirius_snapshot_file_path + "/" + new_file, ec);
+            alkaid::filesystem::create_hard_link(snapshot_path + "/" + new_file,
+                                                 FLAGS_sirius_snapshot_file_path + "/" + new_file, ec);
+            if (ec) {
+                LOG(WARNING) << "keep snapshot file " << new_file << " fail, error:" << ec.message();
+                DiscoveryRocksdb::get_instance()->restore_dirty_keys(*dirty_keys);
+                done->status().set_error(EINVAL, "Fail to keep snapshot file");
+                return;
+            }
+            chain.push_back(new_file);
+        }
+        for (auto &file: chain) {
+            // files are named by the raft indexes they cover, so the same name holds the
+            // same data on every node and a follower does not download it again
+            melon::raft::LocalFileMeta file_meta;
+            file_meta.set_checksum(file);
+            if (writer->add_file("/" + file, &file_meta) != 0) {
+                DiscoveryRocksdb::get_instance()->restore_dirty_keys(*dirty_keys);
+                done->status().set_error(EINVAL, "Fail to add file");
+                LOG(ERROR) << "Error while adding file to writer";
+                return;
+            }
+        }
+        _snapshot_chain.swap(chain);
+        _snapshot_chain_index = snapshot_index;
+        if (full) {
+            _snapshot_full_count = new_files.size();
+        }
+        prune_snapshot_files();
+        LOG(INFO) << "snapshot save success, files:" << _snapshot_chain.size() << " new files:"
+                  << new_files.size() << " full:" << full << " dirty keys:" << dirty_keys->size();
+    }
 
+    int DiscoveryStateMachine::write_full_snapshot_file(const mizar::Snapshot *db_snapshot,
+                                                        const std::string &start_key,
+                                                        const std::string &end_key,
+                                                        const std::string &file_path) {
+        mizar::ReadOptions read_options;
+        read_options.prefix_same_as_start = false;
+        read_options.total_order_seek = true;
+        read_options.snapshot = db_snapshot;
+        std::unique_ptr<mizar::Iterator> iter(RocksStorage::get_instance()->new_iterator(
+                read_options, RocksStorage::get_instance()->get_meta_info_handle()));
+        iter->Seek(start_key);
+        // servlet shards snapshot their own keys, they are above every end key
+        if (!iter->Valid() || iter->key().compare(end_key) >= 0) {
+            return 0;
+        }
         mizar::Options option = RocksStorage::get_instance()->get_options(
                 RocksStorage::get_instance()->get_meta_info_handle());
         SstFileWriter sst_writer(option);
-        LOG(INFO)<< "snapshot path:" << snapshot_path;
         //Open the file for writing
-        auto s = sst_writer.open(sst_file_path);
+        auto s = sst_writer.open(file_path);
         if (!s.ok()) {
-            LOG(WARNING) << "Error while opening file " << sst_file_path << ", Error " << s.ToString();
-            done->status().set_error(EINVAL, "Fail to open SstFileWriter");
-            return;
+            LOG(WARNING) << "Error while opening file " << file_path << ", Error " << s.ToString();
+            return -1;
         }
         for (; iter->Valid(); iter->Next()) {
+            if (iter->key().compare(end_key) >= 0) {
+                break;
+            }
             auto res = sst_writer.put(iter->key(), iter->value());
             if (!res.ok()) {
-                LOG(WARNING) << "Error while adding Key: " << iter->key().ToString() << ", Error: " << s.ToString();
-                done->status().set_error(EINVAL, "Fail to write SstFileWriter");
-                return;
+                LOG(WARNING) << "Error while adding Key: " << iter->key().ToString() << ", Error: " << res.ToString();
+                return -1;
             }
         }
         //close the file
         s = sst_writer.finish();
         if (!s.ok()) {
-            LOG(WARNING) << "Error while finishing file " << sst_file_path << ", Error " << s.ToString();
-            done->status().set_error(EINVAL, "Fail to finish SstFileWriter");
-            return;
+            LOG(WARNING) << "Error while finishing file " << file_path << ", Error " << s.ToString();
+            return -1;
         }
-        if (writer->add_file("/discovery_info.sst") != 0) {
-            done->status().set_error(EINVAL, "Fail to add file");
-            LOG(ERROR) << "Error while adding file to writer";
-            return;
+        return 1;
+    }
+
+    int DiscoveryStateMachine::write_delta_snapshot_file(const mizar::Snapshot *db_snapshot,
+                                                         const std::set<std::string> &dirty_keys,
+                                                         const std::string &file_path) {
+        mizar::ReadOptions read_options;
+        read_options.snapshot = db_snapshot;
+        mizar::Options option = RocksStorage::get_instance()->get_options(
+                RocksStorage::get_instance()->get_meta_info_handle());
+        SstFileWriter sst_writer(option);
+        auto s = sst_writer.open(file_path);
+        if (!s.ok()) {
+            LOG(WARNING) << "Error while opening file " << file_path << ", Error " << s.ToString();
+            return -1;
+        }
+        // std::set orders keys bytewise, the order the sst needs
+        std::string value;
+        for (auto &key: dirty_keys) {
+            s = RocksStorage::get_instance()->get(read_options, RocksStorage::get_instance()->get_meta_info_handle(),
+                                                  key, &value);
+            if (s.ok()) {
+                s = sst_writer.put(key, value);
+            } else if (s.IsNotFound()) {
+                s = sst_writer.del(key);
+            }
+            if (!s.ok()) {
+                LOG(WARNING) << "Error while adding Key: " << key << ", Error: " << s.ToString();
+                return -1;
+            }
+        }
+        s = sst_writer.finish();
+        if (!s.ok()) {
+            LOG(WARNING) << "Error while finishing file " << file_path << ", Error " << s.ToString();
+            return -1;
+        }
+        return 0;
+    }
+
+    int DiscoveryStateMachine::load_snapshot_chain(const std::vector<std::string> &files,
+                                                   std::vector<std::string> *chain,
+                                                   size_t *full_count,
+                                                   int64_t *chain_index) {
+        std::map<int64_t, std::pair<int64_t, std::string>> deltas;
+        std::vector<std::string> full_files;
+        int64_t index = -1;
+        for (auto &file: files) {
+            std::string name = file.substr(file[0] == '/' ? 1 : 0);
+            int64_t from = 0;
+            int64_t to = 0;
+            if (parse_full_snapshot_file(name, &to)) {
+                if (index != -1 && index != to) {
+                    LOG(ERROR) << "snapshot full files of different index:" << index << " and " << to;
+                    return -1;
+                }
+                full_files.push_back(name);
+                index = to;
+            } else if (parse_delta_snapshot_file(name, &from, &to)) {
+                deltas[from] = std::make_pair(to, name);
+            }
+        }
+        chain->clear();
+        *full_count = full_files.size();
+        if (full_files.empty()) {
+            return deltas.empty() ? 0 : -1;
+        }
+        *chain = full_files;
+        while (!deltas.empty()) {
+            auto it = deltas.find(index);
+            if (it == deltas.end()) {
+                LOG(ERROR) << "snapshot delta chain broken at index:" << index;
+                return -1;
+            }
+            chain->push_back(it->second.second);
+            index = it->second.first;
+            deltas.erase(it);
+        }
+        *chain_index = index;
+        return 0;
+    }
+
+    void DiscoveryStateMachine::prune_snapshot_files() {
+        std::set<std::string> keep(_snapshot_chain.begin(), _snapshot_chain.end());
+        std::error_code ec;
+        std::vector<alkaid::filesystem::path> removes;
+        for (auto &entry: alkaid::filesystem::directory_iterator(FLAGS_sirius_snapshot_file_path, ec)) {
+            if (keep.count(entry.path().filename().string()) == 0) {
+                removes.push_back(entry.path());
+            }
+        }
+        for (auto &path: removes) {
+            alkaid::filesystem::remove(path, ec);
+            if (ec) {
+                LOG(WARNING) << "remove snapshot file " << path.string() << " fail, error:" << ec.message();
+            }
         }
     }
 
@@ -209,66 +705,339 @@ namespace sirius::discovery {
             LOG(WARNING) << "remove range success when on snapshot load:code:" << status.code() << ", msg:" << status.ToString();
         }
         LOG(WARNING) << "clear data success";
-        mizar::ReadOptions read_options;
-        std::unique_ptr<mizar::Iterator> iter(RocksStorage::get_instance()->new_iterator(read_options,
-                                                                                           RocksStorage::get_instance()->get_meta_info_handle()));
-        iter->Seek(DiscoveryConstants::SCHEMA_IDENTIFY);
-        for (; iter->Valid(); iter->Next()) {
-            LOG(WARNING) << "iter key:" << iter->key().ToString() << ", iter value:" << iter->value().ToString();
-        }
         std::vector<std::string> files;
         reader->list_files(&files);
+        std::vector<std::string> chain;
+        size_t full_count = 0;
+        int64_t chain_index = 0;
+        if (load_snapshot_chain(files, &chain, &full_count, &chain_index) != 0) {
+            return -1;
+        }
+        // the full files cover disjoint ranges and go in one ingest, each delta after
+        // them in chain order in its own, so the later one wins
+        std::vector<std::vector<std::string>> ingest_files;
+        if (full_count > 0) {
+            ingest_files.emplace_back(chain.begin(), chain.begin() + full_count);
+            for (size_t i = full_count; i < chain.size(); ++i) {
+                ingest_files.push_back({chain[i]});
+            }
+        }
+        // snapshots written before delta snapshots hold one file
+        if (ingest_files.empty() && std::find(files.begin(), files.end(), "/discovery_info.sst") != files.end()) {
+            ingest_files.push_back({"discovery_info.sst"});
+        }
+        std::string snapshot_path = reader->get_path();
         for (auto &file: files) {
             LOG(INFO) << "snapshot load file:" << file;
-            if (file == "/discovery_info.sst") {
-                std::string snapshot_path = reader->get_path();
-                _applied_index = parse_snapshot_index_from_path(snapshot_path, false);
-                LOG(INFO) << "_applied_index:" << _applied_index << " path:" << snapshot_path;
-                snapshot_path.append("/discovery_info.sst");
-
-                //恢复文件
-                mizar::IngestExternalFileOptions ifo;
+        }
+        if (!ingest_files.empty()) {
+            _applied_index.store(parse_snapshot_index_from_path(snapshot_path, false),
+                                 std::memory_order_release);
+            notify_applied();
+            LOG(INFO) << "_applied_index:" << applied_index() << " path:" << snapshot_path;
+            //恢复文件
+            mizar::IngestExternalFileOptions ifo;
+            // link the files into rocksdb instead of copying, they must then stay unchanged.
+            // rocksdb removes the link it moved from, so it gets a link of its own.
+            ifo.move_files = true;
+            ifo.write_global_seqno = false;
+            for (auto &batch_files: ingest_files) {
+                std::vector<std::string> file_paths;
+                for (auto &file: batch_files) {
+                    std::string file_path = FLAGS_sirius_snapshot_file_path + "/" + file + ".ingest";
+                    std::error_code ec;
+                    alkaid::filesystem::remove(file_path, ec);
+                    alkaid::filesystem::create_hard_link(snapshot_path + "/" + file, file_path, ec);
+                    if (ec) {
+                        LOG(ERROR) << "link snapshot file " << file << " fail, error:" << ec.message();
+                        return -1;
+                    }
+                    file_paths.push_back(file_path);
+                }
                 auto res = RocksStorage::get_instance()->ingest_external_file(
                         RocksStorage::get_instance()->get_meta_info_handle(),
-                        {snapshot_path},
+                        file_paths,
                         ifo);
                 if (!res.ok()) {
-                    LOG(ERROR) << "Error while ingest file " << snapshot_path << ", Error " << res.ToString();
-                    return -1;
-
-                }
-                auto ret = PrivilegeManager::get_instance()->load_snapshot();
-                if (ret != 0) {
-                    LOG(ERROR) << "PrivilegeManager load snapshot fail";
-                    return -1;
-                }
-                ret = SchemaManager::get_instance()->load_snapshot();
-                if (ret != 0) {
-                    LOG(ERROR) << "SchemaManager load snapshot fail";
-                    return -1;
-                }
-
-                ret = ConfigManager::get_instance()->load_snapshot();
-                if (ret != 0) {
-                    LOG(ERROR) << "ConfigManager load snapshot fail";
+                    LOG(ERROR) << "Error while ingest file " << batch_files[0] << ", Error " << res.ToString();
                     return -1;
                 }
             }
+            if (load_managers() != 0) {
+                return -1;
+            }
         }
+        // keep the loaded files for the next delta snapshot of this node
+        std::error_code ec;
+        for (auto &file: chain) {
+            std::string keep_path = FLAGS_sirius_snapshot_file_path + "/" + file;
+            if (alkaid::filesystem::exists(keep_path, ec)) {
+                continue;
+            }
+            alkaid::filesystem::create_hard_link(snapshot_path + "/" + file, keep_path, ec);
+            if (ec) {
+                LOG(WARNING) << "keep snapshot file " << file << " fail, error:" << ec.message();
+                chain.clear();
+                full_count = 0;
+                break;
+            }
+        }
+        _snapshot_chain.swap(chain);
+        _snapshot_full_count = full_count;
+        _snapshot_chain_index = chain_index;
+        prune_snapshot_files();
+        DiscoveryRocksdb::get_instance()->clear_dirty_keys();
         set_have_data(true);
         return 0;
     }
 
+    int DiscoveryStateMachine::load_managers(bool privilege, bool schema, bool config) {
+        // the managers read disjoint key ranges and lock only their own memory
+        TimeCost load_cost;
+        int privilege_ret = 0;
+        int schema_ret = 0;
+        int config_ret = 0;
+        ConcurrencyBthread load_bth(3, &FIBER_ATTR_SMALL);
+        if (privilege) {
+            load_bth.run([&privilege_ret]() {
+                privilege_ret = PrivilegeManager::get_instance()->load_snapshot();
+            });
+        }
+        if (schema) {
+            load_bth.run([&schema_ret]() {
+                schema_ret = SchemaManager::get_instance()->load_snapshot();
+            });
+        }
+        if (config) {
+            load_bth.run([&config_ret]() {
+                config_ret = ConfigManager::get_instance()->load_snapshot();
+            });
+        }
+        load_bth.join();
+        if (privilege_ret != 0) {
+            LOG(ERROR) << "PrivilegeManager load snapshot fail";
+            return -1;
+        }
+        if (schema_ret != 0) {
+            LOG(ERROR) << "SchemaManager load snapshot fail";
+            return -1;
+        }
+        if (config_ret != 0) {
+            LOG(ERROR) << "ConfigManager load snapshot fail";
+            return -1;
+        }
+        LOG(INFO) << "load managers cost:" << load_cost.get_time();
+        return 0;
+    }
+
     void DiscoveryStateMachine::on_leader_start() {
         LOG(WARNING) << "leader start at new term";
         BaseStateMachine::on_leader_start();
         _is_leader.store(true);
+        if (FLAGS_sirius_read_heartbeat_interval_ms > 0) {
+            _heartbeat_timer.start();
+        }
+        if (FLAGS_sirius_lease_sync_interval_ms > 0) {
+            // the first sync of a term is full
+            LeaseManager::get_instance()->on_leader_start(mutil::gettimeofday_ms());
+            _lease_sync_timer.start();
+        }
     }
 
     void DiscoveryStateMachine::on_leader_stop() {
+        _heartbeat_timer.stop();
+        _lease_sync_timer.stop();
+        _last_full_lease_sync_ms.store(0);
+        LeaseManager::get_instance()->on_leader_stop();
         _is_leader.store(false);
         LOG(WARNING) << "leader stop";
         BaseStateMachine::on_leader_stop();
     }
 
+    int DiscoveryStateMachine::read_index(int64_t *index, std::string *errmsg) {
+        fiber_mutex_lock(&_read_index_mutex);
+        // a barrier already running may have started before this call, use the next one
+        int64_t ticket = _read_barrier_started + 1;
+        while (_read_barrier_finished < ticket) {
+            if (_read_barrier_started == _read_barrier_finished) {
+                _read_barrier_started = _read_barrier_finished + 1;
+                fiber_mutex_unlock(&_read_index_mutex);
+                int64_t barrier_index = 0;
+                std::string barrier_errmsg;
+                int ret = is_leader() ? commit_read_barrier(&barrier_index, &barrier_errmsg)
+                                      : read_index_from_leader(&barrier_index, &barrier_errmsg);
+                fiber_mutex_lock(&_read_index_mutex);
+                _read_barrier_finished = _read_barrier_started;
+                _read_barrier_ret = ret;
+                _read_barrier_index = barrier_index;
+                _read_barrier_errmsg = barrier_errmsg;
+                fiber_cond_broadcast(&_read_index_cond);
+                break;
+            }
+            fiber_cond_wait(&_read_index_cond, &_read_index_mutex);
+        }
+        int ret = _read_barrier_ret;
+        *index = _read_barrier_index;
+        if (ret != 0) {
+            *errmsg = _read_barrier_errmsg;
+        }
+        fiber_mutex_unlock(&_read_index_mutex);
+        return ret;
+    }
+
+    int DiscoveryStateMachine::commit_read_barrier(int64_t *index, std::string *errmsg) {
+        sirius::proto::DiscoveryManagerRequest request;
+        request.set_op_type(sirius::proto::OP_READ_BARRIER);
+        request.set_heartbeat_ms(mutil::gettimeofday_ms());
+        mutil::IOBuf data;
+        mutil::IOBufAsZeroCopyOutputStream wrapper(&data);
+        if (!request.SerializeToZeroCopyStream(&wrapper)) {
+            *errmsg = "serialize read barrier fail";
+            return -1;
+        }
+        sirius::proto::DiscoveryManagerResponse response;
+        FiberCond sync_cond;
+        sync_cond.increase();
+        DiscoveryServerClosure *closure = new DiscoveryServerClosure;
+        closure->cntl = nullptr;
+        closure->response = &response;
+        closure->done = new ApplyraftClosure(sync_cond);
+        closure->common_state_machine = this;
+        melon::raft::Task task;
+        task.data = &data;
+        task.done = closure;
+        _node.apply(task);
+        sync_cond.wait();
+        if (response.errcode() != sirius::proto::SUCCESS) {
+            *errmsg = "read barrier fail, not leader";
+            return -1;
+        }
+        // closures run after their apply run, so everything up to the barrier is applied
+        *index = applied_index();
+        return 0;
+    }
+
+    int DiscoveryStateMachine::read_index_from_leader(int64_t *index, std::string *errmsg) {
+        mutil::EndPoint leader = get_leader();
+        if (leader.ip == mutil::IP_ANY) {
+            *errmsg = "no leader";
+            return -1;
+        }
+        melon::ChannelOptions channel_opt;
+        channel_opt.timeout_ms = FLAGS_sirius_read_index_timeout_ms;
+        channel_opt.connect_timeout_ms = FLAGS_sirius_connect_timeout;
+        melon::Channel channel;
+        if (channel.Init(leader, &channel_opt) != 0) {
+            *errmsg = "connect leader fail";
+            return -1;
+        }
+        sirius::proto::DiscoveryService_Stub stub(&channel);
+        melon::Controller cntl;
+        sirius::proto::DiscoveryQueryRequest request;
+        sirius::proto::DiscoveryQueryResponse response;
+        request.set_op_type(sirius::proto::QUERY_READ_INDEX);
+        stub.discovery_query(&cntl, &request, &response, nullptr);
+        if (cntl.Failed()) {
+            LOG(WARNING) << "get read index from leader fail, leader:" << leader << ", error:" << cntl.ErrorText();
+            *errmsg = "get read index from leader fail";
+            return -1;
+        }
+        if (response.errcode() != sirius::proto::SUCCESS || !response.has_read_index()) {
+            *errmsg = "get read index from leader fail, " + response.errmsg();
+            return -1;
+        }
+        *index = response.read_index();
+        return 0;
+    }
+
+    bool DiscoveryStateMachine::wait_applied(int64_t index, int64_t timeout_us) {
+        if (applied_index() >= index) {
+            return true;
+        }
+        timespec tm = mutil::microseconds_from_now(timeout_us);
+        bool applied = true;
+        fiber_mutex_lock(&_applied_mutex);
+        while (applied_index() < index) {
+            if (fiber_cond_timedwait(&_applied_cond, &_applied_mutex, &tm) != 0) {
+                applied = applied_index() >= index;
+                break;
+            }
+        }
+        fiber_mutex_unlock(&_applied_mutex);
+        return applied;
+    }
+
+    void DiscoveryStateMachine::notify_applied() {
+        fiber_mutex_lock(&_applied_mutex);
+        fiber_cond_broadcast(&_applied_cond);
+        fiber_mutex_unlock(&_applied_mutex);
+    }
+
+    int64_t DiscoveryStateMachine::staleness_ms() {
+        int64_t leader_ms = _heartbeat_leader_ms.load(std::memory_order_relaxed);
+        int64_t applied_ms = _heartbeat_applied_ms.load(std::memory_order_relaxed);
+        if (applied_ms == 0) {
+            return -1;
+        }
+        // take the earlier stamp, a leader clock running ahead of ours must not make memory look fresher
+        return mutil::gettimeofday_ms() - std::min(leader_ms, applied_ms);
+    }
+
+    void DiscoveryStateMachine::propose_heartbeat() {
+        if (!is_leader()) {
+            return;
+        }
+        sirius::proto::DiscoveryManagerRequest request;
+        request.set_op_type(sirius::proto::OP_READ_BARRIER);
+        request.set_heartbeat_ms(mutil::gettimeofday_ms());
+        mutil::IOBuf data;
+        mutil::IOBufAsZeroCopyOutputStream wrapper(&data);
+        if (!request.SerializeToZeroCopyStream(&wrapper)) {
+            LOG(ERROR) << "serialize heartbeat fail";
+            return;
+        }
+        DiscoveryServerClosure *closure = new DiscoveryServerClosure;
+        closure->cntl = nullptr;
+        closure->response = nullptr;
+        closure->done = nullptr;
+        closure->common_state_machine = this;
+        melon::raft::Task task;
+        task.data = &data;
+        task.done = closure;
+        _node.apply(task);
+    }
+
+    void DiscoveryStateMachine::propose_lease_sync() {
+        if (!is_leader()) {
+            return;
+        }
+        int64_t now_ms = mutil::gettimeofday_ms();
+        int64_t last_full_ms = _last_full_lease_sync_ms.load();
+        bool full = last_full_ms == 0
+                    || now_ms - last_full_ms >= FLAGS_sirius_lease_full_sync_interval_s * 1000LL;
+        sirius::proto::DiscoveryManagerRequest request;
+        request.set_op_type(sirius::proto::OP_SYNC_LEASES);
+        if (!LeaseManager::get_instance()->take_changes(now_ms, full, &request)) {
+            return;
+        }
+        if (full) {
+            _last_full_lease_sync_ms.store(now_ms);
+        }
+        mutil::IOBuf data;
+        mutil::IOBufAsZeroCopyOutputStream wrapper(&data);
+        if (!request.SerializeToZeroCopyStream(&wrapper)) {
+            LOG(ERROR) << "serialize lease sync fail";
+            return;
+        }
+        DiscoveryServerClosure *closure = new DiscoveryServerClosure;
+        closure->cntl = nullptr;
+        closure->response = nullptr;
+        closure->done = nullptr;
+        closure->common_state_machine = this;
+        melon::raft::Task task;
+        task.data = &data;
+        task.done = closure;
+        _node.apply(task);
+    }
+
 }  // namespace sirius::discovery
@@ -20,21 +20,71 @@
 #pragma once
 
 #include <mizar/db.h>
+#include <set>
 #include <sirius/discovery/base_state_machine.h>
+#include <melon/raft/repeated_timer_task.h>
 #include <sirius/proto/discovery.interface.pb.h>
 #include <sirius/flags/sirius.h>
 #include <sirius/discovery/sirius_constants.h>
 
 namespace sirius::discovery {
 
+    class DiscoveryStateMachine;
+
+    class ReadHeartbeatTimer : public melon::raft::RepeatedTimerTask {
+    public:
+        ReadHeartbeatTimer() : _node(nullptr) {}
+
+        virtual ~ReadHeartbeatTimer() {}
+
+        int init(DiscoveryStateMachine *node, int timeout_ms);
+
+        virtual void run();
+
+    protected:
+        virtual void on_destroy() {}
+
+        DiscoveryStateMachine *_node;
+    };
+
+    class LeaseSyncTimer : public melon::raft::RepeatedTimerTask {
+    public:
+        LeaseSyncTimer() : _node(nullptr) {}
+
+        virtual ~LeaseSyncTimer() {}
+
+        int init(DiscoveryStateMachine *node, int timeout_ms);
+
+        virtual void run();
+
+    protected:
+        virtual void on_destroy() {}
+
+        DiscoveryStateMachine *_node;
+    };
 
     class DiscoveryStateMachine : public BaseStateMachine {
     public:
         DiscoveryStateMachine(const melon::raft::PeerId &peerId) :
                 BaseStateMachine(DiscoveryConstants::DiscoveryMachineRegion, FLAGS_sirius_raft_group, "/discovery_server", peerId) {
+            fiber_mutex_init(&_applied_mutex, nullptr);
+            fiber_cond_init(&_applied_cond, nullptr);
+            fiber_mutex_init(&_read_index_mutex, nullptr);
+            fiber_cond_init(&_read_index_cond, nullptr);
         }
 
-        ~DiscoveryStateMachine() override = default;
+        ~DiscoveryStateMachine() override {
+            _heartbeat_timer.stop();
+            _heartbeat_timer.destroy();
+            _lease_sync_timer.stop();
+            _lease_sync_timer.destroy();
+            fiber_cond_destroy(&_applied_cond);
+            fiber_mutex_destroy(&_applied_mutex);
+            fiber_cond_destroy(&_read_index_cond);
+            fiber_mutex_destroy(&_read_index_mutex);
+        }
+
+        int init(const std::vector<melon::raft::PeerId> &peers) override;
 
         // state machine method
         void on_apply(melon::raft::Iterator &iter) override;
@@ -47,14 +97,138 @@ namespace sirius::discovery {
 
         void on_leader_stop() override;
 
-        int64_t applied_index() { return _applied_index; }
+        int64_t applied_index() { return _applied_index.load(std::memory_order_acquire); }
+
+        ///
+        /// \brief get a read index of the raft group, every write committed before the
+        ///        call is visible once applied_index reaches it. the leader commits a
+        ///        OP_READ_BARRIER entry to confirm it still leads, a follower asks the
+        ///        leader. concurrent callers share one barrier.
+        /// \return 0 on success, -1 with errmsg set
+        int read_index(int64_t *index, std::string *errmsg);
+
+        ///
+        /// \brief wait until the entry at index is applied.
+        /// \return false on timeout
+        bool wait_applied(int64_t index, int64_t timeout_us);
+
+        ///
+        /// \brief how old the memory of this node may be, judged by the last applied
+        ///        leader heartbeat. everything the leader committed before the heartbeat
+        ///        was proposed is applied, so the age of the heartbeat bounds the staleness.
+        /// \return -1 if no heartbeat has been applied since start
+        int64_t staleness_ms();
+
+        ///
+        /// \brief propose a heartbeat entry, called by the leader timer, does not wait.
+        void propose_heartbeat();
+
+        ///
+        /// \brief propose the servlet lease changes since the last sync, called by the
+        ///        leader timer, does not wait. nothing is proposed if nothing changed.
+        void propose_lease_sync();
+
+        ///
+        /// \brief check a OP_BATCH request before it is proposed, sub requests must be
+        ///        discovery ops with their payload, nested batches are not allowed.
+        /// \return false with errmsg set if the batch is invalid
+        static bool check_batch_request(const sirius::proto::DiscoveryManagerRequest &request, std::string *errmsg);
 
     private:
-        void save_snapshot(melon::raft::Closure *done,
-                           mizar::Iterator *iter,
-                           melon::raft::SnapshotWriter *writer);
+        void apply_request(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done);
+
+        ///
+        /// \brief apply the sub requests of a OP_BATCH entry in order. if one fails, the
+        ///        writes of the batch are rolled back and only the managers changed by the
+        ///        sub requests before the failed one are reloaded from rocksdb.
+        void apply_batch(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done);
+
+        ///
+        /// \brief rebuild the managers' memory from rocksdb, each manager in its own fiber.
+        int load_managers() {
+            return load_managers(true, true, true);
+        }
 
-        int64_t _applied_index = 0;
+        ///
+        /// \brief rebuild the memory of the selected managers from rocksdb.
+        int load_managers(bool privilege, bool schema, bool config);
+
+        ///
+        /// \brief write full files when there is no chain or the chain holds
+        ///        sirius_snapshot_max_deltas deltas, otherwise a delta file of the dirty keys,
+        ///        then link the chain files into the snapshot. the full files are one per
+        ///        key prefix, written in parallel from the same rocksdb snapshot.
+        void save_snapshot(melon::raft::Closure *done,
+                           const mizar::Snapshot *db_snapshot,
+                           melon::raft::SnapshotWriter *writer,
+                           std::shared_ptr<std::set<std::string>> dirty_keys,
+                           int64_t snapshot_index);
+
+        ///
+        /// \brief write the keys in [start_key, end_key) into one file.
+        /// \return 1 if written, 0 if the range has no key and no file is written, -1 on error
+        int write_full_snapshot_file(const mizar::Snapshot *db_snapshot,
+                                     const std::string &start_key,
+                                     const std::string &end_key,
+                                     const std::string &file_path);
+
+        ///
+        /// \brief write the current value of every dirty key, or a tombstone if it is gone.
+        int write_delta_snapshot_file(const mizar::Snapshot *db_snapshot,
+                                      const std::set<std::string> &dirty_keys,
+                                      const std::string &file_path);
+
+        ///
+        /// \brief order the files of a snapshot as full files then deltas by index.
+        /// \return -1 if the deltas do not form a chain from the full files
+        int load_snapshot_chain(const std::vector<std::string> &files,
+                                std::vector<std::string> *chain,
+                                size_t *full_count,
+                                int64_t *chain_index);
+
+        ///
+        /// \brief remove files under sirius_snapshot_file_path that left the chain.
+        void prune_snapshot_files();
+
+        int commit_read_barrier(int64_t *index, std::string *errmsg);
+
+        int read_index_from_leader(int64_t *index, std::string *errmsg);
+
+        void notify_applied();
+
+        std::atomic<int64_t> _applied_index{0};
+        fiber_mutex_t _applied_mutex;
+        fiber_cond_t _applied_cond;  // broadcast once per apply run
+
+        ReadHeartbeatTimer _heartbeat_timer;
+        // leader wall clock of the last applied heartbeat, and local wall clock when applied
+        std::atomic<int64_t> _heartbeat_leader_ms{0};
+        std::atomic<int64_t> _heartbeat_applied_ms{0};
+
+        LeaseSyncTimer _lease_sync_timer;
+        // 0 forces a full sync, reset when the leadership ends
+        std::atomic<int64_t> _last_full_lease_sync_ms{0};
+
+        fiber_mutex_t _read_index_mutex;  // protect the read barrier state below
+        fiber_cond_t _read_index_cond;
+        // barriers are numbered, a caller only uses a barrier started after it arrived
+        int64_t _read_barrier_started{0};
+        int64_t _read_barrier_finished{0};
+        int _read_barrier_ret{0};
+        int64_t _read_barrier_index{0};
+        std::string _read_barrier_errmsg;
+        // a write of the current apply run failed outside commit_apply_batch, memory and
+        // rocksdb disagree and the node stops applying at the end of the run
+        bool _apply_write_failed = false;
+
+        // files of the last snapshot, the full files first then the deltas in order, also
+        // linked under sirius_snapshot_file_path. only touched by snapshot save and load,
+        // raft never runs them at the same time.
+        std::vector<std::string> _snapshot_chain;
+        // leading full files of the chain, 0 if there is no chain
+        size_t _snapshot_full_count{0};
+        // raft index the chain is up to
+        int64_t _snapshot_chain_index{0};
     };
 
 }  // namespace sirius::discovery
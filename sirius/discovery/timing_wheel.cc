@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <sirius/discovery/timing_wheel.h>
+#include <algorithm>
+
+namespace sirius::discovery {
+
+    void TimingWheel::reset(int64_t tick_ms, int64_t now_ms) {
+        _tick_ms = std::max<int64_t>(tick_ms, 1);
+        _current_tick = now_ms / _tick_ms;
+        _size = 0;
+        for (auto &level: _slots) {
+            for (auto &slot: level) {
+                slot.clear();
+            }
+        }
+    }
+
+    void TimingWheel::add(int64_t id, int64_t deadline_ms) {
+        // round up, an id is never due before its deadline
+        int64_t tick = (deadline_ms + _tick_ms - 1) / _tick_ms;
+        place({id, std::max(tick, _current_tick + 1)});
+        ++_size;
+    }
+
+    void TimingWheel::place(const Entry &entry) {
+        int64_t diff = entry.tick - _current_tick;
+        for (int level = 0; level < kLevels; ++level) {
+            if (diff < (1LL << (kSlotBits * (level + 1)))) {
+                _slots[level][(entry.tick >> (kSlotBits * level)) & (kSlots - 1)].push_back(entry);
+                return;
+            }
+        }
+        // beyond the wheel, park it one full turn of the top level ahead
+        int64_t tick = _current_tick + (1LL << (kSlotBits * kLevels)) - 1;
+        _slots[kLevels - 1][(tick >> (kSlotBits * (kLevels - 1))) & (kSlots - 1)].push_back({entry.id, tick});
+    }
+
+    void TimingWheel::advance(int64_t now_ms, std::vector<int64_t> *due) {
+        int64_t now_tick = now_ms / _tick_ms;
+        while (_current_tick < now_tick) {
+            ++_current_tick;
+            // a higher level slot starting at this tick moves its ids down first
+            for (int level = 1; level < kLevels; ++level) {
+                if ((_current_tick & ((1LL << (kSlotBits * level)) - 1)) != 0) {
+                    break;
+                }
+                std::vector<Entry> entries;
+                entries.swap(_slots[level][(_current_tick >> (kSlotBits * level)) & (kSlots - 1)]);
+                for (auto &entry: entries) {
+                    place(entry);
+                }
+            }
+            auto &slot = _slots[0][_current_tick & (kSlots - 1)];
+            for (auto &entry: slot) {
+                due->push_back(entry.id);
+            }
+            _size -= slot.size();
+            slot.clear();
+        }
+    }
+
+}  // namespace sirius::discovery
@@ -0,0 +1,71 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sirius::discovery {
+
+    ///
+    /// \brief hierarchical timing wheel of ids, kLevels wheels of kSlots slots, a slot of
+    ///        level l spans kSlots^l ticks. add and the per tick work are O(1), an id is
+    ///        moved down at most kLevels - 1 times before it is due. ids further than the
+    ///        wheel can hold are parked in its last slot and come back early, the owner
+    ///        checks the real deadline of every due id. not thread safe.
+    class TimingWheel {
+    public:
+        static constexpr int kSlotBits = 6;
+        static constexpr int kSlots = 1 << kSlotBits;
+        static constexpr int kLevels = 4;
+
+        ///
+        /// \brief drop every id and restart the wheel at now_ms.
+        void reset(int64_t tick_ms, int64_t now_ms);
+
+        ///
+        /// \brief schedule id at deadline_ms, a deadline already passed is due on the next tick.
+        void add(int64_t id, int64_t deadline_ms);
+
+        ///
+        /// \brief run the ticks up to now_ms, ids of the slots passed are appended to due.
+        void advance(int64_t now_ms, std::vector<int64_t> *due);
+
+        size_t size() const {
+            return _size;
+        }
+
+    private:
+        struct Entry {
+            int64_t id;
+            int64_t tick;
+        };
+
+        void place(const Entry &entry);
+
+        int64_t _tick_ms{1000};
+        // every tick up to _current_tick has run
+        int64_t _current_tick{0};
+        size_t _size{0};
+        std::vector<Entry> _slots[kLevels][kSlots];
+    };
+
+}  // namespace sirius::discovery
@@ -19,6 +19,7 @@
 
 #include <sirius/discovery/tso_state_machine.h>
 #include <fstream>
+#include <algorithm>
 #include <collie/rapidjson/rapidjson.h>
 #include <collie/rapidjson/reader.h>
 #include <collie/rapidjson/writer.h>
@@ -28,6 +29,10 @@
 #include <melon/raft/util.h>
 #include <melon/raft/storage.h>
 #include <sirius/flags/sirius.h>
+#include <sirius/base/scope_exit.h>
+#include <sirius/discovery/binary_snapshot.h>
+#include <sirius/discovery/closure_pipeline.h>
+#include <cstring>
 
 namespace sirius::discovery {
 
@@ -44,12 +49,25 @@ namespace sirius::discovery {
 
     const std::string TSOStateMachine::SNAPSHOT_TSO_FILE = "tso.file";
     const std::string TSOStateMachine::SNAPSHOT_TSO_FILE_WITH_SLASH = "/" + SNAPSHOT_TSO_FILE;
+    const std::string TSOStateMachine::SNAPSHOT_TSO_DOMAIN_FILE = "tso_domain.json";
+    const std::string TSOStateMachine::SNAPSHOT_TSO_DOMAIN_FILE_WITH_SLASH = "/" + SNAPSHOT_TSO_DOMAIN_FILE;
+    const std::string TSOStateMachine::SNAPSHOT_TSO_BINARY_FILE = "tso.bin";
+    const std::string TSOStateMachine::SNAPSHOT_TSO_BINARY_FILE_WITH_SLASH = "/" + SNAPSHOT_TSO_BINARY_FILE;
+
+    static void set_tso_response(melon::raft::Closure *done, sirius::proto::ErrCode errcode,
+                                 const std::string &errmsg) {
+        if (done && ((TsoClosure *) done)->response) {
+            ((TsoClosure *) done)->response->set_errcode(errcode);
+            ((TsoClosure *) done)->response->set_errmsg(errmsg);
+        }
+    }
 
     int TSOStateMachine::init(const std::vector<melon::raft::PeerId> &peers) {
-        _tso_update_timer.init(this, tso::update_timestamp_interval_ms);
-        _tso_obj.current_timestamp.set_physical(0);
-        _tso_obj.current_timestamp.set_logical(0);
-        _tso_obj.last_save_physical = 0;
+        tso::init_options();
+        _tso_obj.pacing_threshold.store(tso::max_logical() / 2);
+        _tso_update_timer.init(this, tso::update_timestamp_interval_ms());
+        _tso_obj.current_timestamp.store(0);
+        _tso_obj.last_save_physical.store(0);
         //int ret = BaseStateMachine::init(peers);
         melon::raft::NodeOptions options;
         options.election_timeout_ms = FLAGS_sirius_election_timeout_ms;
@@ -72,7 +90,7 @@ namespace sirius::discovery {
     void TSOStateMachine::gen_tso(const sirius::proto::TsoRequest *request, sirius::proto::TsoResponse *response) {
         int64_t count = request->count();
         response->set_op_type(request->op_type());
-        if (count == 0) {
+        if (count <= 0) {
             response->set_errcode(sirius::proto::INPUT_PARAM_ERROR);
             response->set_errmsg("tso count should be positive");
             return;
@@ -83,32 +101,40 @@ namespace sirius::discovery {
             response->set_errmsg("timestamp not ok, retry later");
             return;
         }
-        sirius::proto::TsoTimestamp current;
+        const std::string &domain = request->domain();
+        TsoObj *obj = &_tso_obj;
+        if (!domain.empty()) {
+            std::string errmsg;
+            obj = prepare_domain(domain, &errmsg);
+            if (obj == nullptr) {
+                response->set_errcode(sirius::proto::EXEC_FAIL);
+                response->set_errmsg(errmsg);
+                return;
+            }
+        }
+        uint64_t current = 0;
         bool need_retry = false;
         for (size_t i = 0; i < 50; i++) {
-            {
-                MELON_SCOPED_LOCK(_tso_mutex);
-                int64_t physical = _tso_obj.current_timestamp.physical();
-                if (physical != 0) {
-                    int64_t new_logical = _tso_obj.current_timestamp.logical() + count;
-                    if (new_logical < tso::max_logical) {
-                        current.CopyFrom(_tso_obj.current_timestamp);
-                        _tso_obj.current_timestamp.set_logical(new_logical);
-                        need_retry = false;
-                    } else {
-                        LOG(WARNING) << "logical part outside of max logical interval, retry later, please check ntp time";
-                        need_retry = true;
-                    }
-                } else {
-                    LOG(WARNING) << "timestamp not ok physical == 0, retry later";
-                    need_retry = true;
-                }
+            int64_t seq = _publish_seq.load(std::memory_order_acquire);
+            int ret = obj->alloc(count, &current);
+            if (ret == -1) {
+                LOG(WARNING) << "timestamp not ok physical == 0, retry later";
+            } else if (ret == -2) {
+                LOG(WARNING) << "logical part outside of max logical interval, retry later, please check ntp time";
+            }
+            need_retry = (ret != 0);
+            if (!need_retry && tso::options().adaptive_pacing
+                && tso::extract_logical(current) + count >= obj->pacing_threshold.load(std::memory_order_relaxed)) {
+                // advance physical before the logical part runs out at the observed rate
+                kick_update_timestamp(domain, obj);
             }
             if (!need_retry) {
                 break;
-            } else {
-               fiber_usleep(tso::update_timestamp_interval_ms * 1000LL);
             }
+            // wait for the next publish instead of polling, and ask for it now
+            // rather than at the next timer tick.
+            kick_update_timestamp(domain, obj);
+            wait_publish(seq, tso::update_timestamp_interval_ms() * 1000LL);
         }
         if (need_retry) {
             response->set_errcode(sirius::proto::EXEC_FAIL);
@@ -118,11 +144,116 @@ namespace sirius::discovery {
         }
         //TLOG_WARN("gen tso current: ({}, {})", current.physical(), current.logical());
         auto timestamp = response->mutable_start_timestamp();
-        timestamp->CopyFrom(current);
+        timestamp->set_physical(tso::extract_physical(current));
+        timestamp->set_logical(tso::extract_logical(current));
         response->set_count(count);
+        response->set_logical_bits(tso::logical_bits());
         response->set_errcode(sirius::proto::SUCCESS);
     }
 
+    void TSOStateMachine::gen_tso_batched(const sirius::proto::TsoRequest *request,
+                                          sirius::proto::TsoResponse *response,
+                                          google::protobuf::Closure *done) {
+        std::vector<TsoBatchItem> batch;
+        bool is_flusher = false;
+        {
+            MELON_SCOPED_LOCK(_batch_mutex);
+            _tso_batch.push_back({request, response, done});
+            if (_tso_batch.size() >= static_cast<size_t>(FLAGS_sirius_tso_batch_max_size)) {
+                batch.swap(_tso_batch);
+            } else if (_tso_batch.size() == 1) {
+                is_flusher = true;
+            }
+        }
+        // the first request of a batch waits the window and flushes whatever has
+        // gathered, a request filling the batch flushes at once. if the batch was
+        // taken early the flusher may find an empty or a newer batch, both are fine.
+        if (is_flusher) {
+            fiber_usleep(FLAGS_sirius_tso_batch_window_us);
+            MELON_SCOPED_LOCK(_batch_mutex);
+            batch.swap(_tso_batch);
+        }
+        if (!batch.empty()) {
+            flush_tso_batch(batch);
+        }
+    }
+
+    void TSOStateMachine::flush_tso_batch(std::vector<TsoBatchItem> &batch) {
+        _tso_batch_size << static_cast<int64_t>(batch.size());
+        _tso_batch_count << 1;
+        bool single_domain = true;
+        for (auto &item: batch) {
+            if (item.request->domain() != batch.front().request->domain()) {
+                single_domain = false;
+                break;
+            }
+        }
+        if (single_domain) {
+            flush_domain_batch(batch.front().request->domain(), batch);
+            return;
+        }
+        std::map<std::string, std::vector<TsoBatchItem>> domain_batches;
+        for (auto &item: batch) {
+            domain_batches[item.request->domain()].push_back(item);
+        }
+        for (auto &domain_batch: domain_batches) {
+            flush_domain_batch(domain_batch.first, domain_batch.second);
+        }
+    }
+
+    void TSOStateMachine::flush_domain_batch(const std::string &domain, std::vector<TsoBatchItem> &batch) {
+        size_t begin = 0;
+        while (begin < batch.size()) {
+            // one allocation must fit in the logical space, split the batch otherwise
+            int64_t total = 0;
+            size_t end = begin;
+            for (; end < batch.size(); ++end) {
+                int64_t count = batch[end].request->count();
+                if (count <= 0) {
+                    continue;
+                }
+                if (total > 0 && total + count >= tso::max_logical()) {
+                    break;
+                }
+                total += count;
+            }
+            sirius::proto::TsoResponse batch_response;
+            if (total > 0) {
+                sirius::proto::TsoRequest batch_request;
+                batch_request.set_op_type(sirius::proto::OP_GEN_TSO);
+                batch_request.set_count(total);
+                if (!domain.empty()) {
+                    batch_request.set_domain(domain);
+                }
+                gen_tso(&batch_request, &batch_response);
+            }
+            int64_t offset = 0;
+            for (size_t i = begin; i < end; ++i) {
+                auto &item = batch[i];
+                melon::ClosureGuard done_guard(item.done);
+                int64_t count = item.request->count();
+                if (count <= 0) {
+                    gen_tso(item.request, item.response);
+                    continue;
+                }
+                item.response->set_op_type(item.request->op_type());
+                if (batch_response.errcode() != sirius::proto::SUCCESS) {
+                    item.response->set_errcode(batch_response.errcode());
+                    item.response->set_errmsg(batch_response.errmsg());
+                    continue;
+                }
+                auto timestamp = item.response->mutable_start_timestamp();
+                timestamp->set_physical(batch_response.start_timestamp().physical());
+                timestamp->set_logical(batch_response.start_timestamp().logical() + offset);
+                item.response->set_count(count);
+                item.response->set_logical_bits(tso::logical_bits());
+                item.response->set_errcode(sirius::proto::SUCCESS);
+                offset += count;
+            }
+            begin = end;
+        }
+    }
+
     void TSOStateMachine::process(google::protobuf::RpcController *controller,
                                   const sirius::proto::TsoRequest *request,
                                   sirius::proto::TsoResponse *response,
@@ -134,9 +265,15 @@ namespace sirius::discovery {
             response->set_op_type(request->op_type());
             response->set_leader(mutil::endpoint2str(_node.leader_id().addr).c_str());
             response->set_system_time(tso::clock_realtime_ms());
-            response->set_save_physical(_tso_obj.last_save_physical);
-            auto timestamp = response->mutable_start_timestamp();
-            timestamp->CopyFrom(_tso_obj.current_timestamp);
+            response->set_logical_bits(tso::logical_bits());
+            TsoObj *obj = get_domain(request->domain());
+            if (obj == nullptr) {
+                response->set_errcode(sirius::proto::INPUT_PARAM_ERROR);
+                response->set_errmsg("tso domain not exist");
+                return;
+            }
+            response->set_save_physical(obj->last_save_physical.load());
+            obj->get_timestamp(response->mutable_start_timestamp());
             return;
         }
         melon::Controller *cntl = (melon::Controller *) controller;
@@ -144,19 +281,24 @@ namespace sirius::discovery {
         if (cntl->has_log_id()) {
             log_id = cntl->log_id();
         }
-        const auto &remote_side_tmp = mutil::endpoint2str(cntl->remote_side());
-        const char *remote_side = remote_side_tmp.c_str();
+        if (!_is_leader && _leader_starting) {
+            wait_leader_ready(FLAGS_sirius_election_timeout_ms * 1000LL);
+        }
         if (!_is_leader) {
             response->set_errcode(sirius::proto::NOT_LEADER);
             response->set_errmsg("not leader");
             response->set_op_type(request->op_type());
             response->set_leader(mutil::endpoint2str(_node.leader_id().addr).c_str());
             LOG(WARNING) << "state machine not leader, request:" << request->ShortDebugString()
-                         << " remote_side:" << remote_side << " log_id:" << log_id;
+                         << " remote_side:" << mutil::endpoint2str(cntl->remote_side()) << " log_id:" << log_id;
             return;
         }
         // 获取时间戳在raft外执行
         if (request->op_type() == sirius::proto::OP_GEN_TSO) {
+            if (FLAGS_sirius_tso_batch_window_us > 0) {
+                gen_tso_batched(request, response, done_guard.release());
+                return;
+            }
             gen_tso(request, response);
             return;
         }
@@ -178,6 +320,8 @@ namespace sirius::discovery {
     }
 
     void TSOStateMachine::on_apply(melon::raft::Iterator &iter) {
+        TimeCost apply_cost;
+        std::vector<melon::raft::Closure *> dones;
         for (; iter.valid(); iter.next()) {
             melon::raft::Closure *done = iter.done();
             melon::ClosureGuard done_guard(done);
@@ -193,13 +337,22 @@ namespace sirius::discovery {
                         ((TsoClosure *) done)->response->set_errcode(sirius::proto::PARSE_FROM_PB_FAIL);
                         ((TsoClosure *) done)->response->set_errmsg("parse from protobuf fail");
                     }
-                    melon::raft::run_closure_in_fiber(done_guard.release());
+                    dones.push_back(done_guard.release());
                 }
                 continue;
             }
             if (done && ((TsoClosure *) done)->response) {
                 ((TsoClosure *) done)->response->set_op_type(request.op_type());
             }
+            // timestamps composed with fewer bits than the log was written with go backwards
+            if (request.has_logical_bits() && request.logical_bits() > tso::logical_bits()) {
+                LOG(ERROR) << "tso entry logical bits:" << request.logical_bits() << " above local:"
+                           << tso::logical_bits() << ", stop applying, fix sirius_tso_logical_bits";
+                // raft runs the closure of this entry with an error after the roll back
+                done_guard.release();
+                iter.set_error_and_rollback();
+                break;
+            }
             switch (request.op_type()) {
                 case sirius::proto::OP_RESET_TSO: {
                     reset_tso(request, done);
@@ -211,13 +364,15 @@ namespace sirius::discovery {
                 }
                 default: {
                     LOG(ERROR) << "unsupport request type, type:" << request.op_type();
-                    IF_DONE_SET_RESPONSE(done, sirius::proto::UNKNOWN_REQ_TYPE, "unsupport request type");
+                    set_tso_response(done, sirius::proto::UNKNOWN_REQ_TYPE, "unsupport request type");
                 }
             }
             if (done) {
-                melon::raft::run_closure_in_fiber(done_guard.release());
+                dones.push_back(done_guard.release());
             }
         }
+        ClosurePipeline::get_instance()->push(dones);
+        ClosurePipeline::get_instance()->add_apply_time(apply_cost.get_time());
     }
 
     void TSOStateMachine::reset_tso(const sirius::proto::TsoRequest &request,
@@ -225,31 +380,42 @@ namespace sirius::discovery {
         if (request.has_current_timestamp() && request.has_save_physical()) {
             int64_t physical = request.save_physical();
             sirius::proto::TsoTimestamp current = request.current_timestamp();
-            if (physical < _tso_obj.last_save_physical
-                || current.physical() < _tso_obj.current_timestamp.physical()) {
+            if (current.logical() < 0 || current.logical() >= tso::max_logical()) {
+                LOG(WARNING) << "reset tso logical out of range:" << current.logical();
+                set_tso_response(done, sirius::proto::INPUT_PARAM_ERROR, "logical out of range");
+                return;
+            }
+            if (request.domain().size() > kMaxDomainLength) {
+                set_tso_response(done, sirius::proto::INPUT_PARAM_ERROR, "tso domain too long");
+                return;
+            }
+            TsoObj *obj = get_or_create_domain(request.domain());
+            int64_t last_save = obj->last_save_physical.load();
+            uint64_t prev = obj->current_timestamp.load();
+            if (physical < last_save
+                || current.physical() < tso::extract_physical(prev)) {
                 if (!request.force()) {
-                    LOG(WARNING) << "time fallback save_physical:(" << physical << ", " << _tso_obj.last_save_physical
-                                 << ") current:(" << current.physical() << ", " << _tso_obj.current_timestamp.physical()
-                                 << ", " << current.logical() << ", " << _tso_obj.current_timestamp.logical();
+                    LOG(WARNING) << "time fallback save_physical:(" << physical << ", " << last_save
+                                 << ") current:(" << current.physical() << ", " << tso::extract_physical(prev)
+                                 << ", " << current.logical() << ", " << tso::extract_logical(prev);
                     if (done && ((TsoClosure *) done)->response) {
                         sirius::proto::TsoResponse *response = ((TsoClosure *) done)->response;
                         response->set_errcode(sirius::proto::INTERNAL_ERROR);
                         response->set_errmsg("time can't fallback");
                         auto timestamp = response->mutable_start_timestamp();
-                        timestamp->CopyFrom(_tso_obj.current_timestamp);
-                        response->set_save_physical(_tso_obj.last_save_physical);
+                        timestamp->set_physical(tso::extract_physical(prev));
+                        timestamp->set_logical(tso::extract_logical(prev));
+                        response->set_save_physical(last_save);
                     }
                     return;
                 }
             }
             _is_healty = true;
-            LOG(WARNING) << "reset tso save_physical: " << physical << " current: (" << current.physical()
-                         << ", " << current.logical() << ")";
-            {
-                MELON_SCOPED_LOCK(_tso_mutex);
-                _tso_obj.last_save_physical = physical;
-                _tso_obj.current_timestamp.CopyFrom(current);
-            }
+            LOG(WARNING) << "reset tso domain: " << request.domain() << " save_physical: " << physical
+                         << " current: (" << current.physical() << ", " << current.logical() << ")";
+            obj->last_save_physical.store(physical);
+            obj->set_timestamp(current);
+            notify_publish();
             if (done && ((TsoClosure *) done)->response) {
                 sirius::proto::TsoResponse *response = ((TsoClosure *) done)->response;
                 response->set_save_physical(physical);
@@ -265,11 +431,18 @@ namespace sirius::discovery {
                                      melon::raft::Closure *done) {
         int64_t physical = request.save_physical();
         sirius::proto::TsoTimestamp current = request.current_timestamp();
-        if (physical < _tso_obj.last_save_physical
-            || current.physical() < _tso_obj.current_timestamp.physical()) {
-            LOG(WARNING) << "time fallback save_physical:(" << physical << ", " << _tso_obj.last_save_physical
-                         << ") current:(" << current.physical() << ", " << _tso_obj.current_timestamp.physical()
-                         << ", " << current.logical() << ", " << _tso_obj.current_timestamp.logical() << ")";
+        if (request.domain().size() > kMaxDomainLength) {
+            set_tso_response(done, sirius::proto::INPUT_PARAM_ERROR, "tso domain too long");
+            return;
+        }
+        TsoObj *obj = get_or_create_domain(request.domain());
+        int64_t last_save = obj->last_save_physical.load();
+        uint64_t prev = obj->current_timestamp.load();
+        if (physical < last_save
+            || current.physical() < tso::extract_physical(prev)) {
+            LOG(WARNING) << "time fallback save_physical:(" << physical << ", " << last_save
+                         << ") current:(" << current.physical() << ", " << tso::extract_physical(prev)
+                         << ", " << current.logical() << ", " << tso::extract_logical(prev) << ")";
             if (done && ((TsoClosure *) done)->response) {
                 sirius::proto::TsoResponse *response = ((TsoClosure *) done)->response;
                 response->set_errcode(sirius::proto::INTERNAL_ERROR);
@@ -277,11 +450,9 @@ namespace sirius::discovery {
             }
             return;
         }
-        {
-            MELON_SCOPED_LOCK(_tso_mutex);
-            _tso_obj.last_save_physical = physical;
-            _tso_obj.current_timestamp.CopyFrom(current);
-        }
+        obj->last_save_physical.store(physical);
+        obj->set_timestamp(current);
+        notify_publish();
 
         if (done && ((TsoClosure *) done)->response) {
             sirius::proto::TsoResponse *response = ((TsoClosure *) done)->response;
@@ -291,10 +462,16 @@ namespace sirius::discovery {
     }
 
 
-    int TSOStateMachine::sync_timestamp(const sirius::proto::TsoTimestamp &current_timestamp, int64_t save_physical) {
+    int TSOStateMachine::sync_timestamp(const std::string &domain,
+                                        const sirius::proto::TsoTimestamp &current_timestamp,
+                                        int64_t save_physical) {
         sirius::proto::TsoRequest request;
         sirius::proto::TsoResponse response;
         request.set_op_type(sirius::proto::OP_UPDATE_TSO);
+        request.set_logical_bits(tso::logical_bits());
+        if (!domain.empty()) {
+            request.set_domain(domain);
+        }
         auto timestamp = request.mutable_current_timestamp();
         timestamp->CopyFrom(current_timestamp);
         request.set_save_physical(save_physical);
@@ -323,63 +500,234 @@ namespace sirius::discovery {
         return 0;
     }
 
+    void TSOStateMachine::notify_publish() {
+        fiber_mutex_lock(&_publish_mutex);
+        _publish_seq.fetch_add(1, std::memory_order_release);
+        fiber_cond_broadcast(&_publish_cond);
+        fiber_mutex_unlock(&_publish_mutex);
+    }
+
+    bool TSOStateMachine::wait_publish(int64_t seq, int64_t timeout_us) {
+        timespec tm = mutil::microseconds_from_now(timeout_us);
+        bool published = true;
+        fiber_mutex_lock(&_publish_mutex);
+        while (_publish_seq.load(std::memory_order_acquire) == seq) {
+            if (fiber_cond_timedwait(&_publish_cond, &_publish_mutex, &tm) != 0) {
+                published = _publish_seq.load(std::memory_order_acquire) != seq;
+                break;
+            }
+        }
+        fiber_mutex_unlock(&_publish_mutex);
+        return published;
+    }
+
+    void TSOStateMachine::wait_leader_ready(int64_t timeout_us) {
+        TimeCost cost;
+        while (!_is_leader && _leader_starting) {
+            int64_t seq = _publish_seq.load(std::memory_order_acquire);
+            if (_is_leader || !_leader_starting) {
+                break;
+            }
+            int64_t left_us = timeout_us - cost.get_time();
+            if (left_us <= 0 || !wait_publish(seq, left_us)) {
+                break;
+            }
+        }
+    }
+
+    void TSOStateMachine::kick_update_timestamp(const std::string &domain, TsoObj *obj) {
+        // claimed here, so a burst above the pacing threshold starts one fiber, not one per request
+        if (!_is_leader || obj->updating.exchange(true)) {
+            return;
+        }
+        Fiber bth(&FIBER_ATTR_SMALL);
+        bth.run([this, domain, obj]() {
+            ON_SCOPE_EXIT(([obj]() {
+                obj->updating.store(false);
+            }));
+            advance_domain_timestamp(domain, obj);
+        });
+    }
+
     void TSOStateMachine::update_timestamp() {
         if (!_is_leader) {
             return;
         }
-        int64_t now = tso::clock_realtime_ms();
-        int64_t prev_physical = 0;
-        int64_t prev_logical = 0;
-        int64_t last_save = 0;
-        {
-            MELON_SCOPED_LOCK(_tso_mutex);
-            prev_physical = _tso_obj.current_timestamp.physical();
-            prev_logical = _tso_obj.current_timestamp.logical();
-            last_save = _tso_obj.last_save_physical;
+        for (auto &domain: list_domains()) {
+            update_domain_timestamp(domain.first, domain.second);
         }
+    }
+
+    void TSOStateMachine::update_domain_timestamp(const std::string &domain, TsoObj *obj) {
+        if (!_is_leader) {
+            return;
+        }
+        // the timer and overflow kicks may race, two syncs of the same physical
+        // would reset the logical part twice and hand out duplicates.
+        if (obj->updating.exchange(true)) {
+            return;
+        }
+        ON_SCOPE_EXIT(([obj]() {
+            obj->updating.store(false);
+        }));
+        advance_domain_timestamp(domain, obj);
+    }
+
+    void TSOStateMachine::advance_domain_timestamp(const std::string &domain, TsoObj *obj) {
+        if (!_is_leader) {
+            return;
+        }
+        int64_t now = tso::clock_realtime_ms();
+        uint64_t prev = obj->current_timestamp.load(std::memory_order_acquire);
+        int64_t prev_physical = tso::extract_physical(prev);
+        int64_t prev_logical = tso::extract_logical(prev);
+        int64_t last_save = obj->last_save_physical.load();
         int64_t delta = now - prev_physical;
         if (delta < 0) {
             LOG(WARNING)<< "physical time slow now:" << now << " prev:" << prev_physical;
         }
+        int64_t threshold = tso::options().adaptive_pacing ? obj->pacing_threshold.load() : tso::max_logical() / 2;
         int64_t next = now;
         if (delta > tso::update_timestamp_guard_ms) {
             next = now;
-        } else if (prev_logical > tso::max_logical / 2) {
-            next = now + tso::update_timestamp_guard_ms;
+        } else if (prev_logical >= threshold) {
+            // under bursts physical may run ahead of the clock, never move it back
+            next = std::max(now, prev_physical) + tso::update_timestamp_guard_ms;
         } else {
-            LOG(WARNING) << "don't need update timestamp prev:" << prev_physical << " now:" << now << " save:" << last_save;
+            DLOG(INFO) << "don't need update timestamp domain:" << domain << " prev:" << prev_physical
+                         << " now:" << now << " save:" << last_save;
             return;
         }
         int64_t save = last_save;
         if (save - next <= tso::update_timestamp_guard_ms) {
-            save = next + tso::save_interval_ms;
+            save = next + tso::save_interval_ms();
         }
         sirius::proto::TsoTimestamp tp;
         tp.set_physical(next);
         tp.set_logical(0);
-        sync_timestamp(tp, save);
+        TimeCost sync_cost;
+        if (sync_timestamp(domain, tp, save) == 0 && tso::options().adaptive_pacing) {
+            update_pacing(obj, prev_logical, sync_cost.get_time());
+        }
     }
 
-    void TSOStateMachine::on_leader_start() {
-        LOG(WARNING) << "tso leader start";
+    void TSOStateMachine::update_pacing(TsoObj *obj, int64_t consumed_logical, int64_t sync_cost_us) {
+        int64_t now_us = turbo::Time::current_microseconds();
+        int64_t elapsed_us = now_us - obj->last_publish_us;
+        obj->last_publish_us = now_us;
+        if (elapsed_us <= 0) {
+            return;
+        }
+        // logical consumed since the previous publish, projected over the time one
+        // more publish takes, with the same again as margin.
+        int64_t headroom = consumed_logical * std::max<int64_t>(sync_cost_us, 1000) * 2 / elapsed_us;
+        int64_t threshold = std::max(tso::max_logical() / 8, tso::max_logical() - headroom);
+        obj->pacing_threshold.store(std::min(threshold, tso::max_logical() * 3 / 4));
+    }
+
+    TsoObj *TSOStateMachine::get_domain(const std::string &domain) {
+        if (domain.empty()) {
+            return &_tso_obj;
+        }
+        MELON_SCOPED_LOCK(_domain_mutex);
+        auto it = _domains.find(domain);
+        if (it == _domains.end()) {
+            return nullptr;
+        }
+        return it->second.get();
+    }
+
+    TsoObj *TSOStateMachine::get_or_create_domain(const std::string &domain) {
+        if (domain.empty()) {
+            return &_tso_obj;
+        }
+        MELON_SCOPED_LOCK(_domain_mutex);
+        auto &obj = _domains[domain];
+        if (obj == nullptr) {
+            obj = std::make_unique<TsoObj>();
+            obj->pacing_threshold.store(tso::max_logical() / 2);
+            LOG(WARNING) << "create tso domain:" << domain;
+        }
+        return obj.get();
+    }
+
+    TsoObj *TSOStateMachine::prepare_domain(const std::string &domain, std::string *errmsg) {
+        TsoObj *obj = get_domain(domain);
+        if (obj != nullptr) {
+            return obj;
+        }
+        if (domain.size() > kMaxDomainLength) {
+            *errmsg = "tso domain too long";
+            return nullptr;
+        }
+        MELON_SCOPED_LOCK(_domain_create_mutex);
+        obj = get_domain(domain);
+        if (obj != nullptr) {
+            return obj;
+        }
+        {
+            MELON_SCOPED_LOCK(_domain_mutex);
+            if (_domains.size() >= static_cast<size_t>(FLAGS_sirius_tso_max_domains)) {
+                *errmsg = "too many tso domains";
+                return nullptr;
+            }
+        }
+        // the domain only exists once its first window is committed, followers
+        // create it when applying the same entry.
         int64_t now = tso::clock_realtime_ms();
         sirius::proto::TsoTimestamp current;
         current.set_physical(now);
         current.set_logical(0);
-        int64_t last_save = _tso_obj.last_save_physical;
-        if (last_save - now < tso::update_timestamp_interval_ms) {
-            current.set_physical(last_save + tso::update_timestamp_guard_ms);
-            last_save = now + tso::save_interval_ms;
-        }
-        auto func = [this, last_save, current]() {
-            LOG(WARNING) << "leader start current(phy:" << current.physical() << ",log:" << current.logical()
-                         << ") save:" << last_save;
-            int ret = sync_timestamp(current, last_save);
-            if (ret < 0) {
-                _is_healty = false;
+        if (sync_timestamp(domain, current, now + tso::save_interval_ms()) != 0) {
+            *errmsg = "create tso domain failed";
+            return nullptr;
+        }
+        return get_domain(domain);
+    }
+
+    std::vector<std::pair<std::string, TsoObj *>> TSOStateMachine::list_domains() {
+        std::vector<std::pair<std::string, TsoObj *>> domains;
+        domains.emplace_back(std::string(), &_tso_obj);
+        MELON_SCOPED_LOCK(_domain_mutex);
+        for (auto &domain: _domains) {
+            domains.emplace_back(domain.first, domain.second.get());
+        }
+        return domains;
+    }
+
+    void TSOStateMachine::on_leader_start() {
+        LOG(WARNING) << "tso leader start";
+        // requests arriving before the first window commits are parked in
+        // wait_leader_ready. serving from last_save_physical right away is not
+        // safe: if this leader dies before its window commits, the next leader
+        // starts from the same last_save_physical and hands out the same timestamps.
+        _leader_starting.store(true);
+        auto func = [this]() {
+            for (auto &domain: list_domains()) {
+                int64_t now = tso::clock_realtime_ms();
+                sirius::proto::TsoTimestamp current;
+                current.set_physical(now);
+                current.set_logical(0);
+                int64_t last_save = domain.second->last_save_physical.load();
+                if (last_save - now < tso::update_timestamp_interval_ms()) {
+                    current.set_physical(last_save + tso::update_timestamp_guard_ms);
+                    last_save = now + tso::save_interval_ms();
+                }
+                LOG(WARNING) << "leader start domain:" << domain.first << " current(phy:" << current.physical()
+                             << ",log:" << current.logical() << ") save:" << last_save;
+                int ret = sync_timestamp(domain.first, current, last_save);
+                if (ret < 0) {
+                    _is_healty = false;
+                }
             }
             LOG(WARNING) << "sync timestamp ok";
+            if (!_leader_starting.load()) {
+                LOG(WARNING) << "tso leader stopped before first window committed";
+                return;
+            }
             _is_leader.store(true);
+            _leader_starting.store(false);
+            notify_publish();
             _tso_update_timer.start();
         };
         Fiber bth;
@@ -389,62 +737,115 @@ namespace sirius::discovery {
     void TSOStateMachine::on_leader_stop() {
         _tso_update_timer.stop();
         LOG(WARNING) << "tso leader stop";
+        _leader_starting.store(false);
         BaseStateMachine::on_leader_stop();
+        notify_publish();
     }
 
     void TSOStateMachine::on_snapshot_save(melon::raft::SnapshotWriter *writer, melon::raft::Closure *done) {
         LOG(WARNING) << "start on snapshot save";
-        std::string sto_str = std::to_string(_tso_obj.last_save_physical);
+        // list_domains returns the default domain first and the rest by name,
+        // so the records are already sorted.
+        auto domains = list_domains();
+        std::string records;
+        records.reserve(domains.size() * sizeof(TsoDomainRecord));
+        for (auto &domain: domains) {
+            TsoDomainRecord record;
+            memset(&record, 0, sizeof(record));
+            memcpy(record.domain, domain.first.data(), std::min(domain.first.size(), kMaxDomainLength));
+            record.save_physical = domain.second->last_save_physical.load();
+            records.append(reinterpret_cast<const char *>(&record), sizeof(record));
+        }
         Fiber bth(&FIBER_ATTR_SMALL);
-        std::function<void()> save_snapshot_function = [this, done, writer, sto_str]() {
-            save_snapshot(done, writer, sto_str);
+        std::function<void()> save_snapshot_function = [this, done, writer, records]() {
+            save_snapshot(done, writer, records);
         };
         bth.run(save_snapshot_function);
     }
 
     void TSOStateMachine::save_snapshot(melon::raft::Closure *done,
                                         melon::raft::SnapshotWriter *writer,
-                                        std::string sto_str) {
+                                        std::string records) {
         melon::ClosureGuard done_guard(done);
         std::string snapshot_path = writer->get_path();
-        std::string save_path = snapshot_path + SNAPSHOT_TSO_FILE_WITH_SLASH;
-        std::ofstream extra_fs(save_path,
-                               std::ofstream::out | std::ofstream::trunc);
-        extra_fs.write(sto_str.data(), sto_str.size());
-        extra_fs.close();
-        if (writer->add_file(SNAPSHOT_TSO_FILE_WITH_SLASH) != 0) {
+        std::string save_path = snapshot_path + SNAPSHOT_TSO_BINARY_FILE_WITH_SLASH;
+        if (write_binary_snapshot(save_path, BINARY_SNAPSHOT_TSO, sizeof(TsoDomainRecord), records,
+                                  static_cast<uint32_t>(tso::logical_bits())) != 0) {
+            done->status().set_error(EIO, "Fail to write tso file");
+            LOG(WARNING) << "Error while writing tso file";
+            return;
+        }
+        if (writer->add_file(SNAPSHOT_TSO_BINARY_FILE_WITH_SLASH) != 0) {
             done->status().set_error(EINVAL, "Fail to add file");
             LOG(WARNING) << "Error while adding file to writer";
             return;
         }
-        LOG(WARNING) << "save physical string:" << sto_str << " when snapshot";
+        LOG(WARNING) << "save physical of " << records.size() / sizeof(TsoDomainRecord)
+                     << " tso domains when snapshot, default:" << _tso_obj.last_save_physical.load();
     }
 
     int TSOStateMachine::on_snapshot_load(melon::raft::SnapshotReader *reader) {
         LOG(WARNING) << "start on snapshot load";
         std::vector<std::string> files;
         reader->list_files(&files);
+        bool has_binary = std::find(files.begin(), files.end(), SNAPSHOT_TSO_BINARY_FILE_WITH_SLASH) != files.end();
         for (auto &file: files) {
             LOG(WARNING) << "snapshot load file:" << file;
-            if (file == SNAPSHOT_TSO_FILE_WITH_SLASH) {
+            if (file == SNAPSHOT_TSO_BINARY_FILE_WITH_SLASH) {
+                std::string tso_file = reader->get_path() + SNAPSHOT_TSO_BINARY_FILE_WITH_SLASH;
+                if (load_tso_binary(tso_file) != 0) {
+                    LOG(WARNING) << "load tso fail";
+                    return -1;
+                }
+            } else if (has_binary) {
+                continue;
+            } else if (file == SNAPSHOT_TSO_FILE_WITH_SLASH) {
+                // snapshots written by old versions
                 std::string tso_file = reader->get_path() + SNAPSHOT_TSO_FILE_WITH_SLASH;
                 if (load_tso(tso_file) != 0) {
                     LOG(WARNING) << "load tso fail";
                     return -1;
                 }
-                break;
+            } else if (file == SNAPSHOT_TSO_DOMAIN_FILE_WITH_SLASH) {
+                std::string domain_file = reader->get_path() + SNAPSHOT_TSO_DOMAIN_FILE_WITH_SLASH;
+                if (load_tso_domain(domain_file) != 0) {
+                    LOG(WARNING) << "load tso domain fail";
+                    return -1;
+                }
             }
         }
         set_have_data(true);
         return 0;
     }
 
+    int TSOStateMachine::load_tso_binary(const std::string &tso_file) {
+        std::string data;
+        uint64_t count = 0;
+        uint32_t logical_bits = 0;
+        if (read_binary_snapshot(tso_file, BINARY_SNAPSHOT_TSO, sizeof(TsoDomainRecord), &data, &count,
+                                 &logical_bits) != 0) {
+            return -1;
+        }
+        // 0 for snapshots written before the bits were recorded
+        if (logical_bits > static_cast<uint32_t>(tso::logical_bits())) {
+            LOG(ERROR) << "tso snapshot logical bits:" << logical_bits << " above local:" << tso::logical_bits()
+                       << ", fix sirius_tso_logical_bits";
+            return -1;
+        }
+        const TsoDomainRecord *records = reinterpret_cast<const TsoDomainRecord *>(data.data());
+        for (uint64_t i = 0; i < count; ++i) {
+            std::string domain(records[i].domain, strnlen(records[i].domain, kMaxDomainLength));
+            get_or_create_domain(domain)->last_save_physical.store(records[i].save_physical);
+        }
+        return 0;
+    }
+
     int TSOStateMachine::load_tso(const std::string &tso_file) {
         std::ifstream extra_fs(tso_file);
         std::string extra((std::istreambuf_iterator<char>(extra_fs)),
                           std::istreambuf_iterator<char>());
         try {
-            _tso_obj.last_save_physical = std::stol(extra);
+            _tso_obj.last_save_physical.store(std::stol(extra));
         } catch (std::invalid_argument &) {
             LOG(WARNING) << "Invalid_argument: " << extra;
             return -1;
@@ -460,4 +861,24 @@ namespace sirius::discovery {
         return 0;
     }
 
+    int TSOStateMachine::load_tso_domain(const std::string &domain_file) {
+        std::ifstream extra_fs(domain_file);
+        std::string extra((std::istreambuf_iterator<char>(extra_fs)),
+                          std::istreambuf_iterator<char>());
+        rapidjson::Document root;
+        root.Parse(extra.c_str());
+        if (root.HasParseError() || !root.IsObject()) {
+            LOG(WARNING) << "parse tso domain file fail: " << extra;
+            return -1;
+        }
+        for (auto it = root.MemberBegin(); it != root.MemberEnd(); ++it) {
+            if (!it->value.IsInt64()) {
+                LOG(WARNING) << "invalid save physical of tso domain: " << it->name.GetString();
+                return -1;
+            }
+            get_or_create_domain(it->name.GetString())->last_save_physical.store(it->value.GetInt64());
+        }
+        return 0;
+    }
+
 }  // namespace sirius::discovery
@@ -22,6 +22,11 @@
 #include <sirius/discovery/base_state_machine.h>
 #include <melon/raft/repeated_timer_task.h>
 #include <time.h>
+#include <atomic>
+#include <vector>
+#include <map>
+#include <memory>
+#include <melon/var/var.h>
 #include <sirius/discovery/sirius_constants.h>
 
 namespace sirius::discovery {
@@ -44,22 +49,88 @@ namespace sirius::discovery {
         TSOStateMachine *_node;
     };
 
+    /// \brief tso state shared by the allocation path and the raft apply path.
+    ///        current_timestamp holds physical and logical packed by tso::pack_timestamp,
+    ///        gen_tso advances it with CAS, apply and timer publish it with a plain store.
+    ///        every tso domain owns one TsoObj, the default domain is the empty name.
     struct TsoObj {
-        sirius::proto::TsoTimestamp current_timestamp;
-        int64_t last_save_physical;
+        std::atomic<uint64_t> current_timestamp{0};
+        std::atomic<int64_t> last_save_physical{0};
+        // timer and overflow kicks of this domain must not run concurrently
+        std::atomic<bool> updating{false};
+        // adaptive pacing, advance physical once logical reaches the threshold
+        std::atomic<int64_t> pacing_threshold{0};
+        int64_t last_publish_us{0};
+
+        void get_timestamp(sirius::proto::TsoTimestamp *timestamp) const {
+            uint64_t packed = current_timestamp.load(std::memory_order_acquire);
+            timestamp->set_physical(tso::extract_physical(packed));
+            timestamp->set_logical(tso::extract_logical(packed));
+        }
+
+        /// \brief take count logical values with CAS, *start gets the packed first one.
+        ///        returns -1 while physical is not set and -2 when logical would pass
+        ///        max_logical, the caller waits for the next publish in both cases.
+        int alloc(int64_t count, uint64_t *start) {
+            // the timer and raft apply only ever store a whole new word, so a failed
+            // CAS just means someone moved the timestamp, reload and try again.
+            uint64_t current = current_timestamp.load(std::memory_order_acquire);
+            while (true) {
+                if (tso::extract_physical(current) == 0) {
+                    return -1;
+                }
+                if (tso::extract_logical(current) + count >= tso::max_logical()) {
+                    return -2;
+                }
+                if (current_timestamp.compare_exchange_weak(current, current + count,
+                                                            std::memory_order_acq_rel,
+                                                            std::memory_order_acquire)) {
+                    *start = current;
+                    return 0;
+                }
+            }
+        }
+
+        void set_timestamp(const sirius::proto::TsoTimestamp &timestamp) {
+            current_timestamp.store(tso::pack_timestamp(timestamp.physical(), timestamp.logical()),
+                                    std::memory_order_release);
+        }
+    };
+
+    /// \brief one tso domain in the binary snapshot, the name is zero padded.
+    struct TsoDomainRecord {
+        char domain[64];
+        int64_t save_physical;
+    };
+
+    /// \brief a gen tso request waiting in the coalescing queue.
+    struct TsoBatchItem {
+        const sirius::proto::TsoRequest *request;
+        sirius::proto::TsoResponse *response;
+        google::protobuf::Closure *done;
     };
 
     class TSOStateMachine : public BaseStateMachine {
     public:
         TSOStateMachine(const melon::raft::PeerId &peerId) :
-                BaseStateMachine(DiscoveryConstants::TsoMachineRegion, "tso_raft", "/tso", peerId) {
-            fiber_mutex_init(&_tso_mutex, nullptr);
+                BaseStateMachine(DiscoveryConstants::TsoMachineRegion, "tso_raft", "/tso", peerId),
+                _tso_batch_size("sirius_tso_batch_size"),
+                _tso_batch_count("sirius_tso_batch_count") {
+            fiber_mutex_init(&_batch_mutex, nullptr);
+            fiber_mutex_init(&_domain_mutex, nullptr);
+            fiber_mutex_init(&_domain_create_mutex, nullptr);
+            fiber_mutex_init(&_publish_mutex, nullptr);
+            fiber_cond_init(&_publish_cond, nullptr);
         }
 
         virtual ~TSOStateMachine() {
             _tso_update_timer.stop();
             _tso_update_timer.destroy();
-            fiber_mutex_destroy(&_tso_mutex);
+            fiber_mutex_destroy(&_batch_mutex);
+            fiber_mutex_destroy(&_domain_mutex);
+            fiber_mutex_destroy(&_domain_create_mutex);
+            fiber_cond_destroy(&_publish_cond);
+            fiber_mutex_destroy(&_publish_mutex);
         }
 
         virtual int init(const std::vector<melon::raft::PeerId> &peers);
@@ -74,21 +145,77 @@ namespace sirius::discovery {
 
         void gen_tso(const sirius::proto::TsoRequest *request, sirius::proto::TsoResponse *response);
 
+        /// \brief queue a gen tso request, the batch is allocated as one logical
+        ///        range by whichever caller flushes it. done is always run.
+        void gen_tso_batched(const sirius::proto::TsoRequest *request,
+                             sirius::proto::TsoResponse *response,
+                             google::protobuf::Closure *done);
+
+        void flush_tso_batch(std::vector<TsoBatchItem> &batch);
+
+        void flush_domain_batch(const std::string &domain, std::vector<TsoBatchItem> &batch);
+
+        /// \brief find a domain, the empty name is the default domain.
+        /// \return nullptr if the domain does not exist
+        TsoObj *get_domain(const std::string &domain);
+
+        /// \brief find or create a domain when applying raft entries.
+        TsoObj *get_or_create_domain(const std::string &domain);
+
+        /// \brief find a domain on the leader, a new domain is created by
+        ///        committing its first timestamp window through raft.
+        /// \return nullptr if the domain can not be created
+        TsoObj *prepare_domain(const std::string &domain, std::string *errmsg);
+
+        /// \brief all domains including the default one.
+        std::vector<std::pair<std::string, TsoObj *>> list_domains();
+
         void reset_tso(const sirius::proto::TsoRequest &request, melon::raft::Closure *done);
 
         void update_tso(const sirius::proto::TsoRequest &request, melon::raft::Closure *done);
 
         int load_tso(const std::string &tso_file);
 
-        int sync_timestamp(const sirius::proto::TsoTimestamp &current_timestamp, int64_t save_physical);
+        int load_tso_domain(const std::string &domain_file);
+
+        int load_tso_binary(const std::string &tso_file);
+
+        int sync_timestamp(const std::string &domain,
+                           const sirius::proto::TsoTimestamp &current_timestamp,
+                           int64_t save_physical);
 
         void update_timestamp();
 
+        void update_domain_timestamp(const std::string &domain, TsoObj *obj);
+
+        /// \brief advance the domain if it needs it, the caller holds obj->updating.
+        void advance_domain_timestamp(const std::string &domain, TsoObj *obj);
+
+        /// \brief wake up waiters of wait_publish, called after a new
+        ///        timestamp is published or the leader state changes.
+        void notify_publish();
+
+        /// \brief wait until the publish sequence moves past seq or timeout.
+        /// \return false on timeout
+        bool wait_publish(int64_t seq, int64_t timeout_us);
+
+        /// \brief park the caller while a newly elected leader commits its first
+        ///        timestamp window, instead of answering NOT_LEADER.
+        void wait_leader_ready(int64_t timeout_us);
+
+        /// \brief update the domain now in a fiber, used when the logical part overflows.
+        ///        the fiber is only started by the caller that claims obj->updating.
+        void kick_update_timestamp(const std::string &domain, TsoObj *obj);
+
+        /// \brief recompute the logical level at which physical is advanced early,
+        ///        from the logical consumed since the previous publish.
+        void update_pacing(TsoObj *obj, int64_t consumed_logical, int64_t sync_cost_us);
+
         virtual void on_snapshot_save(melon::raft::SnapshotWriter *writer, melon::raft::Closure *done);
 
         void save_snapshot(melon::raft::Closure *done,
                            melon::raft::SnapshotWriter *writer,
-                           std::string sto_str);
+                           std::string records);
 
         virtual int on_snapshot_load(melon::raft::SnapshotReader *reader);
 
@@ -98,12 +225,34 @@ namespace sirius::discovery {
 
         static const std::string SNAPSHOT_TSO_FILE;;
         static const std::string SNAPSHOT_TSO_FILE_WITH_SLASH;
+        static const std::string SNAPSHOT_TSO_DOMAIN_FILE;
+        static const std::string SNAPSHOT_TSO_DOMAIN_FILE_WITH_SLASH;
+        static const std::string SNAPSHOT_TSO_BINARY_FILE;
+        static const std::string SNAPSHOT_TSO_BINARY_FILE_WITH_SLASH;
+        static constexpr size_t kMaxDomainLength = 64;
 
     private:
         TsoTimer _tso_update_timer;
+        // default domain, served without any lookup
         TsoObj _tso_obj;
-        fiber_mutex_t _tso_mutex;  // 保护_tso_obj，C++20 atomic<std::shared_ptr<U>>
-        bool _is_healty = true;
+        fiber_mutex_t _domain_mutex;  // protect _domains
+        // named domains, never removed so TsoObj pointers stay valid
+        std::map<std::string, std::unique_ptr<TsoObj>> _domains;
+        fiber_mutex_t _domain_create_mutex;  // serialize domain creation on the leader
+        std::atomic<bool> _is_healty{true};
+        // raft leader whose first timestamp window is not committed yet
+        std::atomic<bool> _leader_starting{false};
+
+        // bumped on every timestamp publish and leader state change
+        std::atomic<int64_t> _publish_seq{0};
+        fiber_mutex_t _publish_mutex;
+        fiber_cond_t _publish_cond;
+
+        fiber_mutex_t _batch_mutex;  // protect _tso_batch
+        std::vector<TsoBatchItem> _tso_batch;
+        // average request count per batch
+        melon::var::IntRecorder _tso_batch_size;
+        melon::var::Adder<int64_t> _tso_batch_count;
     };
 
 }  // namespace sirius::discovery
@@ -75,7 +75,7 @@ namespace sirius::discovery {
         set_max_zone_id(tmp_zone_id);
         AppManager::get_instance()->add_zone_id(app_id, tmp_zone_id);
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(INFO) << "create zone success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "create zone success, request:" << request.ShortDebugString();
     }
 
     void ZoneManager::drop_zone(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done) {
@@ -113,7 +113,7 @@ namespace sirius::discovery {
         // update app memory info
         AppManager::get_instance()->delete_zone_id(app_id, zone_id);
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(INFO) << "drop zone success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "drop zone success, request:" << request.ShortDebugString();
     }
 
     void ZoneManager::modify_zone(const sirius::proto::DiscoveryManagerRequest &request, melon::raft::Closure *done) {
@@ -152,7 +152,7 @@ namespace sirius::discovery {
         // update zone values in memory
         set_zone_info(tmp_zone_info);
         IF_DONE_SET_RESPONSE(done, sirius::proto::SUCCESS, "success");
-        LOG(INFO) << "modify zone success, request:" << request.ShortDebugString();
+        DLOG(INFO) << "modify zone success, request:" << request.ShortDebugString();
     }
 
     int ZoneManager::load_zone_snapshot(const std::string &value) {
@@ -38,6 +38,58 @@ namespace sirius {
                  "sirius as server connect timeout, default:5000ms");
 
     DEFINE_int64(time_between_sirius_connect_error_ms, 0, "time between sirius connect error(ms)");
+    DEFINE_int32(sirius_batch_max_ops, 1000, "max sub requests in one batch manager request");
+    DEFINE_int32(sirius_servlet_shards, 0,
+                 "servlet raft groups hashed by app name, 0 keeps servlets in the discovery raft group, "
+                 "must be the same on all nodes and not changed once servlets are written");
+    DEFINE_int32(sirius_snapshot_max_deltas, 8,
+                 "delta files a discovery snapshot may stack on its full file before the next full one, "
+                 "0 writes a full snapshot every time");
+    DEFINE_string(sirius_snapshot_file_path, "./sirius_data/snapshot_files",
+                  "keeps the files of the last discovery snapshot for the next delta snapshot to link");
+    DEFINE_int32(sirius_access_log_sample_rate, 100,
+                 "log one of every n successful raft write requests, 0 means only failed and slow ones");
+    DEFINE_int64(sirius_slow_request_ms, 500, "raft write requests slower than this are always logged in full(ms)");
+    DEFINE_int32(sirius_read_index_timeout_ms, 1000,
+                 "linearizable read timeout for getting the read index and waiting it applied(ms)");
+    DEFINE_int32(sirius_read_heartbeat_interval_ms, 0,
+                 "interval of the leader heartbeat entry that bounded staleness reads are judged by, "
+                 "every heartbeat is a raft write, 0 disables and those reads wait for the read index(ms)");
+    DEFINE_int32(sirius_max_in_flight_applies, 4096,
+                 "max raft writes in flight per state machine on the leader, 0 means no limit");
+    DEFINE_int32(sirius_max_in_flight_applies_per_op, 1024,
+                 "max raft writes in flight per op type on the leader, 0 means no limit");
+    DEFINE_int32(sirius_admission_retry_after_ms, 100, "retry after hint for writes rejected by in flight limits(ms)");
+    DEFINE_int64(sirius_lease_ms, 10000, "servlet lease granted by one heartbeat(ms)");
+    DEFINE_int32(sirius_lease_sync_interval_ms, 1000,
+                 "interval the leader replicates servlet lease changes, 0 disables lease heartbeats(ms)");
+    DEFINE_int32(sirius_lease_full_sync_interval_s, 30,
+                 "interval the leader replicates every alive servlet lease, so restarted nodes catch up(s)");
+    DEFINE_int64(sirius_servlet_mtime_timeout_s, 50,
+                 "naming hides a servlet without lease whose mtime is older than this(s)");
+    DEFINE_int32(sirius_naming_cache_size, 10000,
+                 "max naming answers cached by query, the cache is dropped when full, 0 disables it");
+    DEFINE_int64(sirius_naming_watch_max_timeout_ms, 30000, "longest a naming watch may park(ms)");
+
+    /// for tso
+    DEFINE_int32(sirius_tso_batch_window_us, 0,
+                 "window to coalesce concurrent gen tso requests into one allocation(us), 0 means no coalescing");
+    DEFINE_int32(sirius_tso_batch_max_size, 64,
+                 "max gen tso requests in one coalesced batch, a full batch is flushed without waiting the window");
+    DEFINE_int32(sirius_tso_logical_bits, 18,
+                 "bits of the logical part of tso, in [10, 22], read at startup. must be the same on every "
+                 "node and never decrease, a node refuses snapshots and entries written with more bits");
+    DEFINE_int64(sirius_tso_save_interval_ms, 3000, "tso physical window persisted ahead by raft(ms), read at startup");
+    DEFINE_int64(sirius_tso_update_interval_ms, 50, "tso physical update interval(ms), read at startup");
+    DEFINE_bool(sirius_tso_adaptive_pacing, false,
+                "advance tso physical early by the observed logical consumption rate instead of max_logical/2");
+    DEFINE_int32(sirius_tso_max_domains, 256, "max named tso domains in the tso raft group");
+
+    /// for auto increment
+    DEFINE_int64(sirius_auto_incr_segment_size, 0,
+                 "ids reserved per servlet through raft and served from leader memory, 0 means every gen id goes through raft");
+    DEFINE_int32(sirius_auto_incr_prefetch_percent, 20,
+                 "prefetch the next id segment once the remaining ids of the current one drop below this percent");
 
 
 }  // namespace sirius
@@ -36,5 +36,35 @@ namespace sirius {
     DECLARE_int32(sirius_request_timeout);
     DECLARE_int32(sirius_connect_timeout);
     DECLARE_int64(time_between_sirius_connect_error_ms);
+    DECLARE_int32(sirius_batch_max_ops);
+    DECLARE_int32(sirius_servlet_shards);
+    DECLARE_int32(sirius_snapshot_max_deltas);
+    DECLARE_string(sirius_snapshot_file_path);
+    DECLARE_int32(sirius_access_log_sample_rate);
+    DECLARE_int64(sirius_slow_request_ms);
+    DECLARE_int32(sirius_read_index_timeout_ms);
+    DECLARE_int32(sirius_read_heartbeat_interval_ms);
+    DECLARE_int32(sirius_max_in_flight_applies);
+    DECLARE_int32(sirius_max_in_flight_applies_per_op);
+    DECLARE_int32(sirius_admission_retry_after_ms);
+    DECLARE_int64(sirius_lease_ms);
+    DECLARE_int32(sirius_lease_sync_interval_ms);
+    DECLARE_int32(sirius_lease_full_sync_interval_s);
+    DECLARE_int64(sirius_servlet_mtime_timeout_s);
+    DECLARE_int32(sirius_naming_cache_size);
+    DECLARE_int64(sirius_naming_watch_max_timeout_ms);
+
+    /// for tso
+    DECLARE_int32(sirius_tso_batch_window_us);
+    DECLARE_int32(sirius_tso_batch_max_size);
+    DECLARE_int32(sirius_tso_logical_bits);
+    DECLARE_int64(sirius_tso_save_interval_ms);
+    DECLARE_int64(sirius_tso_update_interval_ms);
+    DECLARE_bool(sirius_tso_adaptive_pacing);
+    DECLARE_int32(sirius_tso_max_domains);
+
+    /// for auto increment
+    DECLARE_int64(sirius_auto_incr_segment_size);
+    DECLARE_int32(sirius_auto_incr_prefetch_percent);
 
 }  // namespace sirius
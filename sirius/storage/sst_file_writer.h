@@ -40,6 +40,10 @@ namespace sirius {
             return _sst_writer->Put(key, value);
         }
 
+        mizar::Status del(const mizar::Slice &key) {
+            return _sst_writer->Delete(key);
+        }
+
         mizar::Status finish(mizar::ExternalSstFileInfo *file_info = nullptr) {
             return _sst_writer->Finish(file_info);
         }
@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// loads max_id.json as written by versions before the binary snapshot, the
+// format snapshot load still falls back to.
+
+#include <sirius/discovery/auto_incr_state_machine.h>
+#include <collie/rapidjson/document.h>
+#include <collie/rapidjson/stringbuffer.h>
+#include <collie/rapidjson/writer.h>
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+using sirius::discovery::AutoIncrRecord;
+using sirius::discovery::AutoIncrStateMachine;
+
+#define CHECK_TRUE(cond)                                                        \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d check fail: %s\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                           \
+        }                                                                       \
+    } while (0)
+
+// the same writer the old save_auto_increment used
+static std::string legacy_max_id_json(const std::map<int64_t, uint64_t> &max_ids) {
+    rapidjson::Document root;
+    root.SetObject();
+    rapidjson::Document::AllocatorType &alloc = root.GetAllocator();
+    for (auto &max_id_pair: max_ids) {
+        std::string servlet_id_string = std::to_string(max_id_pair.first);
+        rapidjson::Value servlet_id_val(rapidjson::kStringType);
+        servlet_id_val.SetString(servlet_id_string.c_str(), servlet_id_string.size(), alloc);
+        rapidjson::Value max_id_value(rapidjson::kNumberType);
+        max_id_value.SetUint64(max_id_pair.second);
+        root.AddMember(servlet_id_val, max_id_value, alloc);
+    }
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    root.Accept(writer);
+    return buffer.GetString();
+}
+
+static int test_legacy_snapshot() {
+    std::map<int64_t, uint64_t> max_ids = {{1, 100}, {42, 7}, {1LL << 40, 1ULL << 50}};
+    std::vector<AutoIncrRecord> records;
+    CHECK_TRUE(AutoIncrStateMachine::parse_max_id_json(legacy_max_id_json(max_ids), &records) == 0);
+    CHECK_TRUE(records.size() == max_ids.size());
+    for (auto &record: records) {
+        auto it = max_ids.find(record.servlet_id);
+        CHECK_TRUE(it != max_ids.end());
+        CHECK_TRUE(it->second == record.max_id);
+    }
+    return 0;
+}
+
+static int test_skip_bad_members() {
+    std::vector<AutoIncrRecord> records;
+    CHECK_TRUE(AutoIncrStateMachine::parse_max_id_json(R"({"5": 9, "x": 1, "6": "y", "7": -1})", &records) == 0);
+    CHECK_TRUE(records.size() == 1);
+    CHECK_TRUE(records[0].servlet_id == 5 && records[0].max_id == 9);
+    return 0;
+}
+
+static int test_not_json() {
+    std::vector<AutoIncrRecord> records;
+    CHECK_TRUE(AutoIncrStateMachine::parse_max_id_json("{\"1\":", &records) != 0);
+    CHECK_TRUE(AutoIncrStateMachine::parse_max_id_json("[1, 2]", &records) != 0);
+    CHECK_TRUE(records.empty());
+    return 0;
+}
+
+int main() {
+    if (test_legacy_snapshot() != 0 || test_skip_bad_members() != 0 || test_not_json() != 0) {
+        return 1;
+    }
+    printf("auto incr json snapshot test pass\n");
+    return 0;
+}
@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2024 EA group inc.
+// Author: Jeff.li lijippy@163.com
+// All rights reserved.
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published
+// by the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+// drives the lock free allocation gen_tso uses, several threads take ranges
+// from one TsoObj while another thread publishes new physical values the
+// way the timer does, no two ranges may overlap.
+
+#include <sirius/discovery/tso_state_machine.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using sirius::discovery::TsoObj;
+namespace tso = sirius::discovery::tso;
+
+#define CHECK_TRUE(cond)                                                        \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            fprintf(stderr, "%s:%d check fail: %s\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                           \
+        }                                                                       \
+    } while (0)
+
+static const int kThreads = 8;
+static const int kRounds = 20000;
+
+int main(int argc, char **argv) {
+    uint64_t start = 0;
+    {
+        TsoObj obj;
+        // no physical published yet
+        CHECK_TRUE(obj.alloc(1, &start) == -1);
+        obj.current_timestamp.store(tso::pack_timestamp(100, tso::max_logical() - 2));
+        CHECK_TRUE(obj.alloc(2, &start) == -2);
+        CHECK_TRUE(obj.alloc(1, &start) == 0);
+        CHECK_TRUE(tso::extract_physical(start) == 100);
+        CHECK_TRUE(tso::extract_logical(start) == tso::max_logical() - 2);
+        CHECK_TRUE(obj.alloc(1, &start) == -2);
+    }
+
+    TsoObj obj;
+    obj.current_timestamp.store(tso::pack_timestamp(1, 0));
+    std::atomic<bool> stop{false};
+    std::thread publisher([&obj, &stop]() {
+        int64_t physical = 1;
+        while (!stop.load()) {
+            obj.current_timestamp.store(tso::pack_timestamp(++physical, 0), std::memory_order_release);
+            std::this_thread::yield();
+        }
+    });
+
+    std::vector<std::vector<std::pair<uint64_t, int64_t>>> ranges(kThreads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < kThreads; ++t) {
+        workers.emplace_back([&obj, &ranges, t]() {
+            for (int i = 0; i < kRounds; ++i) {
+                int64_t count = 1 + (i % 7);
+                uint64_t first = 0;
+                while (obj.alloc(count, &first) != 0) {
+                    std::this_thread::yield();
+                }
+                ranges[t].emplace_back(first, count);
+            }
+        });
+    }
+    for (auto &w: workers) {
+        w.join();
+    }
+    stop.store(true);
+    publisher.join();
+
+    std::vector<std::pair<uint64_t, int64_t>> all;
+    for (auto &r: ranges) {
+        // every thread sees its own timestamps strictly increase
+        for (size_t i = 1; i < r.size(); ++i) {
+            CHECK_TRUE(r[i].first >= r[i - 1].first + r[i - 1].second);
+        }
+        all.insert(all.end(), r.begin(), r.end());
+    }
+    CHECK_TRUE(all.size() == static_cast<size_t>(kThreads) * kRounds);
+    std::sort(all.begin(), all.end());
+    for (size_t i = 0; i < all.size(); ++i) {
+        CHECK_TRUE(tso::extract_physical(all[i].first) > 0);
+        CHECK_TRUE(tso::extract_logical(all[i].first) + all[i].second < tso::max_logical());
+        if (i > 0) {
+            CHECK_TRUE(all[i].first >= all[i - 1].first + all[i - 1].second);
+        }
+    }
+    fprintf(stdout, "tso alloc ok\n");
+    return 0;
+}